@@ -162,6 +162,8 @@ SOURCES += \
     src/amount.cpp \
     src/arith_uint256.cpp \
     src/base58.cpp \
+    src/blockencodings.cpp \
+    src/blockprefetch.cpp \
     src/chain.cpp \
     src/chainparams.cpp \
     src/chainparamsbase.cpp \
@@ -450,6 +452,7 @@ HEADERS += \
     src/walletdb.h \
     src/init.h \
     src/mruset.h \
+    src/msgworkers.h \
     src/json/json_spirit_writer_template.h \
     src/json/json_spirit_writer.h \
     src/json/json_spirit_value.h \
@@ -490,8 +493,12 @@ HEADERS += \
     src/clientversion.h \
     src/bloom.h \
     src/checkqueue.h \
+    src/blockencodings.h \
+    src/blockprefetch.h \
     src/hash.h \
     src/limitedmap.h \
+    src/memusage.h \
+    src/support/pool.h \
     src/threadsafety.h \
     src/qt/macnotificationhandler.h \
     src/tinyformat.h \
@@ -704,6 +711,7 @@ SOURCES += \
     src/key.cpp \
     src/main.cpp \
     src/miner.cpp \
+    src/msgworkers.cpp \
     src/init.cpp \
     src/net.cpp \
     src/checkpoints.cpp \
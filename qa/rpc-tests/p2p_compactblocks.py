@@ -0,0 +1,80 @@
+#!/usr/bin/env python2
+# Copyright (c) 2018 The Blocknet developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Benchmark block propagation with and without compact blocks.
+#
+# Three nodes are connected in a line (0 - 1 - 2). For every round the
+# mempools are filled with transactions, node 0 mines a block and the time
+# until node 2 has it as its tip is measured, along with the bytes node 1
+# received while the block travelled. Run once with -compactblocks=0 and
+# once with -compactblocks=1; for example:
+#
+#   p2p_compactblocks.py --txs=200 --rounds=5
+#
+
+from test_framework import BitcoinTestFramework
+from util import *
+
+import time
+
+class CompactBlocksBench(BitcoinTestFramework):
+    def add_options(self, parser):
+        parser.add_option("--txs", dest="txs", default=100, type="int",
+                          help="Number of mempool transactions per block (default: %default)")
+        parser.add_option("--rounds", dest="rounds", default=5, type="int",
+                          help="Number of blocks per configuration (default: %default)")
+
+    def setup_network(self):
+        self.nodes = []
+
+    def bytes_received(self, node):
+        return sum(peer["bytesrecv"] for peer in node.getpeerinfo())
+
+    def run_one(self, compact):
+        args = ["-compactblocks=%d" % compact, "-debug=cmpctblock"]
+        self.nodes = start_nodes(3, self.options.tmpdir, [args] * 3)
+        try:
+            connect_nodes_bi(self.nodes, 0, 1)
+            connect_nodes_bi(self.nodes, 1, 2)
+            sync_blocks(self.nodes)
+
+            # Let node 1 and 2 see a block from their neighbour first, so that
+            # they ask for compact blocks to be pushed to them
+            self.nodes[0].setgenerate(True, 1)
+            sync_blocks(self.nodes)
+
+            address = self.nodes[2].getnewaddress()
+            times = []
+            sizes = []
+            for i in range(self.options.rounds):
+                for j in range(self.options.txs):
+                    self.nodes[0].sendtoaddress(address, 0.01)
+                sync_mempools(self.nodes)
+
+                before = self.bytes_received(self.nodes[1])
+                start = time.time()
+                self.nodes[0].setgenerate(True, 1)
+                tip = self.nodes[0].getbestblockhash()
+                while self.nodes[2].getbestblockhash() != tip:
+                    if time.time() - start > 60:
+                        raise AssertionError("block did not reach node 2 in time")
+                    time.sleep(0.005)
+                times.append(time.time() - start)
+                sizes.append(self.bytes_received(self.nodes[1]) - before)
+            return min(times), sum(times) / len(times), sum(sizes) / len(sizes)
+        finally:
+            stop_nodes(self.nodes)
+            wait_bitcoinds()
+            self.nodes = []
+
+    def run_test(self):
+        print("%-14s %12s %12s %14s" % ("compactblocks", "min(s)", "avg(s)", "bytes/block"))
+        for compact in (0, 1):
+            t_min, t_avg, size = self.run_one(compact)
+            print("%-14d %12.4f %12.4f %14d" % (compact, t_min, t_avg, size))
+
+if __name__ == '__main__':
+    CompactBlocksBench().main()
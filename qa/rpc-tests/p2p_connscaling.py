@@ -0,0 +1,170 @@
+#!/usr/bin/env python2
+# Copyright (c) 2018 The Blocknet developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Benchmark the socket handler with many loopback peers.
+#
+# For every -socketevents mode and peer count, a node is started and that
+# many raw P2P connections are opened to it. Reported are the time until all
+# handshakes completed and the time for a ping round trip on every connection
+# at once. Not part of the regular test run; for example:
+#
+#   p2p_connscaling.py --peers=100,500,1000 --modes=select,epoll
+#
+
+from test_framework import BitcoinTestFramework
+from util import *
+
+import hashlib
+import random
+import resource
+import select
+import socket
+import struct
+import time
+
+REGTEST_MAGIC = b"\xa1\xcf\x7e\xac"
+PROTOCOL_VERSION = 70712
+
+def sha256d(data):
+    return hashlib.sha256(hashlib.sha256(data).digest()).digest()
+
+def ser_addr(port):
+    return struct.pack("<Q", 1) + b"\x00" * 10 + b"\xff" * 2 + socket.inet_aton("127.0.0.1") + struct.pack(">H", port)
+
+class LoopbackPeer(object):
+    def __init__(self, port):
+        self.sock = socket.create_connection(("127.0.0.1", port))
+        self.sock.setblocking(0)
+        self.recvbuf = b""
+        self.sendbuf = b""
+        self.got_verack = False
+        self.got_pong = False
+
+    def push_message(self, command, payload=b""):
+        header = REGTEST_MAGIC + command.ljust(12, b"\x00") + struct.pack("<I", len(payload)) + sha256d(payload)[:4]
+        self.sendbuf += header + payload
+        self.flush()
+
+    def send_version(self, port):
+        subver = b"/connscaling:0.1/"
+        payload = struct.pack("<iQq", PROTOCOL_VERSION, 1, int(time.time()))
+        payload += ser_addr(port) + ser_addr(0)
+        payload += struct.pack("<Q", random.getrandbits(64))
+        payload += struct.pack("<B", len(subver)) + subver
+        payload += struct.pack("<i", 0)
+        self.push_message(b"version", payload)
+
+    def flush(self):
+        while self.sendbuf:
+            try:
+                n = self.sock.send(self.sendbuf)
+            except socket.error:
+                return
+            self.sendbuf = self.sendbuf[n:]
+
+    def read(self):
+        try:
+            data = self.sock.recv(65536)
+        except socket.error:
+            return
+        if not data:
+            raise IOError("connection closed by node")
+        self.recvbuf += data
+        while len(self.recvbuf) >= 24:
+            command = self.recvbuf[4:16].rstrip(b"\x00")
+            length = struct.unpack("<I", self.recvbuf[16:20])[0]
+            if len(self.recvbuf) < 24 + length:
+                return
+            payload = self.recvbuf[24:24 + length]
+            self.recvbuf = self.recvbuf[24 + length:]
+            if command == b"verack":
+                self.got_verack = True
+            elif command == b"ping":
+                self.push_message(b"pong", payload)
+            elif command == b"pong":
+                self.got_pong = True
+
+def wait_all(peers, done, timeout=120):
+    """Read from all peers until done(peer) holds for every one of them"""
+    poller = select.poll()
+    byfd = {}
+    for peer in peers:
+        poller.register(peer.sock.fileno(), select.POLLIN)
+        byfd[peer.sock.fileno()] = peer
+    pending = set(peer for peer in peers if not done(peer))
+    deadline = time.time() + timeout
+    while pending:
+        if time.time() > deadline:
+            raise AssertionError("%d of %d peers did not respond in time" % (len(pending), len(peers)))
+        for fd, _ in poller.poll(1000):
+            peer = byfd[fd]
+            peer.read()
+            if done(peer):
+                pending.discard(peer)
+
+class ConnScalingBench(BitcoinTestFramework):
+    def add_options(self, parser):
+        parser.add_option("--peers", dest="peers", default="50,200,800",
+                          help="Comma separated list of peer counts (default: %default)")
+        parser.add_option("--modes", dest="modes", default="select,epoll",
+                          help="Comma separated list of -socketevents modes (default: %default)")
+        parser.add_option("--pings", dest="pings", default=5, type="int",
+                          help="Number of ping rounds per configuration (default: %default)")
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 1)
+
+    def setup_network(self):
+        self.nodes = []
+
+    def run_one(self, mode, count):
+        self.nodes = [start_node(0, self.options.tmpdir, ["-socketevents=" + mode, "-maxconnections=%d" % (count + 16), "-listen=1"])]
+        port = p2p_port(0)
+        try:
+            start = time.time()
+            peers = []
+            for i in range(count):
+                peer = LoopbackPeer(port)
+                peer.send_version(port)
+                peers.append(peer)
+            wait_all(peers, lambda peer: peer.got_verack)
+            connect_time = time.time() - start
+            for peer in peers:
+                peer.push_message(b"verack")
+
+            rounds = []
+            for i in range(self.options.pings):
+                start = time.time()
+                for peer in peers:
+                    peer.got_pong = False
+                    peer.push_message(b"ping", struct.pack("<Q", random.getrandbits(64)))
+                wait_all(peers, lambda peer: peer.got_pong)
+                rounds.append(time.time() - start)
+
+            assert_equal(self.nodes[0].getconnectioncount(), count)
+            for peer in peers:
+                peer.sock.close()
+            return connect_time, min(rounds), sum(rounds) / len(rounds)
+        finally:
+            stop_node(self.nodes[0], 0)
+            self.nodes = []
+
+    def run_test(self):
+        soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+        resource.setrlimit(resource.RLIMIT_NOFILE, (hard, hard))
+
+        print("%-8s %6s %12s %12s %12s" % ("mode", "peers", "connect(s)", "ping min(s)", "ping avg(s)"))
+        for mode in self.options.modes.split(","):
+            for count in [int(n) for n in self.options.peers.split(",")]:
+                if mode == "select" and count + 64 > 1024:
+                    print("%-8s %6d %12s" % (mode, count, "n/a (FD_SETSIZE)"))
+                    continue
+                connect_time, ping_min, ping_avg = self.run_one(mode, count)
+                print("%-8s %6d %12.3f %12.4f %12.4f" % (mode, count, connect_time, ping_min, ping_avg))
+
+if __name__ == '__main__':
+    ConnScalingBench().main()
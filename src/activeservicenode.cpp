@@ -300,7 +300,7 @@ bool CActiveServicenode::Register(CTxIn vin, CService service, CKey keyCollatera
         CServicenode mn(mnb);
         mnodeman.Add(mn);
     } else {
-        pmn->UpdateFromNewBroadcast(mnb);
+        mnodeman.UpdateFromNewBroadcast(*pmn, mnb);
     }
 
     //send to all peers
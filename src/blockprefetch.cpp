@@ -0,0 +1,231 @@
+// Copyright (c) 2018 The Blocknet developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockprefetch.h"
+
+#include "chainparams.h"
+#include "clientversion.h"
+#include "main.h"
+#include "util.h"
+
+#include <boost/foreach.hpp>
+
+void CBlockPrefetcher::Prefetch(const std::vector<std::pair<uint256, CDiskBlockPos> >& vBlocks)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    queue.clear();
+    setWanted.clear();
+    typedef std::pair<uint256, CDiskBlockPos> BlockRef;
+    BOOST_FOREACH (const BlockRef& ref, vBlocks) {
+        setWanted.insert(ref.first);
+        if (!mapReady.count(ref.first) && ref.first != hashLoading)
+            queue.push_back(ref);
+    }
+    // Forget blocks that were read ahead but are no longer going to be connected
+    std::map<uint256, boost::shared_ptr<CBlock> >::iterator it = mapReady.begin();
+    while (it != mapReady.end()) {
+        if (setWanted.count(it->first))
+            ++it;
+        else
+            mapReady.erase(it++);
+    }
+    condWorker.notify_one();
+}
+
+bool CBlockPrefetcher::Take(const uint256& hash, boost::shared_ptr<CBlock>& pblock)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (hash == hashLoading)
+        condReady.wait(lock);
+    setWanted.erase(hash);
+    std::map<uint256, boost::shared_ptr<CBlock> >::iterator it = mapReady.find(hash);
+    if (it == mapReady.end()) {
+        // Not read yet; the caller will read it itself, so make sure the worker doesn't.
+        for (std::deque<std::pair<uint256, CDiskBlockPos> >::iterator qi = queue.begin(); qi != queue.end(); ++qi) {
+            if (qi->first == hash) {
+                queue.erase(qi);
+                break;
+            }
+        }
+        nMisses++;
+        return false;
+    }
+    pblock = it->second;
+    mapReady.erase(it);
+    nHits++;
+    condWorker.notify_one();
+    return true;
+}
+
+void CBlockPrefetcher::Clear()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    queue.clear();
+    setWanted.clear();
+    mapReady.clear();
+}
+
+void CBlockPrefetcher::Thread(unsigned int nMaxReadyIn)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nMaxReady = std::max(1U, nMaxReadyIn);
+    }
+    while (true) {
+        std::pair<uint256, CDiskBlockPos> ref;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (queue.empty() || mapReady.size() >= nMaxReady)
+                condWorker.wait(lock); // interruption point
+            ref = queue.front();
+            queue.pop_front();
+            hashLoading = ref.first;
+        }
+
+        // Read, deserialize and hash outside the lock. Failures are left to
+        // the consumer, which will read the block again and report the error.
+        boost::shared_ptr<CBlock> pblock(new CBlock());
+        bool fOk = false;
+        try {
+            fOk = ReadBlockFromDisk(*pblock, ref.second) && pblock->GetHash() == ref.first;
+        } catch (const std::exception& e) {
+            LogPrint("bench", "%s : error reading block %s: %s\n", __func__, ref.first.ToString(), e.what());
+        }
+
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            hashLoading.SetNull();
+            if (fOk && setWanted.count(ref.first))
+                mapReady[ref.first] = pblock;
+        }
+        condReady.notify_all();
+    }
+}
+
+void CBlockPrefetcher::GetStats(uint64_t& nHitsOut, uint64_t& nMissesOut)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    nHitsOut = nHits;
+    nMissesOut = nMisses;
+}
+
+
+CBlockFileReader::CBlockFileReader(FILE* fileIn, unsigned int nMaxQueueIn) : blkdat(fileIn, 2 * MAX_BLOCK_SIZE, MAX_BLOCK_SIZE + 8, SER_DISK, CLIENT_VERSION),
+                                                                             nRewind(0),
+                                                                             fEof(false),
+                                                                             nMaxQueue(nMaxQueueIn),
+                                                                             fQuit(false)
+{
+    nRewind = blkdat.GetPos();
+    if (nMaxQueue > 0)
+        thread = boost::thread(&CBlockFileReader::ThreadRead, this);
+}
+
+CBlockFileReader::~CBlockFileReader()
+{
+    if (thread.joinable()) {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fQuit = true;
+        }
+        condProducer.notify_all();
+        thread.join();
+    }
+}
+
+bool CBlockFileReader::ReadNext(Entry& entry)
+{
+    try {
+        while (!blkdat.eof()) {
+            blkdat.SetPos(nRewind);
+            nRewind++;         // start one byte further next time, in case of failure
+            blkdat.SetLimit(); // remove former limit
+            unsigned int nSize = 0;
+            try {
+                // locate a header
+                unsigned char buf[MESSAGE_START_SIZE];
+                blkdat.FindByte(Params().MessageStart()[0]);
+                nRewind = blkdat.GetPos() + 1;
+                blkdat >> FLATDATA(buf);
+                if (memcmp(buf, Params().MessageStart(), MESSAGE_START_SIZE))
+                    continue;
+                // read size
+                blkdat >> nSize;
+                if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
+                    continue;
+            } catch (const std::exception&) {
+                // no valid block header found; don't complain
+                return false;
+            }
+            try {
+                // read block
+                uint64_t nBlockPos = blkdat.GetPos();
+                blkdat.SetLimit(nBlockPos + nSize);
+                blkdat.SetPos(nBlockPos);
+                entry.pblock.reset(new CBlock());
+                blkdat >> *entry.pblock;
+                nRewind = blkdat.GetPos();
+                entry.hash = entry.pblock->GetHash();
+                entry.nPos = nBlockPos;
+                return true;
+            } catch (std::exception& e) {
+                LogPrintf("%s : Deserialize or I/O error - %s", __func__, e.what());
+            }
+        }
+    } catch (std::runtime_error& e) {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        strError = e.what();
+    }
+    return false;
+}
+
+void CBlockFileReader::ThreadRead()
+{
+    RenameThread("blocknetdx-blkread");
+    while (true) {
+        Entry entry;
+        bool fHave = ReadNext(entry);
+
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (!fHave) {
+            fEof = true;
+            condConsumer.notify_all();
+            return;
+        }
+        while (!fQuit && queue.size() >= nMaxQueue)
+            condProducer.wait(lock);
+        if (fQuit)
+            return;
+        queue.push_back(entry);
+        condConsumer.notify_all();
+    }
+}
+
+bool CBlockFileReader::Next(boost::shared_ptr<CBlock>& pblock, uint256& hash, uint64_t& nPos)
+{
+    Entry entry;
+    if (nMaxQueue == 0) {
+        if (!ReadNext(entry))
+            return false;
+    } else {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (queue.empty() && !fEof)
+            condConsumer.wait(lock); // interruption point
+        if (queue.empty())
+            return false;
+        entry = queue.front();
+        queue.pop_front();
+        condProducer.notify_all();
+    }
+    pblock = entry.pblock;
+    hash = entry.hash;
+    nPos = entry.nPos;
+    return true;
+}
+
+std::string CBlockFileReader::GetError()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return strError;
+}
@@ -0,0 +1,144 @@
+// Copyright (c) 2018 The Blocknet developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKPREFETCH_H
+#define BITCOIN_BLOCKPREFETCH_H
+
+#include "chain.h"
+#include "primitives/block.h"
+#include "streams.h"
+#include "uint256.h"
+
+#include <deque>
+#include <map>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+/** Default for -blockprefetch, number of blocks read ahead of validation (0 = disabled) */
+static const int DEFAULT_BLOCK_PREFETCH = 16;
+/** Maximum for -blockprefetch */
+static const int MAX_BLOCK_PREFETCH = 256;
+
+/**
+ * Reads blocks that are about to be connected from disk on a background
+ * thread, so that ConnectTip usually finds the next block already
+ * deserialized in memory instead of alternating between disk and CPU.
+ *
+ * The chain activation code (holding cs_main) hands over the hashes and
+ * disk positions of the blocks it is going to connect, in order. One worker
+ * thread reads and hashes them into a bounded set of ready blocks, which
+ * ConnectTip then takes. Anything the prefetcher cannot provide is simply
+ * read synchronously by the caller as before.
+ */
+class CBlockPrefetcher
+{
+private:
+    //! Mutex to protect the inner state
+    boost::mutex mutex;
+
+    //! Worker thread blocks on this when there is nothing to read, or no room to store it
+    boost::condition_variable condWorker;
+
+    //! Consumers block on this while the block they want is being read
+    boost::condition_variable condReady;
+
+    //! Blocks still to be read, in connection order
+    std::deque<std::pair<uint256, CDiskBlockPos> > queue;
+
+    //! Hashes of all blocks requested by the last call to Prefetch()
+    std::set<uint256> setWanted;
+
+    //! Blocks that have been read and are waiting to be taken
+    std::map<uint256, boost::shared_ptr<CBlock> > mapReady;
+
+    //! Hash of the block the worker is reading right now (null if none)
+    uint256 hashLoading;
+
+    //! Maximum number of blocks kept in mapReady
+    unsigned int nMaxReady;
+
+    //! Statistics
+    uint64_t nHits;
+    uint64_t nMisses;
+
+public:
+    CBlockPrefetcher() : nMaxReady(0), nHits(0), nMisses(0) {}
+
+    /** Replace the set of blocks to read ahead. Blocks are read in the order given. */
+    void Prefetch(const std::vector<std::pair<uint256, CDiskBlockPos> >& vBlocks);
+
+    /**
+     * Take a prefetched block. Waits if the block is being read right now,
+     * returns false if it was not (yet) requested or could not be read.
+     */
+    bool Take(const uint256& hash, boost::shared_ptr<CBlock>& pblock);
+
+    /** Drop everything that is queued or ready */
+    void Clear();
+
+    /** Worker thread; reads at most nMaxReadyIn blocks ahead of the consumer */
+    void Thread(unsigned int nMaxReadyIn);
+
+    void GetStats(uint64_t& nHitsOut, uint64_t& nMissesOut);
+};
+
+/**
+ * Parses a blk?????.dat formatted file and hands out the blocks it contains
+ * (deserialized and hashed) together with their file offsets.
+ *
+ * With a non-zero queue size, parsing runs on its own thread into a bounded
+ * queue so that -reindex and -loadblock overlap reading with validation;
+ * with zero, Next() parses inline. Takes over fileIn, which is closed when
+ * the reader is destroyed.
+ */
+class CBlockFileReader
+{
+private:
+    struct Entry {
+        boost::shared_ptr<CBlock> pblock;
+        uint256 hash;
+        uint64_t nPos;
+    };
+
+    CBufferedFile blkdat;
+    uint64_t nRewind;
+    bool fEof;
+    std::string strError;
+
+    boost::mutex mutex;
+    boost::condition_variable condProducer;
+    boost::condition_variable condConsumer;
+    std::deque<Entry> queue;
+    unsigned int nMaxQueue;
+    bool fQuit;
+    boost::thread thread;
+
+    /** Parse the next block from the file; returns false at end of file or on a fatal error */
+    bool ReadNext(Entry& entry);
+    void ThreadRead();
+
+    // disable copy
+    CBlockFileReader(const CBlockFileReader&);
+    CBlockFileReader& operator=(const CBlockFileReader&);
+
+public:
+    CBlockFileReader(FILE* fileIn, unsigned int nMaxQueueIn);
+    ~CBlockFileReader();
+
+    /** Get the next block in the file. Returns false once the file is exhausted. */
+    bool Next(boost::shared_ptr<CBlock>& pblock, uint256& hash, uint64_t& nPos);
+
+    /** Non-empty if reading stopped because of a system error rather than end of file */
+    std::string GetError();
+};
+
+#endif // BITCOIN_BLOCKPREFETCH_H
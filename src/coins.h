@@ -7,8 +7,10 @@
 #define BITCOIN_COINS_H
 
 #include "compressor.h"
+#include "memusage.h"
 #include "script/standard.h"
 #include "serialize.h"
+#include "support/pool.h"
 #include "uint256.h"
 #include "undo.h"
 
@@ -283,6 +285,15 @@ public:
                 return false;
         return true;
     }
+
+    size_t DynamicMemoryUsage() const
+    {
+        size_t ret = memusage::DynamicUsage(vout);
+        BOOST_FOREACH (const CTxOut& out, vout) {
+            ret += memusage::DynamicUsage(out.scriptPubKey);
+        }
+        return ret;
+    }
 };
 
 class CCoinsKeyHasher
@@ -316,7 +327,12 @@ struct CCoinsCacheEntry {
     CCoinsCacheEntry() : coins(), flags(0) {}
 };
 
-typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
+/**
+ * Map of cached coins. Its nodes are allocated from a per-cache CPoolResource,
+ * which saves one malloc per entry and keeps the entries of a cache together.
+ */
+typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher, std::equal_to<uint256>,
+    pool_allocator<std::pair<const uint256, CCoinsCacheEntry> > > CCoinsMap;
 
 struct CCoinsStats {
     int nHeight;
@@ -398,7 +414,8 @@ class CCoinsModifier
 private:
     CCoinsViewCache& cache;
     CCoinsMap::iterator it;
-    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_);
+    size_t cachedCoinUsage; // Cached memory usage of the CCoins object before modification
+    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage);
 
 public:
     CCoins* operator->() { return &it->second.coins; }
@@ -419,8 +436,12 @@ protected:
      * declared as "const".  
      */
     mutable uint256 hashBlock;
+    mutable CPoolResource cacheResource;
     mutable CCoinsMap cacheCoins;
 
+    /* Cached dynamic memory usage for the inner CCoins objects. */
+    mutable size_t cachedCoinsUsage;
+
 public:
     CCoinsViewCache(CCoinsView* baseIn);
     ~CCoinsViewCache();
@@ -456,6 +477,9 @@ public:
     //! Calculate the size of the cache (in number of transactions)
     unsigned int GetCacheSize() const;
 
+    //! Calculate the size of the cache (in bytes)
+    size_t DynamicMemoryUsage() const;
+
     /** 
      * Amount of blocknetdx coming in to a transaction
      * Note that lightweight clients may not know anything besides the hash of previous transactions,
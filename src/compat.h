@@ -46,6 +46,14 @@
 #include <unistd.h>
 #endif
 
+// Linux can wait on sockets of any number with poll() and epoll instead of select()
+#ifdef __linux__
+#define USE_POLL
+#define USE_EPOLL
+#include <poll.h>
+#include <sys/epoll.h>
+#endif
+
 #ifdef WIN32
 #define MSG_DONTWAIT 0
 #else
@@ -93,6 +101,7 @@ typedef u_int SOCKET;
 size_t strnlen( const char *start, size_t max_len);
 #endif // HAVE_DECL_STRNLEN
 
+/** Whether select() can wait on this socket; not needed with poll() or epoll */
 bool static inline IsSelectableSocket(SOCKET s)
 {
 #ifdef WIN32
@@ -15,6 +15,8 @@
 #include "activeservicenode.h"
 #include "addrman.h"
 #include "amount.h"
+#include "blockencodings.h"
+#include "blockprefetch.h"
 #include "checkpoints.h"
 #include "compat/sanity.h"
 #include "key.h"
@@ -24,6 +26,7 @@
 #include "servicenodeconfig.h"
 #include "servicenodeman.h"
 #include "miner.h"
+#include "msgworkers.h"
 #include "net.h"
 #include "rpcserver.h"
 #include "script/standard.h"
@@ -215,6 +218,8 @@ void PrepareShutdown()
         LOCK(cs_main);
         if (pcoinsTip != NULL) {
             FlushStateToDisk();
+            if (GetBoolArg("-blockindexsnapshot", DEFAULT_BLOCKINDEX_SNAPSHOT))
+                WriteBlockIndexSnapshot();
 
             //record that client took the proper shutdown procedure
             pblocktree->WriteFlag("shutdown", true);
@@ -223,6 +228,8 @@ void PrepareShutdown()
         pcoinsTip = NULL;
         delete pcoinscatcher;
         pcoinscatcher = NULL;
+        delete pcoinsflush;
+        pcoinsflush = NULL;
         delete pcoinsdbview;
         pcoinsdbview = NULL;
         delete pblocktree;
@@ -330,7 +337,11 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-version", _("Print version and exit"));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
     strUsage += HelpMessageOpt("-alerts", strprintf(_("Receive and display P2P network alerts (default: %u)"), DEFAULT_ALERTS));
+    strUsage += HelpMessageOpt("-backgroundflush", strprintf(_("Write the coin database on a background thread while validation continues; may use up to twice -dbcache while a write is in progress (default: %u)"), DEFAULT_BACKGROUND_FLUSH));
+    strUsage += HelpMessageOpt("-blockindexsnapshot", strprintf(_("Save the block index to a snapshot file on shutdown and load it on the next startup instead of scanning the block index database (default: %u)"), DEFAULT_BLOCKINDEX_SNAPSHOT));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
+    strUsage += HelpMessageOpt("-blockprefetch=<n>", strprintf(_("Number of blocks to read from disk ahead of validation during reindex and sync (0 to %d, 0 = disabled, default: %d)"), MAX_BLOCK_PREFETCH, DEFAULT_BLOCK_PREFETCH));
+    strUsage += HelpMessageOpt("-blockservecache=<n>", strprintf(_("Memory for recently served blocks kept ready to send to other peers, in megabytes (0 = disabled, default: %u)"), DEFAULT_BLOCK_SERVE_CACHE));
     strUsage += HelpMessageOpt("-checkblocks=<n>", strprintf(_("How many blocks to check at startup (default: %u, 0 = all)"), 500));
     strUsage += HelpMessageOpt("-checklevel=<n>", strprintf(_("How thorough the block verification of -checkblocks is (0-4, default: %u)"), 3));
     strUsage += HelpMessageOpt("-conf=<file>", strprintf(_("Specify configuration file (default: %s)"), "blocknetdx.conf"));
@@ -343,6 +354,9 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file") + " " + _("on startup"));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+    strUsage += HelpMessageOpt("-maxorphantxsize=<n>", strprintf(_("Keep at most <n> kilobytes of unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS_SIZE));
+    strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
+    strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"), -(int)boost::thread::hardware_concurrency(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), "blocknetdxd.pid"));
@@ -359,6 +373,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-banscore=<n>", strprintf(_("Threshold for disconnecting misbehaving peers (default: %u)"), 100));
     strUsage += HelpMessageOpt("-bantime=<n>", strprintf(_("Number of seconds to keep misbehaving peers from reconnecting (default: %u)"), 86400));
     strUsage += HelpMessageOpt("-bind=<addr>", _("Bind to given address and always listen on it. Use [host]:port notation for IPv6"));
+    strUsage += HelpMessageOpt("-compactblocks", strprintf(_("Relay new blocks as header and short transaction ids to peers supporting it, and fetch them that way (default: %u)"), DEFAULT_COMPACT_BLOCKS));
     strUsage += HelpMessageOpt("-connect=<ip>", _("Connect only to the specified node(s)"));
     strUsage += HelpMessageOpt("-discover", _("Discover own IP address (default: 1 when listening and no -externalip)"));
     strUsage += HelpMessageOpt("-dns", _("Allow DNS lookups for -addnode, -seednode and -connect") + " " + _("(default: 1)"));
@@ -369,6 +384,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-maxconnections=<n>", strprintf(_("Maintain at most <n> connections to peers (default: %u)"), 125));
     strUsage += HelpMessageOpt("-maxreceivebuffer=<n>", strprintf(_("Maximum per-connection receive buffer, <n>*1000 bytes (default: %u)"), 5000));
     strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)"), 1000));
+    strUsage += HelpMessageOpt("-msgworkers=<n>", strprintf(_("Number of threads processing servicenode, budget, XBridge and XRouter messages next to block and transaction relay (0 to %d, 0 = disabled, default: %d)"), MAX_MESSAGE_WORKERS, DEFAULT_MESSAGE_WORKERS));
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", _("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
     strUsage += HelpMessageOpt("-permitbaremultisig", strprintf(_("Relay non-P2SH multisig (default: %u)"), 1));
@@ -376,6 +392,9 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-port=<port>", strprintf(_("Listen for connections on <port> (default: %u or testnet: %u)"), 41412, 41474));
     strUsage += HelpMessageOpt("-proxy=<ip:port>", _("Connect through SOCKS5 proxy"));
     strUsage += HelpMessageOpt("-seednode=<ip>", _("Connect to a node to retrieve peer addresses, and disconnect"));
+#ifdef USE_EPOLL
+    strUsage += HelpMessageOpt("-socketevents=<mode>", strprintf(_("Socket events mode, which must be one of: %s (default: %s)"), "select, epoll", DEFAULT_SOCKETEVENTS));
+#endif
     strUsage += HelpMessageOpt("-timeout=<n>", strprintf(_("Specify connection timeout in milliseconds (minimum: 1, default: %d)"), DEFAULT_CONNECT_TIMEOUT));
 #ifdef USE_UPNP
 #if USE_UPNP
@@ -429,6 +448,11 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-checkblockindex", strprintf("Do a full consistency check for mapBlockIndex, setBlockIndexCandidates, chainActive and mapBlocksUnlinked occasionally. Also sets -checkmempool (default: %u)", Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
         strUsage += HelpMessageOpt("-checkmempool=<n>", strprintf("Run checks every <n> transactions (default: %u)", Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
         strUsage += HelpMessageOpt("-checkpoints", strprintf(_("Only accept block chain matching built-in checkpoints (default: %u)"), 1));
+        strUsage += HelpMessageOpt("-<db>bloombits=<n>", _("Bits per key of the LevelDB bloom filter, 0 = none; <db> is chainstate or blockindex (default: 10)"));
+        strUsage += HelpMessageOpt("-<db>blocksize=<n>", _("Approximate LevelDB block size in bytes (default: 4096)"));
+        strUsage += HelpMessageOpt("-<db>compression", _("Compress LevelDB blocks with snappy, if available (default: 0)"));
+        strUsage += HelpMessageOpt("-<db>maxopenfiles=<n>", _("Number of LevelDB table files kept open (default: 64)"));
+        strUsage += HelpMessageOpt("-<db>writebuffer=<n>", _("LevelDB write buffer size in megabytes, 0 = a quarter of the database cache (default: 0)"));
         strUsage += HelpMessageOpt("-dblogsize=<n>", strprintf(_("Flush database activity from memory pool to disk log every <n> megabytes (default: %u)"), 100));
         strUsage += HelpMessageOpt("-disablesafemode", strprintf(_("Disable safemode, override a real safe mode event (default: %u)"), 0));
         strUsage += HelpMessageOpt("-testsafemode", strprintf(_("Force safe mode (default: %u)"), 0));
@@ -455,6 +479,10 @@ std::string HelpMessage(HelpMessageMode mode)
     if (GetBoolArg("-help-debug", false)) {
         strUsage += HelpMessageOpt("-limitfreerelay=<n>", strprintf(_("Continuously rate-limit free transactions to <n>*1000 bytes per minute (default:%u)"), 15));
         strUsage += HelpMessageOpt("-relaypriority", strprintf(_("Require high priority for relaying free or low-fee transactions (default:%u)"), 1));
+        strUsage += HelpMessageOpt("-limitancestorcount=<n>", strprintf("Do not accept transactions if number of in-mempool ancestors is <n> or more (default: %u)", DEFAULT_ANCESTOR_LIMIT));
+        strUsage += HelpMessageOpt("-limitancestorsize=<n>", strprintf("Do not accept transactions whose size with all in-mempool ancestors exceeds <n> kilobytes (default: %u)", DEFAULT_ANCESTOR_SIZE_LIMIT));
+        strUsage += HelpMessageOpt("-limitdescendantcount=<n>", strprintf("Do not accept transactions if any ancestor would have <n> or more in-mempool descendants (default: %u)", DEFAULT_DESCENDANT_LIMIT));
+        strUsage += HelpMessageOpt("-limitdescendantsize=<n>", strprintf("Do not accept transactions if any ancestor would have more than <n> kilobytes of in-mempool descendants (default: %u).", DEFAULT_DESCENDANT_SIZE_LIMIT));
         strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf(_("Limit size of signature cache to <n> entries (default: %u)"), 50000));
     }
     strUsage += HelpMessageOpt("-minrelaytxfee=<amt>", strprintf(_("Fees (in BLOCK/Kb) smaller than this are considered zero fee for relaying (default: %s)"), FormatMoney(::minRelayTxFee.GetFeePerK())));
@@ -795,10 +823,25 @@ bool AppInit2(int argc, char* argv[], boost::thread_group& threadGroup)
         }
     }
 
+    // select() can only wait on sockets below FD_SETSIZE, epoll is limited by the file descriptor limit alone.
+    // Only count on that once the epoll instance exists, creating it can fail.
+    int nSocketFDs = FD_SETSIZE;
+    std::string strSocketEvents = GetArg("-socketevents", DEFAULT_SOCKETEVENTS);
+#ifdef USE_EPOLL
+    if (strSocketEvents == "epoll") {
+        if (InitSocketEvents())
+            nSocketFDs = std::numeric_limits<int>::max() / 2;
+    } else if (strSocketEvents != "select")
+        return InitError(strprintf(_("Invalid -socketevents ('%s') specified. Only these modes are supported: %s"), strSocketEvents, "select, epoll"));
+#else
+    if (strSocketEvents != "select")
+        return InitError(strprintf(_("Invalid -socketevents ('%s') specified. Only these modes are supported: %s"), strSocketEvents, "select"));
+#endif
+
     // Make sure enough file descriptors are available
     int nFD{0};
     int nBind = std::max((int)mapArgs.count("-bind") + (int)mapArgs.count("-whitebind"), 1);
-    if (!CNode::SetMaxConnections(FD_SETSIZE, MIN_CORE_FILEDESCRIPTORS, nBind, nFD))
+    if (!CNode::SetMaxConnections(nSocketFDs, MIN_CORE_FILEDESCRIPTORS, nBind, nFD))
         return InitError(_("Not enough file descriptors available."));
 
     // ********************************************************* Step 3: parameter-to-internal-flags
@@ -836,6 +879,26 @@ bool AppInit2(int argc, char* argv[], boost::thread_group& threadGroup)
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
+    nBlockPrefetch = GetArg("-blockprefetch", DEFAULT_BLOCK_PREFETCH);
+    if (nBlockPrefetch < 0)
+        nBlockPrefetch = 0;
+    else if (nBlockPrefetch > MAX_BLOCK_PREFETCH)
+        nBlockPrefetch = MAX_BLOCK_PREFETCH;
+
+    nBlockServeCacheSize = std::max(GetArg("-blockservecache", DEFAULT_BLOCK_SERVE_CACHE), (int64_t)0) << 20;
+
+    // mempool limits
+    int64_t nMempoolSizeMax = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
+    int64_t nMempoolSizeMin = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT) * 1000 * 40;
+    if (nMempoolSizeMax < 0 || nMempoolSizeMax < nMempoolSizeMin)
+        return InitError(strprintf(_("-maxmempool must be at least %d MB"), (nMempoolSizeMin + 999999) / 1000000));
+
+    nMessageWorkers = GetArg("-msgworkers", DEFAULT_MESSAGE_WORKERS);
+    if (nMessageWorkers < 0)
+        nMessageWorkers = 0;
+    else if (nMessageWorkers > MAX_MESSAGE_WORKERS)
+        nMessageWorkers = MAX_MESSAGE_WORKERS;
+
     fServer = GetBoolArg("-server", false);
     setvbuf(stdout, NULL, _IOLBF, 0); /// ***TODO*** do we still need this after -printtoconsole is gone?
 
@@ -911,6 +974,9 @@ bool AppInit2(int argc, char* argv[], boost::thread_group& threadGroup)
 //    nMaxDatacarrierBytes = GetArg("-datacarriersize", nMaxDatacarrierBytes); // No longer configurable
 
     fAlerts = GetBoolArg("-alerts", DEFAULT_ALERTS);
+    fCompactBlocks = GetBoolArg("-compactblocks", DEFAULT_COMPACT_BLOCKS);
+    if (fCompactBlocks)
+        nLocalServices |= NODE_COMPACT_BLOCKS;
 
 
     if (GetBoolArg("-peerbloomfilters", false))
@@ -967,10 +1033,21 @@ bool AppInit2(int argc, char* argv[], boost::thread_group& threadGroup)
 
     LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
-        for (int i = 0; i < nScriptCheckThreads - 1; i++)
+        for (int i = 0; i < nScriptCheckThreads - 1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadTxScriptCheck);
+            threadGroup.create_thread(&ThreadBudgetVoteCheck);
+        }
     }
 
+    LogPrintf("Reading up to %d blocks ahead of validation\n", nBlockPrefetch);
+    if (nBlockPrefetch)
+        threadGroup.create_thread(&ThreadBlockPrefetch);
+
+    LogPrintf("Using %d threads for message processing next to the message handler\n", nMessageWorkers);
+    for (int i = 0; i < nMessageWorkers; i++)
+        threadGroup.create_thread(&ThreadMessageWorker);
+
     if (mapArgs.count("-sporkkey")) // spork priv key
     {
         if (!sporkManager.SetPrivKey(GetArg("-sporkkey", "")))
@@ -1255,7 +1332,7 @@ bool AppInit2(int argc, char* argv[], boost::thread_group& threadGroup)
     nTotalCache -= nBlockTreeDBCache;
     size_t nCoinDBCache = nTotalCache / 2; // use half of the remaining cache for coindb cache
     nTotalCache -= nCoinDBCache;
-    nCoinCacheSize = nTotalCache / 300; // coins in memory require around 300 bytes
+    nCoinCacheUsage = nTotalCache; // the in-memory coins cache gets whatever is left
 
     bool fLoaded = false;
     while (!fLoaded) {
@@ -1269,13 +1346,15 @@ bool AppInit2(int argc, char* argv[], boost::thread_group& threadGroup)
             try {
                 UnloadBlockIndex();
                 delete pcoinsTip;
-                delete pcoinsdbview;
                 delete pcoinscatcher;
+                delete pcoinsflush;
+                delete pcoinsdbview;
                 delete pblocktree;
 
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex);
-                pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
+                pcoinsflush = new CCoinsViewBackgroundFlush(pcoinsdbview, GetBoolArg("-backgroundflush", DEFAULT_BACKGROUND_FLUSH));
+                pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsflush);
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
 
                 if (fReindex)
@@ -27,14 +27,39 @@ void HandleError(const leveldb::Status& status) throw(leveldb_error)
     throw leveldb_error("Unknown database error");
 }
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+CLevelDBOptions CLevelDBOptions::FromArgs(const std::string& strPrefix, const CLevelDBOptions& defaults)
+{
+    CLevelDBOptions dbopts;
+    dbopts.nBloomBits = std::max(0, (int)GetArg("-" + strPrefix + "bloombits", defaults.nBloomBits));
+    dbopts.nBlockSize = std::max((int64_t)1024, GetArg("-" + strPrefix + "blocksize", defaults.nBlockSize));
+    dbopts.fCompression = GetBoolArg("-" + strPrefix + "compression", defaults.fCompression);
+    dbopts.nWriteBufferSize = std::max((int64_t)0, GetArg("-" + strPrefix + "writebuffer", defaults.nWriteBufferSize >> 20)) << 20;
+    dbopts.nMaxOpenFiles = std::max(20, (int)GetArg("-" + strPrefix + "maxopenfiles", defaults.nMaxOpenFiles));
+    return dbopts;
+}
+
+std::string CLevelDBOptions::ToString() const
+{
+    return strprintf("bloombits=%d blocksize=%u compression=%d writebuffer=%s maxopenfiles=%d",
+        nBloomBits, nBlockSize, fCompression, nWriteBufferSize ? strprintf("%uMiB", nWriteBufferSize >> 20) : "auto", nMaxOpenFiles);
+}
+
+static leveldb::Options GetOptions(size_t nCacheSize, const CLevelDBOptions& dbopts)
 {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
-    options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
+    if (dbopts.nWriteBufferSize == 0) {
+        options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
+        options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
+    } else {
+        // up to two write buffers may be held in memory simultaneously; the block cache gets the rest
+        size_t nBuffers = 2 * dbopts.nWriteBufferSize;
+        options.block_cache = leveldb::NewLRUCache(nCacheSize > nBuffers + (nCacheSize / 4) ? nCacheSize - nBuffers : nCacheSize / 4);
+        options.write_buffer_size = dbopts.nWriteBufferSize;
+    }
+    options.filter_policy = dbopts.nBloomBits > 0 ? leveldb::NewBloomFilterPolicy(dbopts.nBloomBits) : NULL;
+    options.block_size = dbopts.nBlockSize;
+    options.compression = dbopts.fCompression ? leveldb::kSnappyCompression : leveldb::kNoCompression;
+    options.max_open_files = dbopts.nMaxOpenFiles;
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
         // on corruption in later versions.
@@ -43,14 +68,14 @@ static leveldb::Options GetOptions(size_t nCacheSize)
     return options;
 }
 
-CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe)
+CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe, const CLevelDBOptions& dbopts)
 {
     penv = NULL;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    options = GetOptions(nCacheSize, dbopts);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -61,7 +86,7 @@ CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& path, size_t nCa
             leveldb::DestroyDB(path.string(), options);
         }
         TryCreateDirectory(path);
-        LogPrintf("Opening LevelDB in %s\n", path.string());
+        LogPrintf("Opening LevelDB in %s (%s)\n", path.string(), dbopts.ToString());
     }
     leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
     HandleError(status);
@@ -24,6 +24,30 @@ public:
 
 void HandleError(const leveldb::Status& status) throw(leveldb_error);
 
+/**
+ * Tunable LevelDB parameters of a single database. Each database reads its
+ * own overrides from -<name>bloombits, -<name>blocksize, -<name>compression,
+ * -<name>writebuffer and -<name>maxopenfiles, where <name> is the prefix
+ * passed to FromArgs() (e.g. "chainstate" or "blockindex").
+ */
+struct CLevelDBOptions {
+    //! bits per key of the bloom filter, 0 = no filter
+    int nBloomBits;
+    //! approximate amount of user data per block, in bytes
+    size_t nBlockSize;
+    //! whether to compress blocks (if LevelDB was built with snappy)
+    bool fCompression;
+    //! size of one write buffer in bytes, 0 = a quarter of the cache size
+    size_t nWriteBufferSize;
+    //! number of table files LevelDB may keep open
+    int nMaxOpenFiles;
+
+    CLevelDBOptions() : nBloomBits(10), nBlockSize(4096), fCompression(false), nWriteBufferSize(0), nMaxOpenFiles(64) {}
+
+    static CLevelDBOptions FromArgs(const std::string& strPrefix, const CLevelDBOptions& defaults = CLevelDBOptions());
+    std::string ToString() const;
+};
+
 /** Batch of changes queued to be written to a CLevelDBWrapper */
 class CLevelDBBatch
 {
@@ -86,7 +110,7 @@ private:
     leveldb::DB* pdb;
 
 public:
-    CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, const CLevelDBOptions& dbopts = CLevelDBOptions());
     ~CLevelDBWrapper();
 
     template <typename K, typename V>
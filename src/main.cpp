@@ -11,6 +11,8 @@
 
 #include "addrman.h"
 #include "alert.h"
+#include "blockencodings.h"
+#include "blockprefetch.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
@@ -20,6 +22,7 @@
 #include "servicenode-payments.h"
 #include "servicenodeman.h"
 #include "merkleblock.h"
+#include "msgworkers.h"
 #include "net.h"
 #include "obfuscation.h"
 #include "pow.h"
@@ -65,12 +68,16 @@ int64_t nTimeBestReceived = 0;
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
+int nBlockPrefetch = 0;
+int nMessageWorkers = 0;
+size_t nBlockServeCacheSize = DEFAULT_BLOCK_SERVE_CACHE << 20;
+bool fCompactBlocks = DEFAULT_COMPACT_BLOCKS;
 bool fImporting = false;
 bool fReindex = false;
 bool fTxIndex = true;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
-unsigned int nCoinCacheSize = 5000;
+size_t nCoinCacheUsage = 5000 * 300;
 bool fAlerts = DEFAULT_ALERTS;
 CoinValidator &coinValidator = CoinValidator::instance();
 
@@ -87,9 +94,23 @@ CTxMemPool mempool(::minRelayTxFee);
 struct COrphanTx {
     CTransaction tx;
     NodeId fromPeer;
+    int64_t nTimeExpire;
+    unsigned int nSize;
 };
 map<uint256, COrphanTx> mapOrphanTransactions;
-map<uint256, set<uint256> > mapOrphanTransactionsByPrev;
+struct IteratorComparator {
+    template <typename I>
+    bool operator()(const I& a, const I& b) const
+    {
+        return &(*a) < &(*b);
+    }
+};
+typedef map<uint256, COrphanTx>::iterator OrphanIter;
+typedef set<OrphanIter, IteratorComparator> setOrphanIters;
+map<COutPoint, setOrphanIters> mapOrphanTransactionsByPrev;
+map<NodeId, setOrphanIters> mapOrphanTransactionsByPeer;
+size_t nOrphanTransactionsSize = 0;
+static COrphanStats orphanStats;
 map<uint256, int64_t> mapRejectedBlocks;
 
 
@@ -291,6 +312,12 @@ struct CNodeState {
     int nBlocksInFlight;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
+    //! Compact block from this peer waiting for the "blocktxn" with the transactions we lack.
+    boost::shared_ptr<PartiallyDownloadedBlock> partialBlock;
+    //! Since when partialBlock is waiting (in microseconds).
+    int64_t nPartialBlockTime;
+    //! Blocks we asked this peer to send as "cmpctblock", and when (in microseconds).
+    std::map<uint256, int64_t> mapCompactBlocksRequested;
 
     CNodeState()
         : fCurrentlyConnected(false)
@@ -302,6 +329,7 @@ struct CNodeState {
         , nStallingSince(0)
         , nBlocksInFlight(0)
         , fPreferredDownload(false)
+        , nPartialBlockTime(0)
     {
     }
 };
@@ -309,6 +337,9 @@ struct CNodeState {
 /** Map maintaining per-node state. Requires cs_main. */
 map<NodeId, CNodeState> mapNodeState;
 
+/** Peers asked to push new blocks to us as "cmpctblock", least recently useful first. Requires cs_main. */
+list<NodeId> lNodesAnnouncingHeaderAndIDs;
+
 // Requires cs_main.
 CNodeState* State(NodeId pnode)
 {
@@ -365,6 +396,7 @@ void FinalizeNode(NodeId nodeid)
         mapBlocksInFlight.erase(entry.hash);
     EraseOrphansFor(nodeid);
     nPreferredDownload -= state->fPreferredDownload;
+    lNodesAnnouncingHeaderAndIDs.remove(nodeid);
 
     mapNodeState.erase(nodeid);
 }
@@ -434,6 +466,37 @@ void UpdateBlockAvailability(NodeId nodeid, const uint256& hash)
     }
 }
 
+/**
+ * pfrom just gave us a new tip. Ask it to push future blocks to us as
+ * "cmpctblock" right away, and keep that up for the last few such peers only,
+ * so we don't get every block from every peer. Requires cs_main.
+ */
+void MaybeSetPeerAsAnnouncingHeaderAndIDs(CNode* pfrom)
+{
+    if (!fCompactBlocks || !pfrom->fSupportsCompactBlocks)
+        return;
+
+    list<NodeId>::iterator it = std::find(lNodesAnnouncingHeaderAndIDs.begin(), lNodesAnnouncingHeaderAndIDs.end(), pfrom->GetId());
+    if (it != lNodesAnnouncingHeaderAndIDs.end()) {
+        lNodesAnnouncingHeaderAndIDs.splice(lNodesAnnouncingHeaderAndIDs.end(), lNodesAnnouncingHeaderAndIDs, it);
+        return;
+    }
+
+    LOCK(cs_vNodes);
+    if (lNodesAnnouncingHeaderAndIDs.size() >= MAX_COMPACT_BLOCK_ANNOUNCERS) {
+        NodeId nodeid = lNodesAnnouncingHeaderAndIDs.front();
+        lNodesAnnouncingHeaderAndIDs.pop_front();
+        BOOST_FOREACH (CNode* pnode, vNodes) {
+            if (pnode->GetId() == nodeid) {
+                pnode->PushMessage("sendcmpct", false, COMPACT_BLOCKS_ENCODING_VERSION);
+                break;
+            }
+        }
+    }
+    pfrom->PushMessage("sendcmpct", true, COMPACT_BLOCKS_ENCODING_VERSION);
+    lNodesAnnouncingHeaderAndIDs.push_back(pfrom->GetId());
+}
+
 /** Find the last common ancestor two blocks have.
  *  Both pa and pb must be non-NULL. */
 CBlockIndex* LastCommonAncestor(CBlockIndex* pa, CBlockIndex* pb)
@@ -590,6 +653,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 
 CCoinsViewCache* pcoinsTip = NULL;
 CBlockTreeDB* pblocktree = NULL;
+CCoinsViewBackgroundFlush* pcoinsflush = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -612,65 +676,137 @@ bool AddOrphanTx(const CTransaction& tx, NodeId peer)
     unsigned int sz = tx.GetSerializeSize(SER_NETWORK, CTransaction::CURRENT_VERSION);
     if (sz > 5000) {
         LogPrint("mempool", "ignoring large orphan tx (size: %u, hash: %s)\n", sz, hash.ToString());
+        orphanStats.nRejected++;
         return false;
     }
 
-    mapOrphanTransactions[hash].tx = tx;
-    mapOrphanTransactions[hash].fromPeer = peer;
+    OrphanIter it = mapOrphanTransactions.insert(make_pair(hash, COrphanTx())).first;
+    it->second.tx = tx;
+    it->second.fromPeer = peer;
+    it->second.nTimeExpire = GetTime() + ORPHAN_TX_EXPIRE_TIME;
+    it->second.nSize = sz;
     BOOST_FOREACH (const CTxIn& txin, tx.vin)
-        mapOrphanTransactionsByPrev[txin.prevout.hash].insert(hash);
+        mapOrphanTransactionsByPrev[txin.prevout].insert(it);
+    mapOrphanTransactionsByPeer[peer].insert(it);
+    nOrphanTransactionsSize += sz;
+    orphanStats.nAdded++;
 
-    LogPrint("mempool", "stored orphan tx %s (mapsz %u prevsz %u)\n", hash.ToString(),
-        mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size());
+    LogPrint("mempool", "stored orphan tx %s (mapsz %u prevsz %u bytes %u)\n", hash.ToString(),
+        mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size(), nOrphanTransactionsSize);
     return true;
 }
 
-void static EraseOrphanTx(uint256 hash)
+static void EraseOrphanTx(OrphanIter it)
 {
-    map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.find(hash);
-    if (it == mapOrphanTransactions.end())
-        return;
     BOOST_FOREACH (const CTxIn& txin, it->second.tx.vin) {
-        map<uint256, set<uint256> >::iterator itPrev = mapOrphanTransactionsByPrev.find(txin.prevout.hash);
+        map<COutPoint, setOrphanIters>::iterator itPrev = mapOrphanTransactionsByPrev.find(txin.prevout);
         if (itPrev == mapOrphanTransactionsByPrev.end())
             continue;
-        itPrev->second.erase(hash);
+        itPrev->second.erase(it);
         if (itPrev->second.empty())
             mapOrphanTransactionsByPrev.erase(itPrev);
     }
+    map<NodeId, setOrphanIters>::iterator itPeer = mapOrphanTransactionsByPeer.find(it->second.fromPeer);
+    if (itPeer != mapOrphanTransactionsByPeer.end()) {
+        itPeer->second.erase(it);
+        if (itPeer->second.empty())
+            mapOrphanTransactionsByPeer.erase(itPeer);
+    }
+    nOrphanTransactionsSize -= it->second.nSize;
     mapOrphanTransactions.erase(it);
 }
 
+void static EraseOrphanTx(uint256 hash)
+{
+    OrphanIter it = mapOrphanTransactions.find(hash);
+    if (it != mapOrphanTransactions.end())
+        EraseOrphanTx(it);
+}
+
 void EraseOrphansFor(NodeId peer)
 {
-    int nErased = 0;
-    map<uint256, COrphanTx>::iterator iter = mapOrphanTransactions.begin();
-    while (iter != mapOrphanTransactions.end()) {
-        map<uint256, COrphanTx>::iterator maybeErase = iter++; // increment to avoid iterator becoming invalid
-        if (maybeErase->second.fromPeer == peer) {
-            EraseOrphanTx(maybeErase->second.tx.GetHash());
-            ++nErased;
+    map<NodeId, setOrphanIters>::iterator itPeer = mapOrphanTransactionsByPeer.find(peer);
+    if (itPeer == mapOrphanTransactionsByPeer.end())
+        return;
+    // Copy, erasing the last orphan of the peer erases the set
+    setOrphanIters setErase(itPeer->second);
+    BOOST_FOREACH (OrphanIter it, setErase)
+        EraseOrphanTx(it);
+    orphanStats.nErasedForPeer += setErase.size();
+    LogPrint("mempool", "Erased %d orphan tx from peer %d\n", setErase.size(), peer);
+}
+
+/** Erase the orphans a block included or made impossible by spending their inputs */
+static void EraseOrphansForBlock(const CBlock& block)
+{
+    vector<OrphanIter> vErase;
+    BOOST_FOREACH (const CTransaction& tx, block.vtx) {
+        BOOST_FOREACH (const CTxIn& txin, tx.vin) {
+            map<COutPoint, setOrphanIters>::iterator itPrev = mapOrphanTransactionsByPrev.find(txin.prevout);
+            if (itPrev == mapOrphanTransactionsByPrev.end())
+                continue;
+            vErase.insert(vErase.end(), itPrev->second.begin(), itPrev->second.end());
         }
     }
-    if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx from peer %d\n", nErased, peer);
+    // An orphan can spend several outputs the block spent
+    std::sort(vErase.begin(), vErase.end(), IteratorComparator());
+    vErase.erase(std::unique(vErase.begin(), vErase.end()), vErase.end());
+    BOOST_FOREACH (OrphanIter it, vErase)
+        EraseOrphanTx(it);
+    if (!vErase.empty()) {
+        orphanStats.nErasedForBlock += vErase.size();
+        LogPrint("mempool", "Erased %d orphan tx included or conflicted by block\n", vErase.size());
+    }
 }
 
-
-unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans)
+unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans, size_t nMaxOrphansSize)
 {
     unsigned int nEvicted = 0;
-    while (mapOrphanTransactions.size() > nMaxOrphans) {
+    static int64_t nNextSweep;
+    int64_t nNow = GetTime();
+    if (nNextSweep <= nNow) {
+        // Sweep out expired orphan pool entries:
+        int nErased = 0;
+        int64_t nMinExpTime = nNow + ORPHAN_TX_EXPIRE_TIME - ORPHAN_TX_EXPIRE_INTERVAL;
+        OrphanIter iter = mapOrphanTransactions.begin();
+        while (iter != mapOrphanTransactions.end()) {
+            OrphanIter maybeErase = iter++;
+            if (maybeErase->second.nTimeExpire <= nNow) {
+                EraseOrphanTx(maybeErase);
+                ++nErased;
+            } else {
+                nMinExpTime = std::min(maybeErase->second.nTimeExpire, nMinExpTime);
+            }
+        }
+        // Sweeping again 5 minutes after the next entry that expires in order to batch the linear scan.
+        nNextSweep = nMinExpTime + ORPHAN_TX_EXPIRE_INTERVAL;
+        orphanStats.nExpired += nErased;
+        if (nErased > 0)
+            LogPrint("mempool", "Erased %d orphan tx due to expiration\n", nErased);
+    }
+    while (!mapOrphanTransactions.empty() &&
+           (mapOrphanTransactions.size() > nMaxOrphans || nOrphanTransactionsSize > nMaxOrphansSize)) {
         // Evict a random orphan:
         uint256 randomhash = GetRandHash();
-        map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.lower_bound(randomhash);
+        OrphanIter it = mapOrphanTransactions.lower_bound(randomhash);
         if (it == mapOrphanTransactions.end())
             it = mapOrphanTransactions.begin();
-        EraseOrphanTx(it->first);
+        EraseOrphanTx(it);
         ++nEvicted;
     }
+    orphanStats.nEvicted += nEvicted;
     return nEvicted;
 }
 
+void GetOrphanStats(COrphanStats& stats)
+{
+    AssertLockHeld(cs_main);
+    stats = orphanStats;
+    stats.nOrphans = mapOrphanTransactions.size();
+    stats.nBytes = nOrphanTransactionsSize;
+    stats.nPeers = mapOrphanTransactionsByPeer.size();
+}
+
 bool IsStandardTx(const CTransaction& tx, string& reason)
 {
     AssertLockHeld(cs_main);
@@ -1115,7 +1251,16 @@ CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowF
 }
 
 
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee, bool ignoreFees)
+void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age)
+{
+    int expired = pool.Expire(GetTime() - age);
+    if (expired != 0)
+        LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
+
+    pool.TrimToSize(limit);
+}
+
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee, bool ignoreFees, bool fOverrideMempoolLimit)
 {
     AssertLockHeld(cs_main);
     if (pfMissingInputs)
@@ -1255,6 +1400,13 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
                                         hash.ToString(), nFees, txMinFee),
                     REJECT_INSUFFICIENTFEE, "insufficient fee");
 
+            // A full mempool raises the bar for everything that wants in
+            CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+            if (mempoolRejectFee > 0 && nFees < mempoolRejectFee)
+                return state.DoS(0, error("AcceptToMemoryPool : mempool min fee not met %s, %d < %d",
+                                        hash.ToString(), nFees, mempoolRejectFee),
+                    REJECT_INSUFFICIENTFEE, "mempool min fee not met");
+
             // Require that free transactions have sufficient priority to be mined in the next block.
             if (GetBoolArg("-relaypriority", true) && nFees < ::minRelayTxFee.GetFee(nSize) && !AllowFree(view.GetPriority(tx, chainActive.Height() + 1))) {
                 return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "insufficient priority");
@@ -1289,6 +1441,17 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
                 hash.ToString(),
                 nFees, ::minRelayTxFee.GetFee(nSize) * 10000);
 
+        // Calculate in-mempool ancestors, up to a limit.
+        CTxMemPool::setEntries setAncestors;
+        size_t nLimitAncestors = GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+        size_t nLimitAncestorSize = GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT) * 1000;
+        size_t nLimitDescendants = GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+        size_t nLimitDescendantSize = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT) * 1000;
+        std::string errString;
+        if (!pool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString))
+            return state.DoS(0, error("AcceptToMemoryPool : too long mempool chain %s: %s", hash.ToString(), errString),
+                REJECT_NONSTANDARD, "too-long-mempool-chain");
+
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
         if (!CheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true)) {
@@ -1309,7 +1472,14 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
         }
 
         // Store transaction in memory
-        pool.addUnchecked(hash, entry);
+        pool.addUnchecked(hash, entry, setAncestors);
+
+        // trim mempool and check if tx was trimmed
+        if (!fOverrideMempoolLimit) {
+            LimitMempoolSize(pool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+            if (!pool.exists(hash))
+                return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
+        }
     }
 
     SyncWithWallets(tx, NULL);
@@ -1630,6 +1800,33 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
     return true;
 }
 
+bool ReadRawBlockFromDisk(CDataStream& ss, const CDiskBlockPos& pos)
+{
+    // The block is preceded by the network magic and its size
+    if (pos.nPos < MESSAGE_START_SIZE + sizeof(unsigned int))
+        return error("%s : invalid position %u in file %d", __func__, pos.nPos, pos.nFile);
+    CDiskBlockPos posHeader(pos.nFile, pos.nPos - MESSAGE_START_SIZE - sizeof(unsigned int));
+    CAutoFile filein(OpenBlockFile(posHeader, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s : OpenBlockFile failed", __func__);
+
+    try {
+        unsigned char pchMessageStart[MESSAGE_START_SIZE];
+        unsigned int nSize;
+        filein >> FLATDATA(pchMessageStart) >> nSize;
+        if (memcmp(pchMessageStart, Params().MessageStart(), MESSAGE_START_SIZE) != 0)
+            return error("%s : no block at position %u in file %d", __func__, pos.nPos, pos.nFile);
+        if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
+            return error("%s : invalid block size %u at position %u in file %d", __func__, nSize, pos.nPos, pos.nFile);
+        size_t nOffset = ss.size();
+        ss.resize(nOffset + nSize);
+        filein.read(&ss[nOffset], nSize);
+    } catch (std::exception& e) {
+        return error("%s : I/O error - %s", __func__, e.what());
+    }
+    return true;
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
 {
     if (!ReadBlockFromDisk(block, pindex->GetBlockPos()))
@@ -1800,12 +1997,13 @@ void CheckForkWarningConditionsOnNewFork(CBlockIndex* pindexNewForkTip)
     CheckForkWarningConditions();
 }
 
+//! Misbehavior reported while cs_main was taken by another thread, applied by SendMessages
+static CCriticalSection cs_vPendingMisbehavior;
+static std::vector<std::pair<NodeId, int> > vPendingMisbehavior;
+
 // Requires cs_main.
-void Misbehaving(NodeId pnode, int howmuch)
+static void AddMisbehavior(NodeId pnode, int howmuch)
 {
-    if (howmuch == 0)
-        return;
-
     CNodeState* state = State(pnode);
     if (state == NULL)
         return;
@@ -1819,6 +2017,28 @@ void Misbehaving(NodeId pnode, int howmuch)
         LogPrintf("Misbehaving: %s (%d -> %d)\n", state->name, state->nMisbehavior - howmuch, state->nMisbehavior);
 }
 
+void Misbehaving(NodeId pnode, int howmuch)
+{
+    if (howmuch == 0)
+        return;
+
+    // Message workers get here without cs_main. Rather than waiting for it
+    // while holding their own locks, they leave the score for SendMessages.
+    if (CMessageWorkers::IsWorkerThread()) {
+        TRY_LOCK(cs_main, lockMain);
+        if (!lockMain) {
+            LOCK(cs_vPendingMisbehavior);
+            vPendingMisbehavior.push_back(std::make_pair(pnode, howmuch));
+            return;
+        }
+        AddMisbehavior(pnode, howmuch);
+        return;
+    }
+
+    LOCK(cs_main);
+    AddMisbehavior(pnode, howmuch);
+}
+
 void static InvalidChainFound(CBlockIndex* pindexNew)
 {
     if (!pindexBestInvalid || pindexNew->nChainWork > pindexBestInvalid->nChainWork)
@@ -2099,6 +2319,86 @@ void ThreadScriptCheck()
     scriptcheckqueue.Thread();
 }
 
+// Loose transactions get their own queue, block validation holds cs_main
+// while it uses scriptcheckqueue and a queue serves one caller at a time
+static CCheckQueue<CScriptCheck> txcheckqueue(16);
+static boost::mutex csTxCheckQueue;
+
+void ThreadTxScriptCheck()
+{
+    RenameThread("blocknetdx-txcheck");
+    txcheckqueue.Thread();
+}
+
+bool PreverifyTransaction(CTxMemPool& pool, const CTransaction& tx)
+{
+    // Context free checks first, no point in fetching the coins of junk
+    CValidationState state;
+    if (!CheckTransaction(tx, state) || tx.IsCoinBase() || tx.IsCoinStake())
+        return false;
+    string reason;
+    if (Params().RequireStandard() && !IsStandardTx(tx, reason))
+        return false;
+
+    // Fetch the spent coins and run the inexpensive input checks; only this needs cs_main
+    std::vector<CScriptCheck> vChecks;
+    CCoinsView dummy;
+    CCoinsViewCache view(&dummy);
+    {
+        LOCK2(cs_main, pool.cs);
+        if (pool.exists(tx.GetHash()))
+            return false;
+
+        // Like AcceptToMemoryPool, turn away what it would reject for free
+        // before paying for the signatures: mempool conflicts and low fees
+        BOOST_FOREACH (const CTxIn& txin, tx.vin) {
+            if (pool.mapNextTx.count(txin.prevout))
+                return false;
+        }
+
+        CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
+        view.SetBackend(viewMemPool);
+        bool fOk = view.HaveInputs(tx);
+        if (fOk) {
+            CAmount nFees = view.GetValueIn(tx) - tx.GetValueOut();
+            unsigned int nSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+            if (nFees < GetMinRelayFee(tx, nSize, true))
+                fOk = false;
+            else if (GetBoolArg("-relaypriority", true) && nFees < ::minRelayTxFee.GetFee(nSize) &&
+                     !AllowFree(view.GetPriority(tx, chainActive.Height() + 1)))
+                fOk = false;
+        }
+        fOk = fOk && (!Params().RequireStandard() || AreInputsStandard(tx, view)) &&
+              CheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true, &vChecks);
+        view.SetBackend(dummy);
+        if (!fOk)
+            return false;
+    }
+
+    // The checks hold copies of the spent scripts; verify them in parallel if
+    // nobody else is using the queue. Valid signatures end up in the cache.
+    boost::unique_lock<boost::mutex> lock(csTxCheckQueue, boost::try_to_lock);
+    if (nScriptCheckThreads && lock.owns_lock() && vChecks.size() > 1) {
+        CCheckQueueControl<CScriptCheck> control(&txcheckqueue);
+        control.Add(vChecks);
+        return control.Wait();
+    }
+    BOOST_FOREACH (CScriptCheck& check, vChecks) {
+        if (!check())
+            return false;
+    }
+    return true;
+}
+
+static CBlockPrefetcher blockprefetcher;
+static CMessageWorkers messageworkers;
+
+void ThreadBlockPrefetch()
+{
+    RenameThread("blocknetdx-prefetch");
+    blockprefetcher.Thread(nBlockPrefetch);
+}
+
 //static unsigned int GetBlockScriptFlags(const CBlockIndex* pindex) {
 //    AssertLockHeld(cs_main);
 
@@ -2360,7 +2660,7 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
     static int64_t nLastWrite = 0;
     try {
         if ((mode == FLUSH_STATE_ALWAYS) ||
-            ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->GetCacheSize() > nCoinCacheSize) ||
+            ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->DynamicMemoryUsage() > nCoinCacheUsage) ||
             (mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000)) {
             // Typical CCoins structures on disk are around 100 bytes in size.
             // Pushing a new one to the database can cause it to be written
@@ -2391,8 +2691,12 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
             }
             pblocktree->Sync();
             // Finally flush the chainstate (which may refer to block index entries).
+            // With -backgroundflush this only hands the dirty coins to the writer
+            // thread, unless the caller needs them on disk right now.
             if (!pcoinsTip->Flush())
                 return state.Abort("Failed to write to coin database");
+            if (mode == FLUSH_STATE_ALWAYS && pcoinsflush && !pcoinsflush->Sync())
+                return state.Abort("Failed to write to coin database");
             // Update best block in wallet (so we can detect restored wallets).
             if (mode != FLUSH_STATE_IF_NEEDED) {
                 g_signals.SetBestChain(chainActive.GetLocator());
@@ -2420,10 +2724,10 @@ void static UpdateTip(CBlockIndex* pindexNew)
     nTimeBestReceived = GetTime();
     mempool.AddTransactionsUpdated(1);
 
-    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%u\n",
+    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%.1fMiB(%utx)\n",
         chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height(), log(chainActive.Tip()->nChainWork.getdouble()) / log(2.0), (unsigned long)chainActive.Tip()->nChainTx,
         DateTimeStrFormat("%Y-%m-%d %H:%M:%S", chainActive.Tip()->GetBlockTime()),
-              SyncProgress(chainActive.Height()), (unsigned int)pcoinsTip->GetCacheSize());
+              SyncProgress(chainActive.Height()), pcoinsTip->DynamicMemoryUsage() * (1.0 / (1 << 20)), (unsigned int)pcoinsTip->GetCacheSize());
 
     cvBlockChange.notify_all();
 
@@ -2471,14 +2775,25 @@ bool static DisconnectTip(CValidationState& state)
     if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
         return false;
     // Resurrect mempool transactions from the disconnected block.
+    std::vector<uint256> vHashUpdate;
     BOOST_FOREACH (const CTransaction& tx, block.vtx) {
         // ignore validation errors in resurrected transactions
         list<CTransaction> removed;
         CValidationState stateDummy;
-        if (tx.IsCoinBase() || tx.IsCoinStake() || !AcceptToMemoryPool(mempool, stateDummy, tx, false, NULL))
+        if (tx.IsCoinBase() || tx.IsCoinStake() || !AcceptToMemoryPool(mempool, stateDummy, tx, false, NULL, false, false, true)) {
             mempool.remove(tx, removed, true);
+        } else if (mempool.exists(tx.GetHash())) {
+            vHashUpdate.push_back(tx.GetHash());
+        }
     }
+    // AcceptToMemoryPool/addUnchecked all assume that new mempool entries have
+    // no in-mempool children, which is generally not true when adding
+    // previously-confirmed transactions back to the mempool.
+    // UpdateTransactionsFromBlock finds descendants of any transactions in this
+    // block that were added back and cleans up the mempool state.
+    mempool.UpdateTransactionsFromBlock(vHashUpdate);
     mempool.removeCoinbaseSpends(pcoinsTip, pindexDelete->nHeight);
+    LimitMempoolSize(mempool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
     mempool.check(pcoinsTip);
     // Update chainActive and related variables.
     UpdateTip(pindexDelete->pprev);
@@ -2506,13 +2821,18 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, CBlock*
     mempool.check(pcoinsTip);
     CCoinsViewCache view(pcoinsTip);
 
-    // Read block from disk.
+    // Read block from disk, unless the prefetcher already did.
     int64_t nTime1 = GetTimeMicros();
     CBlock block;
+    boost::shared_ptr<CBlock> pblockPrefetched;
     if (!pblock) {
-        if (!ReadBlockFromDisk(block, pindexNew))
-            return state.Abort("Failed to read block");
-        pblock = &block;
+        if (nBlockPrefetch && blockprefetcher.Take(pindexNew->GetBlockHash(), pblockPrefetched)) {
+            pblock = pblockPrefetched.get();
+        } else {
+            if (!ReadBlockFromDisk(block, pindexNew))
+                return state.Abort("Failed to read block");
+            pblock = &block;
+        }
     }
     // Apply the block atomically to the chain state.
     int64_t nTime2 = GetTimeMicros();
@@ -2551,6 +2871,7 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, CBlock*
     // Remove conflicting transactions from the mempool.
     list<CTransaction> txConflicted;
     mempool.removeForBlock(pblock->vtx, pindexNew->nHeight, txConflicted);
+    EraseOrphansForBlock(*pblock);
     mempool.check(pcoinsTip);
     // Update chainActive & related variables.
     UpdateTip(pindexNew);
@@ -2762,6 +3083,19 @@ static bool ActivateBestChainStep(CValidationState& state, CBlockIndex* pindexMo
         }
         nHeight = nTargetHeight;
 
+        // Start reading the blocks we are about to connect in the background.
+        if (nBlockPrefetch) {
+            std::vector<std::pair<uint256, CDiskBlockPos> > vToPrefetch;
+            vToPrefetch.reserve(vpindexToConnect.size());
+            BOOST_REVERSE_FOREACH (CBlockIndex* pindexConnect, vpindexToConnect) {
+                if (pindexConnect == pindexMostWork && pblock)
+                    continue;
+                if (pindexConnect->nStatus & BLOCK_HAVE_DATA)
+                    vToPrefetch.push_back(std::make_pair(pindexConnect->GetBlockHash(), pindexConnect->GetBlockPos()));
+            }
+            blockprefetcher.Prefetch(vToPrefetch);
+        }
+
         // Connect new blocks.
         BOOST_REVERSE_FOREACH (CBlockIndex* pindexConnect, vpindexToConnect) {
             if (!ConnectTip(state, pindexConnect, pindexConnect == pindexMostWork ? pblock : NULL)) {
@@ -2835,13 +3169,30 @@ bool ActivateBestChain(CValidationState& state, CBlock* pblock)
         // Notifications/callbacks that can run without cs_main
         if (!fInitialDownload) {
             uint256 hashNewTip = pindexNewTip->GetBlockHash();
+            CInv inv(MSG_BLOCK, hashNewTip);
             // Relay inventory, but don't relay old inventory during initial block download.
+            // Peers that asked for it get the block right away as compact block, built once for all of them.
             int nBlockEstimate = Checkpoints::GetTotalBlocksEstimate();
+            bool fCompact = fCompactBlocks && pblock && pblock->GetHash() == hashNewTip;
+            CSerializedNetMsg msgCmpctBlock;
             {
                 LOCK(cs_vNodes);
-                BOOST_FOREACH (CNode* pnode, vNodes)
-                    if (chainActive.Height() > (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
-                        pnode->PushInventory(CInv(MSG_BLOCK, hashNewTip));
+                BOOST_FOREACH (CNode* pnode, vNodes) {
+                    if (chainActive.Height() <= (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
+                        continue;
+                    if (fCompact && pnode->fPreferHeaderAndIDs) {
+                        {
+                            LOCK(pnode->cs_inventory);
+                            if (pnode->filterInventoryKnown.contains(inv.hash))
+                                continue;
+                        }
+                        if (!msgCmpctBlock)
+                            msgCmpctBlock = MakeNetMsg("cmpctblock", CBlockHeaderAndShortTxIDs(*pblock));
+                        pnode->PushSerializedMessage(msgCmpctBlock);
+                        pnode->AddInventoryKnown(inv);
+                    } else
+                        pnode->PushInventory(inv);
+                }
             }
             // Notify external listeners about the new tip.
             uiInterface.NotifyBlockTip(hashNewTip);
@@ -3731,24 +4082,245 @@ CBlockIndex* InsertBlockIndex(uint256 hash)
     return pindexNew;
 }
 
+/** Version of the block index snapshot file format */
+static const int BLOCK_INDEX_SNAPSHOT_VERSION = 1;
+
+/** Block index entries loaded from a snapshot live in one allocation instead of one per entry */
+static CBlockIndex* pindexSnapshotArena = NULL;
+static size_t nSnapshotArenaSize = 0;
+
+static boost::filesystem::path GetBlockIndexSnapshotPath()
+{
+    return GetDataDir() / "blockindex.dat";
+}
+
+static void RemoveBlockIndexSnapshot()
+{
+    boost::system::error_code ec;
+    boost::filesystem::remove(GetBlockIndexSnapshotPath(), ec);
+}
+
+/**
+ * The snapshot holds every block index entry ordered by height, with its
+ * predecessor and skip pointers stored as positions in that order, its chain
+ * work and its proof of stake hash, so that none of them have to be looked up
+ * or recomputed on load. It is followed by a checksum of the whole content.
+ */
+bool WriteBlockIndexSnapshot()
+{
+    AssertLockHeld(cs_main);
+    int64_t nStart = GetTimeMillis();
+
+    vector<pair<int, CBlockIndex*> > vSortedByHeight;
+    vSortedByHeight.reserve(mapBlockIndex.size());
+    for (const PAIRTYPE(const uint256, CBlockIndex*) & item : mapBlockIndex)
+        vSortedByHeight.push_back(make_pair(item.second->nHeight, item.second));
+    sort(vSortedByHeight.begin(), vSortedByHeight.end());
+
+    boost::unordered_map<const CBlockIndex*, uint32_t> mapPosition;
+    mapPosition.reserve(vSortedByHeight.size());
+    for (uint32_t nPos = 0; nPos < vSortedByHeight.size(); nPos++)
+        mapPosition[vSortedByHeight[nPos].second] = nPos;
+
+    CDataStream ssSnapshot(SER_DISK, CLIENT_VERSION);
+    ssSnapshot << FLATDATA(Params().MessageStart());
+    ssSnapshot << BLOCK_INDEX_SNAPSHOT_VERSION;
+    ssSnapshot << pcoinsTip->GetBestBlock();
+    ssSnapshot << (uint32_t)vSortedByHeight.size();
+    BOOST_FOREACH (const PAIRTYPE(int, CBlockIndex*) & item, vSortedByHeight) {
+        CBlockIndex* pindex = item.second;
+        uint32_t nPrev = pindex->pprev ? mapPosition[pindex->pprev] : std::numeric_limits<uint32_t>::max();
+        uint32_t nSkip = pindex->pskip ? mapPosition[pindex->pskip] : std::numeric_limits<uint32_t>::max();
+        ssSnapshot << pindex->GetBlockHash() << nPrev << nSkip << CDiskBlockIndex(pindex) << pindex->nChainWork;
+        if (pindex->IsProofOfStake())
+            ssSnapshot << pindex->hashProofOfStake;
+    }
+    uint256 hash = Hash(ssSnapshot.begin(), ssSnapshot.end());
+    ssSnapshot << hash;
+
+    boost::filesystem::path pathSnapshot = GetBlockIndexSnapshotPath();
+    CAutoFile fileout(fopen(pathSnapshot.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull())
+        return error("%s : Failed to open file %s", __func__, pathSnapshot.string());
+    try {
+        fileout << ssSnapshot;
+    } catch (std::exception& e) {
+        fileout.fclose();
+        RemoveBlockIndexSnapshot();
+        return error("%s : Serialize or I/O error - %s", __func__, e.what());
+    }
+    FileCommit(fileout.Get());
+    fileout.fclose();
+
+    LogPrintf("%s: wrote %u entries in %dms\n", __func__, vSortedByHeight.size(), GetTimeMillis() - nStart);
+    return true;
+}
+
+/**
+ * Load the block index from the snapshot written at the last shutdown. The
+ * file is removed right away, so a snapshot is never used twice or after an
+ * unclean shutdown. Returns false (with mapBlockIndex untouched) if there is
+ * no usable snapshot, in which case the caller falls back to the block tree
+ * database. On success vSortedByHeight receives all entries in height order.
+ */
+static bool ReadBlockIndexSnapshot(vector<pair<int, CBlockIndex*> >& vSortedByHeight, bool fLastShutdownWasPrepared)
+{
+    boost::filesystem::path pathSnapshot = GetBlockIndexSnapshotPath();
+    if (!boost::filesystem::exists(pathSnapshot))
+        return false;
+    int64_t nStart = GetTimeMillis();
+
+    // Read the whole file with a single sequential read
+    vector<unsigned char> vchData;
+    uint256 hashIn;
+    {
+        CAutoFile filein(fopen(pathSnapshot.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("%s : Failed to open file %s", __func__, pathSnapshot.string());
+        try {
+            uint64_t nFileSize = boost::filesystem::file_size(pathSnapshot);
+            if (nFileSize < sizeof(uint256))
+                throw std::runtime_error("file too small");
+            vchData.resize(nFileSize - sizeof(uint256));
+            if (!vchData.empty())
+                filein.read((char*)&vchData[0], vchData.size());
+            filein >> hashIn;
+        } catch (std::exception& e) {
+            RemoveBlockIndexSnapshot();
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
+    RemoveBlockIndexSnapshot();
+
+    if (!fLastShutdownWasPrepared) {
+        LogPrintf("%s: last shutdown was not clean, ignoring snapshot\n", __func__);
+        return false;
+    }
+    if (!GetBoolArg("-blockindexsnapshot", DEFAULT_BLOCKINDEX_SNAPSHOT) || !mapBlockIndex.empty())
+        return false;
+
+    CDataStream ssSnapshot(vchData, SER_DISK, CLIENT_VERSION);
+    if (Hash(ssSnapshot.begin(), ssSnapshot.end()) != hashIn)
+        return error("%s : Checksum mismatch, data corrupted", __func__);
+
+    CBlockIndex* pindexArena = NULL;
+    try {
+        unsigned char pchMsgTmp[4];
+        int nSnapshotVersion;
+        uint256 hashBestChain;
+        uint32_t nEntries;
+        ssSnapshot >> FLATDATA(pchMsgTmp) >> nSnapshotVersion >> hashBestChain >> nEntries;
+        if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp)))
+            return error("%s : Invalid network magic number", __func__);
+        if (nSnapshotVersion != BLOCK_INDEX_SNAPSHOT_VERSION) {
+            LogPrintf("%s: unsupported snapshot version %d, ignoring snapshot\n", __func__, nSnapshotVersion);
+            return false;
+        }
+        if (hashBestChain != pcoinsTip->GetBestBlock()) {
+            LogPrintf("%s: snapshot is stale (tip %s, coins tip %s), ignoring snapshot\n", __func__, hashBestChain.ToString(), pcoinsTip->GetBestBlock().ToString());
+            return false;
+        }
+        if (nEntries > vchData.size() / 32)
+            return error("%s : Invalid number of entries %u", __func__, nEntries);
+
+        pindexArena = new CBlockIndex[nEntries];
+        vector<uint256> vHashes(nEntries);
+        for (uint32_t nPos = 0; nPos < nEntries; nPos++) {
+            uint32_t nPrev, nSkip;
+            CDiskBlockIndex diskindex;
+            ssSnapshot >> vHashes[nPos] >> nPrev >> nSkip >> diskindex;
+            if ((nPrev != std::numeric_limits<uint32_t>::max() && nPrev >= nPos) ||
+                (nSkip != std::numeric_limits<uint32_t>::max() && nSkip >= nPos))
+                throw std::runtime_error("entries out of order");
+
+            CBlockIndex* pindex = &pindexArena[nPos];
+            pindex->pprev = nPrev == std::numeric_limits<uint32_t>::max() ? NULL : &pindexArena[nPrev];
+            pindex->pskip = nSkip == std::numeric_limits<uint32_t>::max() ? NULL : &pindexArena[nSkip];
+            pindex->pnext = NULL;
+            pindex->nHeight = diskindex.nHeight;
+            pindex->nFile = diskindex.nFile;
+            pindex->nDataPos = diskindex.nDataPos;
+            pindex->nUndoPos = diskindex.nUndoPos;
+            pindex->nVersion = diskindex.nVersion;
+            pindex->hashMerkleRoot = diskindex.hashMerkleRoot;
+            pindex->nTime = diskindex.nTime;
+            pindex->nBits = diskindex.nBits;
+            pindex->nNonce = diskindex.nNonce;
+            pindex->nStatus = diskindex.nStatus;
+            pindex->nTx = diskindex.nTx;
+
+            //Proof Of Stake
+            pindex->nMint = diskindex.nMint;
+            pindex->nMoneySupply = diskindex.nMoneySupply;
+            pindex->nFlags = diskindex.nFlags;
+            pindex->nStakeModifier = diskindex.nStakeModifier;
+            pindex->prevoutStake = diskindex.prevoutStake;
+            pindex->nStakeTime = diskindex.nStakeTime;
+
+            ssSnapshot >> pindex->nChainWork;
+            if (pindex->IsProofOfStake()) {
+                uint256 hashProofOfStake;
+                ssSnapshot >> hashProofOfStake;
+                // Same stake hashes as LoadBlockIndexDB recomputes from the block files
+                if (hashProofOfStake != 0 && IsProtocolV05(static_cast<uint64_t>(pindex->GetBlockTime())))
+                    pindex->hashProofOfStake = hashProofOfStake;
+            }
+        }
+        if (nEntries > 0 && vHashes[nEntries - 1] != hashBestChain && !count(vHashes.begin(), vHashes.end(), hashBestChain))
+            throw std::runtime_error("tip missing from snapshot");
+
+        // Everything checks out; publish the entries
+        mapBlockIndex.reserve(nEntries);
+        vSortedByHeight.reserve(nEntries);
+        for (uint32_t nPos = 0; nPos < nEntries; nPos++) {
+            CBlockIndex* pindex = &pindexArena[nPos];
+            BlockMap::iterator mi = mapBlockIndex.insert(make_pair(vHashes[nPos], pindex)).first;
+            pindex->phashBlock = &((*mi).first);
+            if (pindex->IsProofOfStake())
+                setStakeSeen.insert(make_pair(pindex->prevoutStake, pindex->nStakeTime));
+            if (pindex->hashProofOfStake != 0)
+                mapProofOfStake[vHashes[nPos]] = pindex->hashProofOfStake;
+            vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
+        }
+        pindexSnapshotArena = pindexArena;
+        nSnapshotArenaSize = nEntries;
+    } catch (std::exception& e) {
+        delete[] pindexArena;
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+
+    LogPrintf("%s: loaded %u entries in %dms\n", __func__, nSnapshotArenaSize, GetTimeMillis() - nStart);
+    return true;
+}
+
 bool static LoadBlockIndexDB()
 {
-    if (!pblocktree->LoadBlockIndexGuts())
+    //Check if the shutdown procedure was followed on last client exit
+    bool fLastShutdownWasPrepared = true;
+    pblocktree->ReadFlag("shutdown", fLastShutdownWasPrepared);
+    LogPrintf("%s: Last shutdown was prepared: %s\n", __func__, fLastShutdownWasPrepared);
+
+    // Snapshot entries come sorted by height, with chain work, skip pointers and stake hashes filled in
+    vector<pair<int, CBlockIndex*> > vSortedByHeight;
+    bool fSnapshot = ReadBlockIndexSnapshot(vSortedByHeight, fLastShutdownWasPrepared);
+    if (!fSnapshot && !pblocktree->LoadBlockIndexGuts())
         return false;
 
     boost::this_thread::interruption_point();
 
     // Calculate nChainWork
-    vector<pair<int, CBlockIndex*> > vSortedByHeight;
-    vSortedByHeight.reserve(mapBlockIndex.size());
-    for (const PAIRTYPE(uint256, CBlockIndex*) & item : mapBlockIndex) {
-        CBlockIndex* pindex = item.second;
-        vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
+    if (!fSnapshot) {
+        vSortedByHeight.reserve(mapBlockIndex.size());
+        for (const PAIRTYPE(const uint256, CBlockIndex*) & item : mapBlockIndex) {
+            CBlockIndex* pindex = item.second;
+            vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
+        }
+        sort(vSortedByHeight.begin(), vSortedByHeight.end());
     }
-    sort(vSortedByHeight.begin(), vSortedByHeight.end());
     BOOST_FOREACH (const PAIRTYPE(int, CBlockIndex*) & item, vSortedByHeight) {
         CBlockIndex* pindex = item.second;
-        pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
+        if (!fSnapshot)
+            pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
         if (pindex->nStatus & BLOCK_HAVE_DATA) {
             if (pindex->pprev) {
                 if (pindex->pprev->nChainTx) {
@@ -3765,25 +4337,27 @@ bool static LoadBlockIndexDB()
             setBlockIndexCandidates.insert(pindex);
         if (pindex->nStatus & BLOCK_FAILED_MASK && (!pindexBestInvalid || pindex->nChainWork > pindexBestInvalid->nChainWork))
             pindexBestInvalid = pindex;
-        if (pindex->pprev)
+        if (pindex->pprev && !fSnapshot)
             pindex->BuildSkip();
         if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
             pindexBestHeader = pindex;
     }
 
-    // Load stake hashes
-    for (const auto & item : vSortedByHeight) {
-        const auto & blockIndex = item.second;
-        if (blockIndex->IsProofOfStake() && IsProtocolV05(static_cast<uint64_t>(blockIndex->GetBlockTime()))) {
-            CBlock block;
-            if (!ReadBlockFromDisk(block, blockIndex->GetBlockPos()))
-                return error("LoadBlockIndex() : failed to read block: %s", blockIndex->ToString());
-            uint256 hashProofOfStake;
-            if (!CheckProofOfStake(block, blockIndex->pprev, hashProofOfStake))
-                LogPrintf("AddToBlockIndex() : CheckProofOfStake failed\n");
-            else {
-                blockIndex->hashProofOfStake = hashProofOfStake;
-                mapProofOfStake[block.GetHash()] = hashProofOfStake;
+    // Load stake hashes (already part of the snapshot)
+    if (!fSnapshot) {
+        for (const auto & item : vSortedByHeight) {
+            const auto & blockIndex = item.second;
+            if (blockIndex->IsProofOfStake() && IsProtocolV05(static_cast<uint64_t>(blockIndex->GetBlockTime()))) {
+                CBlock block;
+                if (!ReadBlockFromDisk(block, blockIndex->GetBlockPos()))
+                    return error("LoadBlockIndex() : failed to read block: %s", blockIndex->ToString());
+                uint256 hashProofOfStake;
+                if (!CheckProofOfStake(block, blockIndex->pprev, hashProofOfStake))
+                    LogPrintf("AddToBlockIndex() : CheckProofOfStake failed\n");
+                else {
+                    blockIndex->hashProofOfStake = hashProofOfStake;
+                    mapProofOfStake[block.GetHash()] = hashProofOfStake;
+                }
             }
         }
     }
@@ -3821,11 +4395,6 @@ bool static LoadBlockIndexDB()
         }
     }
 
-    //Check if the shutdown procedure was followed on last client exit
-    bool fLastShutdownWasPrepared = true;
-    pblocktree->ReadFlag("shutdown", fLastShutdownWasPrepared);
-    LogPrintf("%s: Last shutdown was prepared: %s\n", __func__, fLastShutdownWasPrepared);
-
     // Check whether we need to continue reindexing
     bool fReindexing = false;
     pblocktree->ReadReindexing(fReindexing);
@@ -3904,7 +4473,7 @@ bool CVerifyDB::VerifyDB(CCoinsView* coinsview, int nCheckLevel, int nCheckDepth
             }
         }
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.GetCacheSize() + pcoinsTip->GetCacheSize()) <= nCoinCacheSize) {
+        if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
             bool fClean = true;
             if (!DisconnectBlock(block, state, pindex, coins, &fClean))
                 return error("VerifyDB() : *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
@@ -3954,6 +4523,9 @@ bool LoadBlockIndex()
     // Load block index from databases
     if (!fReindex && !LoadBlockIndexDB())
         return false;
+    // A snapshot describes the block files as they were before the reindex
+    if (fReindex)
+        RemoveBlockIndexSnapshot();
     return true;
 }
 
@@ -4006,45 +4578,20 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp)
 
     int nLoaded = 0;
     try {
-        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        CBufferedFile blkdat(fileIn, 2 * MAX_BLOCK_SIZE, MAX_BLOCK_SIZE + 8, SER_DISK, CLIENT_VERSION);
-        uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
+        // This takes over fileIn; blocks are parsed ahead on a separate thread when prefetching is enabled
+        CBlockFileReader reader(fileIn, nBlockPrefetch);
+        boost::shared_ptr<CBlock> pblockRead;
+        uint256 hash;
+        uint64_t nBlockPos = 0;
+        while (reader.Next(pblockRead, hash, nBlockPos)) {
             boost::this_thread::interruption_point();
 
-            blkdat.SetPos(nRewind);
-            nRewind++;         // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
             try {
-                // locate a header
-                unsigned char buf[MESSAGE_START_SIZE];
-                blkdat.FindByte(Params().MessageStart()[0]);
-                nRewind = blkdat.GetPos() + 1;
-                blkdat >> FLATDATA(buf);
-                if (memcmp(buf, Params().MessageStart(), MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
-                break;
-            }
-            try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
                 if (dbp)
                     dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                CBlock block;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
+                CBlock& block = *pblockRead;
 
                 // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
                 if (hash != Params().HashGenesisBlock() && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
                     LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
                         block.hashPrevBlock.ToString());
@@ -4090,6 +4637,9 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp)
                 LogPrintf("%s : Deserialize or I/O error - %s", __func__, e.what());
             }
         }
+        std::string strError = reader.GetError();
+        if (!strError.empty())
+            AbortNode(std::string("System error: ") + strError);
     } catch (std::runtime_error& e) {
         AbortNode(std::string("System error: ") + e.what());
     }
@@ -4440,8 +4990,10 @@ bool static AlreadyHave(const CInv& inv)
                mapTxLockReqRejected.count(inv.hash);
     case MSG_TXLOCK_VOTE:
         return mapTxLockVote.count(inv.hash);
-    case MSG_SPORK:
+    case MSG_SPORK: {
+        LOCK(cs_sporks);
         return mapSporks.count(inv.hash);
+    }
     case MSG_SERVICENODE_WINNER:
         if (servicenodePayments.mapServicenodePayeeVotes.count(inv.hash)) {
             servicenodeSync.AddedServicenodeWinner(inv.hash);
@@ -4486,6 +5038,96 @@ bool static AlreadyHave(const CInv& inv)
 }
 
 
+/**
+ * Recently served blocks as complete "block" messages, so that peers syncing
+ * the same blocks share one buffer instead of each causing a disk read and
+ * serialization. Keyed by block hash and whether the peer gets the CBlockPoS
+ * format; the least recently used messages are dropped once the total size
+ * exceeds -blockservecache. Protected by cs_main.
+ */
+class CBlockMsgCache
+{
+private:
+    typedef std::pair<uint256, bool> Key;
+    typedef std::list<std::pair<Key, CSerializedNetMsg> > List;
+
+    List lru; // least recently used first
+    std::map<Key, List::iterator> mapIndex;
+    size_t nBytes;
+
+public:
+    CBlockMsgCache() : nBytes(0) {}
+
+    CSerializedNetMsg Get(const uint256& hash, bool fPoS)
+    {
+        std::map<Key, List::iterator>::iterator it = mapIndex.find(Key(hash, fPoS));
+        if (it == mapIndex.end())
+            return CSerializedNetMsg();
+        lru.splice(lru.end(), lru, it->second);
+        return it->second->second;
+    }
+
+    void Put(const uint256& hash, bool fPoS, const CSerializedNetMsg& msg)
+    {
+        Key key(hash, fPoS);
+        if (mapIndex.count(key) || msg->size() > nBlockServeCacheSize)
+            return;
+        mapIndex[key] = lru.insert(lru.end(), std::make_pair(key, msg));
+        nBytes += msg->size();
+        while (nBytes > nBlockServeCacheSize) {
+            nBytes -= lru.front().second->size();
+            mapIndex.erase(lru.front().first);
+            lru.pop_front();
+        }
+    }
+};
+static CBlockMsgCache blockmsgcache;
+
+/** Build the "block" message for pindex straight from the bytes on disk, without deserializing the block */
+static bool ReadBlockMsgFromDisk(CSerializedNetMsg& msg, const CBlockIndex* pindex, bool fPoS)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << CMessageHeader("block", 0);
+    if (!ReadRawBlockFromDisk(ss, pindex->GetBlockPos()))
+        return false;
+
+    // The block format on disk is the old network format: header, transactions
+    // and, for proof of stake blocks, the signature. Check the header belongs
+    // to the block we want.
+    const unsigned int nHeaderSize = ::GetSerializeSize(CBlockHeader(), SER_NETWORK, PROTOCOL_VERSION);
+    const unsigned int nHeaderPos = CMessageHeader::HEADER_SIZE;
+    if (ss.size() < nHeaderPos + nHeaderSize)
+        return error("%s : block %s truncated", __func__, pindex->GetBlockHash().ToString());
+    CBlockHeader header;
+    CDataStream ssHeader(&ss[nHeaderPos], &ss[nHeaderPos] + nHeaderSize, SER_NETWORK, PROTOCOL_VERSION);
+    ssHeader >> header;
+    if (header.GetHash() != pindex->GetBlockHash())
+        return error("%s : GetHash() doesn't match index for block %s", __func__, pindex->GetBlockHash().ToString());
+
+    // CBlockPoS has the stake fields between header and transactions
+    if (fPoS) {
+        uint256 hashStake;
+        uint32_t nStakeIndex = 0;
+        int64_t nStakeAmount = 0;
+        uint256 hashStakeBlock;
+        if (pindex->IsProofOfStake()) {
+            hashStake = pindex->prevoutStake.hash;
+            nStakeIndex = pindex->prevoutStake.n;
+            CTransaction txPrev;
+            if (GetTransaction(hashStake, txPrev, hashStakeBlock, true) && nStakeIndex < txPrev.vout.size())
+                nStakeAmount = txPrev.vout[nStakeIndex].nValue;
+            else
+                hashStakeBlock = uint256();
+        }
+        CDataStream ssStake(SER_NETWORK, PROTOCOL_VERSION);
+        ssStake << hashStake << nStakeIndex << nStakeAmount << hashStakeBlock;
+        ss.insert(ss.begin() + nHeaderPos + nHeaderSize, &ssStake[0], &ssStake[0] + ssStake.size());
+    }
+
+    msg = FinalizeNetMsg(ss);
+    return true;
+}
+
 void static ProcessGetData(CNode* pfrom)
 {
     std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
@@ -4504,7 +5146,7 @@ void static ProcessGetData(CNode* pfrom)
             boost::this_thread::interruption_point();
             it++;
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK) {
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK) {
                 bool send = false;
                 BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
                 if (mi != mapBlockIndex.end()) {
@@ -4523,26 +5165,30 @@ void static ProcessGetData(CNode* pfrom)
                 }
                 // Don't send not-validated blocks
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second))
-                        assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK) {
-                        if (pfrom->nVersion >= NEW_CHAIN_VERSION) {
-                            auto blockPoS = CBlockPoS(block);
-                            if (block.IsProofOfStake()) {
-                                CTransaction txPrev; uint256 hashBlockPrev;
-                                if (GetTransaction(blockPoS.hashStake, txPrev, hashBlockPrev, true)) {
-                                    blockPoS.nStakeAmount = txPrev.vout[blockPoS.nStakeIndex].nValue;
-                                    blockPoS.hashStakeBlock = hashBlockPrev;
-                                }
-                            }
-                            pfrom->PushMessage("block", blockPoS);
+                    // Blocks further back are most likely not made of transactions the peer has in its mempool
+                    bool fCompact = inv.type == MSG_CMPCT_BLOCK && chainActive.Height() - mi->second->nHeight <= MAX_COMPACT_BLOCK_DEPTH;
+                    if (fCompact) {
+                        CBlock block;
+                        if (!ReadBlockFromDisk(block, (*mi).second))
+                            assert(!"cannot load block from disk");
+                        pfrom->PushMessage("cmpctblock", CBlockHeaderAndShortTxIDs(block));
+                    } else if (inv.type == MSG_BLOCK || inv.type == MSG_CMPCT_BLOCK) {
+                        // Peers catching up with new blocks all ask for the same ones;
+                        // serve them from the cache, or straight from the block file
+                        bool fPoS = pfrom->nVersion >= NEW_CHAIN_VERSION;
+                        CSerializedNetMsg msg = blockmsgcache.Get(inv.hash, fPoS);
+                        if (!msg) {
+                            if (!ReadBlockMsgFromDisk(msg, (*mi).second, fPoS))
+                                assert(!"cannot load block from disk");
+                            blockmsgcache.Put(inv.hash, fPoS, msg);
                         }
-                        else
-                            pfrom->PushMessage("block", block);
+                        pfrom->PushSerializedMessage(msg);
                     } else // MSG_FILTERED_BLOCK)
                     {
+                        // Send block from disk
+                        CBlock block;
+                        if (!ReadBlockFromDisk(block, (*mi).second))
+                            assert(!"cannot load block from disk");
                         LOCK(pfrom->cs_filter);
                         if (pfrom->pfilter) {
                             CMerkleBlock merkleBlock(block, *pfrom->pfilter);
@@ -4555,7 +5201,7 @@ void static ProcessGetData(CNode* pfrom)
                             // however we MUST always provide at least what the remote peer needs
                             typedef std::pair<unsigned int, uint256> PairType;
                             BOOST_FOREACH (PairType& pair, merkleBlock.vMatchedTxn)
-                                if (!pfrom->setInventoryKnown.count(CInv(MSG_TX, pair.second)))
+                                if (!pfrom->filterInventoryKnown.contains(pair.second))
                                     pfrom->PushMessage("tx", block.vtx[pair.first]);
                         }
                         // else
@@ -4578,9 +5224,9 @@ void static ProcessGetData(CNode* pfrom)
                 bool pushed = false;
                 {
                     LOCK(cs_mapRelay);
-                    map<CInv, CDataStream>::iterator mi = mapRelay.find(inv);
+                    map<CInv, CSerializedNetMsg>::iterator mi = mapRelay.find(inv);
                     if (mi != mapRelay.end()) {
-                        pfrom->PushMessage(inv.GetCommand(), (*mi).second);
+                        pfrom->PushSerializedMessage((*mi).second);
                         pushed = true;
                     }
                 }
@@ -4614,6 +5260,7 @@ void static ProcessGetData(CNode* pfrom)
                     }
                 }
                 if (!pushed && inv.type == MSG_SPORK) {
+                    LOCK(cs_sporks);
                     if (mapSporks.count(inv.hash)) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
@@ -4730,6 +5377,27 @@ void static ProcessGetData(CNode* pfrom)
     }
 }
 
+/** Hand a block rebuilt from a compact block to validation, like one received in a "block" message */
+void static ProcessCompactBlock(CNode* pfrom, CBlock& block)
+{
+    CValidationState state;
+    ProcessNewBlock(state, pfrom, &block);
+    int nDoS;
+    if (state.IsInvalid(nDoS)) {
+        pfrom->PushMessage("reject", std::string("cmpctblock"), state.GetRejectCode(),
+                           state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), block.GetHash());
+        if (nDoS > 0) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), nDoS);
+        }
+        return;
+    }
+
+    LOCK(cs_main);
+    if (chainActive.Tip()->GetBlockHash() == block.GetHash())
+        MaybeSetPeerAsAnnouncingHeaderAndIDs(pfrom);
+}
+
 bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived)
 {
     RandAddSeedPerfmon();
@@ -4860,6 +5528,22 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             LOCK(cs_main);
             State(pfrom->GetId())->fCurrentlyConnected = true;
         }
+
+        // Tell the peer we understand compact blocks; whether it should push
+        // them to us unannounced is decided once it delivers new blocks
+        if (fCompactBlocks && (pfrom->nServices & NODE_COMPACT_BLOCKS))
+            pfrom->PushMessage("sendcmpct", false, COMPACT_BLOCKS_ENCODING_VERSION);
+    }
+
+
+    else if (strCommand == "sendcmpct") {
+        bool fAnnounceUsingCMPCTBLOCK = false;
+        uint64_t nCMPCTBLOCKVersion = 0;
+        vRecv >> fAnnounceUsingCMPCTBLOCK >> nCMPCTBLOCKVersion;
+        if (nCMPCTBLOCKVersion == COMPACT_BLOCKS_ENCODING_VERSION && (pfrom->nServices & NODE_COMPACT_BLOCKS)) {
+            pfrom->fSupportsCompactBlocks = true;
+            pfrom->fPreferHeaderAndIDs = fAnnounceUsingCMPCTBLOCK;
+        }
     }
 
 
@@ -4970,6 +5654,16 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             }
         }
 
+        // A single new block announced while we are in sync most likely builds on our
+        // tip and consists of transactions we already have; fetch it as compact block
+        if (vToFetch.size() == 1 && fCompactBlocks && pfrom->fSupportsCompactBlocks && !IsInitialBlockDownload()) {
+            CNodeState* state = State(pfrom->GetId());
+            if (state->mapCompactBlocksRequested.size() < MAX_COMPACT_BLOCKS_REQUESTED) {
+                vToFetch[0].type = MSG_CMPCT_BLOCK;
+                state->mapCompactBlocksRequested[vToFetch[0].hash] = GetTimeMicros();
+            }
+        }
+
         if (!vToFetch.empty())
             pfrom->PushMessage("getdata", vToFetch);
     }
@@ -5125,6 +5819,11 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         CInv inv(MSG_TX, tx.GetHash());
         pfrom->AddInventoryKnown(inv);
 
+        // Verify the signatures before queueing for cs_main, AcceptToMemoryPool finds them cached.
+        // With message workers that was done by PrepareAsyncMessages.
+        if (!messageworkers.IsActive())
+            PreverifyTransaction(mempool, tx);
+
         LOCK(cs_main);
 
         bool fMissingInputs = false;
@@ -5145,43 +5844,49 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             // Recursively process any orphan transactions that depended on this one
             set<NodeId> setMisbehaving;
             for (unsigned int i = 0; i < vWorkQueue.size(); i++) {
-                map<uint256, set<uint256> >::iterator itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue[i]);
-                if (itByPrev == mapOrphanTransactionsByPrev.end())
-                    continue;
-                for (set<uint256>::iterator mi = itByPrev->second.begin();
-                     mi != itByPrev->second.end();
-                     ++mi) {
-                    const uint256& orphanHash = *mi;
-                    const CTransaction& orphanTx = mapOrphanTransactions[orphanHash].tx;
-                    NodeId fromPeer = mapOrphanTransactions[orphanHash].fromPeer;
-                    bool fMissingInputs2 = false;
-                    // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
-                    // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
-                    // anyone relaying LegitTxX banned)
-                    CValidationState stateDummy;
-
-
-                    if (setMisbehaving.count(fromPeer))
+                // Past the first entry the work queue holds accepted orphans, still in the pool
+                const CTransaction* ptxParent = i == 0 ? &tx : &mapOrphanTransactions.find(vWorkQueue[i])->second.tx;
+                for (unsigned int n = 0; n < ptxParent->vout.size(); n++) {
+                    map<COutPoint, setOrphanIters>::iterator itByPrev = mapOrphanTransactionsByPrev.find(COutPoint(vWorkQueue[i], n));
+                    if (itByPrev == mapOrphanTransactionsByPrev.end())
                         continue;
-                    if (AcceptToMemoryPool(mempool, stateDummy, orphanTx, true, &fMissingInputs2)) {
-                        LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
-                        RelayTransaction(orphanTx);
-                        vWorkQueue.push_back(orphanHash);
-                        vEraseQueue.push_back(orphanHash);
-                    } else if (!fMissingInputs2) {
-                        int nDos = 0;
-                        if (stateDummy.IsInvalid(nDos) && nDos > 0) {
-                            // Punish peer that gave us an invalid orphan tx
-                            Misbehaving(fromPeer, nDos);
-                            setMisbehaving.insert(fromPeer);
-                            LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
+                    for (setOrphanIters::iterator mi = itByPrev->second.begin(); mi != itByPrev->second.end(); ++mi) {
+                        const CTransaction& orphanTx = (*mi)->second.tx;
+                        const uint256& orphanHash = orphanTx.GetHash();
+                        NodeId fromPeer = (*mi)->second.fromPeer;
+                        bool fMissingInputs2 = false;
+                        // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
+                        // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
+                        // anyone relaying LegitTxX banned)
+                        CValidationState stateDummy;
+
+                        if (setMisbehaving.count(fromPeer))
+                            continue;
+                        // Already handled through another output of the parent
+                        if (std::find(vEraseQueue.begin(), vEraseQueue.end(), orphanHash) != vEraseQueue.end())
+                            continue;
+                        if (AcceptToMemoryPool(mempool, stateDummy, orphanTx, true, &fMissingInputs2)) {
+                            LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
+                            RelayTransaction(orphanTx);
+                            vWorkQueue.push_back(orphanHash);
+                            vEraseQueue.push_back(orphanHash);
+                            orphanStats.nAccepted++;
+                        } else if (!fMissingInputs2) {
+                            int nDos = 0;
+                            if (stateDummy.IsInvalid(nDos) && nDos > 0) {
+                                // Punish peer that gave us an invalid orphan tx
+                                Misbehaving(fromPeer, nDos);
+                                setMisbehaving.insert(fromPeer);
+                                LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
+                            }
+                            // Has inputs but not accepted to mempool
+                            // Probably non-standard or insufficient fee/priority
+                            LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToString());
+                            vEraseQueue.push_back(orphanHash);
+                            orphanStats.nRemoved++;
                         }
-                        // Has inputs but not accepted to mempool
-                        // Probably non-standard or insufficient fee/priority
-                        LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToString());
-                        vEraseQueue.push_back(orphanHash);
+                        mempool.check(pcoinsTip);
                     }
-                    mempool.check(pcoinsTip);
                 }
             }
 
@@ -5192,7 +5897,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
             // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
             unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
-            unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
+            size_t nMaxOrphanTxSize = (size_t)std::max((int64_t)0, GetArg("-maxorphantxsize", DEFAULT_MAX_ORPHAN_TRANSACTIONS_SIZE)) * 1000;
+            unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx, nMaxOrphanTxSize);
             if (nEvicted > 0)
                 LogPrint("mempool", "mapOrphan overflow, removed %u tx\n", nEvicted);
         } else if (pfrom->fWhitelisted) {
@@ -5261,6 +5967,15 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         CInv inv(MSG_BLOCK, hashBlock);
         LogPrint("net", "received block %s peer=%d\n", inv.hash.ToString(), pfrom->id);
 
+        // The peer may answer a compact block request with the full block
+        {
+            LOCK(cs_main);
+            CNodeState* nodestate = State(pfrom->GetId());
+            nodestate->mapCompactBlocksRequested.erase(hashBlock);
+            if (nodestate->partialBlock && nodestate->partialBlock->header.GetHash() == hashBlock)
+                nodestate->partialBlock.reset();
+        }
+
         //sometimes we will be sent their most recent block and its not the one we want, in that case tell where we are
         if (!mapBlockIndex.count(block.hashPrevBlock)) {
             if (find(pfrom->vBlockRequested.begin(), pfrom->vBlockRequested.end(), hashBlock) != pfrom->vBlockRequested.end()) {
@@ -5286,6 +6001,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                         TRY_LOCK(cs_main, lockMain);
                         if(lockMain) Misbehaving(pfrom->GetId(), nDoS);
                     }
+                } else {
+                    LOCK(cs_main);
+                    if (chainActive.Tip()->GetBlockHash() == hashBlock)
+                        MaybeSetPeerAsAnnouncingHeaderAndIDs(pfrom);
                 }
                 //disconnect this node if its old protocol version
                 pfrom->DisconnectOldProtocol(ActiveProtocol(), strCommand);
@@ -5296,6 +6015,172 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     }
 
 
+    else if (strCommand == "cmpctblock" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+        uint256 hashBlock = cmpctblock.header.GetHash();
+        CInv inv(MSG_BLOCK, hashBlock);
+        LogPrint("net", "received cmpctblock %s (%u txn) peer=%d\n", hashBlock.ToString(), cmpctblock.BlockTxCount(), pfrom->id);
+
+        CBlock block;
+        {
+            LOCK(cs_main);
+            CNodeState* nodestate = State(pfrom->GetId());
+
+            // Only blocks we asked for, or that a peer we asked to push new blocks to us sends
+            bool fRequested = nodestate->mapCompactBlocksRequested.erase(hashBlock) > 0;
+            bool fAnnouncing = std::find(lNodesAnnouncingHeaderAndIDs.begin(), lNodesAnnouncingHeaderAndIDs.end(),
+                                   pfrom->GetId()) != lNodesAnnouncingHeaderAndIDs.end();
+            if (!fRequested && !fAnnouncing) {
+                LogPrint("net", "peer %d sent us an unrequested compact block %s\n", pfrom->id, hashBlock.ToString());
+                return true;
+            }
+            pfrom->AddInventoryKnown(inv);
+
+            if (mapBlockIndex.count(hashBlock))
+                return true;
+
+            BlockMap::iterator mi = mapBlockIndex.find(cmpctblock.header.hashPrevBlock);
+            if (mi == mapBlockIndex.end()) {
+                // Doesn't connect to anything we know; the full block goes through the orphan handling
+                pfrom->PushMessage("getdata", vector<CInv>(1, inv));
+                return true;
+            }
+
+            // Check the header before looking up its transactions, AcceptBlock does it again for the full block
+            if (mi->second->nStatus & BLOCK_FAILED_MASK) {
+                Misbehaving(pfrom->GetId(), 100);
+                return error("peer %d sent us compact block %s building on an invalid block", pfrom->id, hashBlock.ToString());
+            }
+            CValidationState state;
+            if (cmpctblock.header.GetBlockTime() > GetAdjustedTime() + 7200 ||
+                !ContextualCheckBlockHeader(cmpctblock.header, state, mi->second)) {
+                int nDoS;
+                if (state.IsInvalid(nDoS) && nDoS > 0)
+                    Misbehaving(pfrom->GetId(), nDoS);
+                return error("peer %d sent us compact block %s with an invalid header", pfrom->id, hashBlock.ToString());
+            }
+            UpdateBlockAvailability(pfrom->GetId(), hashBlock);
+
+            // One compact block per peer is waiting for its transactions; get any other in full
+            if (nodestate->partialBlock) {
+                if (nodestate->partialBlock->header.GetHash() != hashBlock)
+                    pfrom->PushMessage("getdata", vector<CInv>(1, inv));
+                return true;
+            }
+
+            boost::shared_ptr<PartiallyDownloadedBlock> partialBlock(new PartiallyDownloadedBlock());
+            ReadStatus status = partialBlock->InitData(cmpctblock, mempool);
+            if (status == READ_STATUS_INVALID) {
+                Misbehaving(pfrom->GetId(), 100);
+                return error("peer %d sent us invalid compact block %s", pfrom->id, hashBlock.ToString());
+            } else if (status == READ_STATUS_FAILED) {
+                // Short id collision; just ask for the whole block
+                pfrom->PushMessage("getdata", vector<CInv>(1, inv));
+                return true;
+            }
+
+            BlockTransactionsRequest req;
+            for (size_t i = 0; i < cmpctblock.BlockTxCount(); i++) {
+                if (!partialBlock->IsTxAvailable(i))
+                    req.indexes.push_back(i);
+            }
+            if (!req.indexes.empty()) {
+                req.blockhash = hashBlock;
+                nodestate->partialBlock = partialBlock;
+                nodestate->nPartialBlockTime = GetTimeMicros();
+                pfrom->PushMessage("getblocktxn", req);
+                return true;
+            }
+
+            if (partialBlock->FillBlock(block, vector<CTransaction>()) != READ_STATUS_OK) {
+                pfrom->PushMessage("getdata", vector<CInv>(1, inv));
+                return true;
+            }
+        }
+        ProcessCompactBlock(pfrom, block);
+    }
+
+
+    else if (strCommand == "getblocktxn") {
+        BlockTransactionsRequest req;
+        vRecv >> req;
+
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(req.blockhash);
+        if (mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_HAVE_DATA)) {
+            LogPrint("net", "peer %d sent us a getblocktxn for a block we don't have\n", pfrom->id);
+            return true;
+        }
+
+        if (chainActive.Height() - mi->second->nHeight > MAX_COMPACT_BLOCK_DEPTH) {
+            // Too old to be served this way; send the whole block instead
+            pfrom->vRecvGetData.push_back(CInv(MSG_BLOCK, req.blockhash));
+            ProcessGetData(pfrom);
+            return true;
+        }
+
+        CBlock block;
+        if (!ReadBlockFromDisk(block, mi->second))
+            assert(!"cannot load block from disk");
+
+        BlockTransactions resp(req);
+        for (size_t i = 0; i < req.indexes.size(); i++) {
+            if (req.indexes[i] >= block.vtx.size()) {
+                Misbehaving(pfrom->GetId(), 100);
+                return error("peer %d sent us a getblocktxn with out-of-bounds tx indices", pfrom->id);
+            }
+            resp.txn[i] = block.vtx[req.indexes[i]];
+        }
+        pfrom->PushMessage("blocktxn", resp);
+    }
+
+
+    else if (strCommand == "blocktxn" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        BlockTransactions resp;
+        vRecv >> resp;
+
+        CBlock block;
+        {
+            LOCK(cs_main);
+            CNodeState* state = State(pfrom->GetId());
+            boost::shared_ptr<PartiallyDownloadedBlock> partialBlock;
+            partialBlock.swap(state->partialBlock);
+            if (!partialBlock || partialBlock->header.GetHash() != resp.blockhash) {
+                LogPrint("net", "peer %d sent us block transactions for block we weren't expecting\n", pfrom->id);
+                return true;
+            }
+
+            ReadStatus status = partialBlock->FillBlock(block, resp.txn);
+            if (status == READ_STATUS_INVALID) {
+                Misbehaving(pfrom->GetId(), 100);
+                return error("peer %d sent us invalid compact block/non-matching block transactions", pfrom->id);
+            } else if (status == READ_STATUS_FAILED) {
+                // Might have collided, fall back to getdata now :(
+                pfrom->PushMessage("getdata", vector<CInv>(1, CInv(MSG_BLOCK, resp.blockhash)));
+                return true;
+            }
+        }
+        ProcessCompactBlock(pfrom, block);
+    }
+
+
+    else if (strCommand == "notfound") {
+        vector<CInv> vInv;
+        vRecv >> vInv;
+        if (vInv.size() <= MAX_INV_SZ) {
+            LOCK(cs_main);
+            CNodeState* state = State(pfrom->GetId());
+            BOOST_FOREACH (const CInv& inv, vInv) {
+                if (inv.type == MSG_BLOCK || inv.type == MSG_CMPCT_BLOCK)
+                    state->mapCompactBlocksRequested.erase(inv.hash);
+            }
+        }
+    }
+
+
     // This asymmetric behavior for inbound and outbound connections was introduced
     // to prevent a fingerprinting attack: an attacker can send specific fake addresses
     // to users' AddrMan and later request them by sending getaddr messages.
@@ -5534,10 +6419,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             auto &app = xbridge::App::instance();
 
             // If we haven't seen this packet before, proceed
-            if (!app.isKnownMessage(hash))
+            if (app.addToKnown(hash))
             {
-                app.addToKnown(hash);
-
                 // Relay packets we haven't seen before
                 {
                     LOCK(cs_vNodes);
@@ -5635,6 +6518,146 @@ int ActiveProtocol()
     return MIN_PEER_PROTO_VERSION_BEFORE_ENFORCEMENT;
 }
 
+/**
+ * Check a complete message and process it. Returns true if the message was
+ * processed, false if it was skipped because of an invalid header or checksum.
+ * fOk is set to false if the connection should be dropped.
+ */
+static bool ProcessNetMessage(CNode* pfrom, CNetMessage& msg, bool& fOk)
+{
+    // Scan for message start
+    if (memcmp(msg.hdr.pchMessageStart, Params().MessageStart(), MESSAGE_START_SIZE) != 0) {
+        LogPrintf("PROCESSMESSAGE: INVALID MESSAGESTART %s peer=%d\n", SanitizeString(msg.hdr.GetCommand()), pfrom->id);
+        fOk = false;
+        return false;
+    }
+
+    // Read header
+    CMessageHeader& hdr = msg.hdr;
+    if (!hdr.IsValid()) {
+        LogPrintf("PROCESSMESSAGE: ERRORS IN HEADER %s peer=%d\n", SanitizeString(hdr.GetCommand()), pfrom->id);
+        return false;
+    }
+    string strCommand = hdr.GetCommand();
+
+    // Message size
+    unsigned int nMessageSize = hdr.nMessageSize;
+
+    // Checksum
+    CDataStream& vRecv = msg.vRecv;
+    uint256 hash = Hash(vRecv.begin(), vRecv.begin() + nMessageSize);
+    unsigned int nChecksum = 0;
+    memcpy(&nChecksum, &hash, sizeof(nChecksum));
+    if (nChecksum != hdr.nChecksum) {
+        LogPrintf("ProcessMessages(%s, %u bytes): CHECKSUM ERROR nChecksum=%08x hdr.nChecksum=%08x\n",
+            SanitizeString(strCommand), nMessageSize, nChecksum, hdr.nChecksum);
+        return false;
+    }
+
+    // Process message
+    bool fRet = false;
+    try {
+        fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime);
+        boost::this_thread::interruption_point();
+    } catch (std::ios_base::failure& e) {
+        pfrom->PushMessage("reject", strCommand, REJECT_MALFORMED, string("error parsing message"));
+        if (strstr(e.what(), "end of data")) {
+            // Allow exceptions from under-length message on vRecv
+            LogPrintf("ProcessMessages(%s, %u bytes): Exception '%s' caught, normally caused by a message being shorter than its stated length\n", SanitizeString(strCommand), nMessageSize, e.what());
+        } else if (strstr(e.what(), "size too large")) {
+            // Allow exceptions from over-long size
+            LogPrintf("ProcessMessages(%s, %u bytes): Exception '%s' caught\n", SanitizeString(strCommand), nMessageSize, e.what());
+        } else {
+            PrintExceptionContinue(&e, string("ProcessMessages() " + strCommand).c_str());
+        }
+    } catch (boost::thread_interrupted) {
+        throw;
+    } catch (std::exception& e) {
+        PrintExceptionContinue(&e, string("ProcessMessages() " + strCommand).c_str());
+    } catch (...) {
+        PrintExceptionContinue(NULL, string("ProcessMessages() " + strCommand).c_str());
+    }
+
+    if (!fRet)
+        LogPrintf("ProcessMessage(%s, %u bytes) FAILED peer=%d\n", SanitizeString(strCommand), nMessageSize, pfrom->id);
+
+    return true;
+}
+
+/**
+ * Messages that don't touch the chainstate (or take cs_main themselves where
+ * they do) and whose handlers lock their own state, so they can be processed
+ * by the message workers. Sporks, SwiftTX, obfuscation (including "dstx"),
+ * servicenode payments ("mnw", "mnget") and the sync status counts ("ssc")
+ * stay on the message handler thread, their tables are not safe for
+ * concurrent use.
+ */
+static bool IsAsyncMessage(const CNetMessage& msg)
+{
+    static const char* const ASYNC_COMMANDS[] = {
+        "mnb", "mnp", "dseg", "mnvs", "mprop", "mvote", "fbs", "fbvote", "xbridge", "xrouter"};
+    static const std::set<std::string> setAsyncCommands(ASYNC_COMMANDS, ASYNC_COMMANDS + ARRAYLEN(ASYNC_COMMANDS));
+    return setAsyncCommands.count(msg.hdr.GetCommand()) > 0;
+}
+
+/**
+ * Loose transactions are accepted on the message handler thread, next to the
+ * SwiftTX and obfuscation tables they update, but their scripts are verified
+ * by the message workers first, so a burst of them from several peers is
+ * checked in parallel and AcceptToMemoryPool finds the signatures cached.
+ */
+static bool IsPreparedMessage(const CNetMessage& msg)
+{
+    return !msg.fPrepared && msg.hdr.GetCommand() == "tx";
+}
+
+static void ProcessAsyncMessage(CNode* pfrom, CNetMessage& msg)
+{
+    bool fOk = true;
+    ProcessNetMessage(pfrom, msg, fOk);
+    if (!fOk)
+        pfrom->CloseSocketDisconnect();
+}
+
+static void PrepareAsyncMessages(CNode* pfrom, const std::deque<CNetMessage>& vMsgs)
+{
+    BOOST_FOREACH (const CNetMessage& msg, vMsgs) {
+        if (msg.hdr.GetCommand() != "tx")
+            continue;
+        CDataStream vRecv(msg.vRecv);
+        CTransaction tx;
+        try {
+            vRecv >> tx;
+        } catch (const std::exception&) {
+            continue; // reported when the message is processed
+        }
+        PreverifyTransaction(mempool, tx);
+    }
+
+    // A peer syncing the budget to us sends thousands of votes back to back
+    budget.PreverifyVotes(vMsgs);
+}
+
+/** Move the run of messages at it matching fn out of the receive queue and submit it */
+static void SubmitMessages(CNode* pfrom, std::deque<CNetMessage>::iterator& it, bool (*fn)(const CNetMessage&), bool fPrepareOnly)
+{
+    std::deque<CNetMessage> vMsgs;
+    size_t nBytes = 0;
+    while (it != pfrom->vRecvMsg.end() && it->complete() && fn(*it) &&
+           vMsgs.size() < MAX_MESSAGE_WORKER_BATCH && nBytes < ReceiveFloodSize()) {
+        nBytes += it->vRecv.size();
+        vMsgs.push_back(std::move(*it));
+        it++;
+    }
+    messageworkers.Submit(pfrom, vMsgs, fPrepareOnly);
+}
+
+void ThreadMessageWorker()
+{
+    RenameThread("blocknetdx-msgwork");
+    messageworkers.Thread(ProcessAsyncMessage, PrepareAsyncMessages);
+}
+
 // requires LOCK(cs_vRecvMsg)
 bool ProcessMessages(CNode* pfrom)
 {
@@ -5651,6 +6674,10 @@ bool ProcessMessages(CNode* pfrom)
     //
     bool fOk = true;
 
+    // Earlier messages are still being processed by a worker
+    if (pfrom->fRecvMsgAsync)
+        return fOk;
+
     if (!pfrom->vRecvGetData.empty())
         ProcessGetData(pfrom);
 
@@ -5675,66 +6702,21 @@ bool ProcessMessages(CNode* pfrom)
         if (!msg.complete())
             break;
 
-        // at this point, any failure means we can delete the current message
-        it++;
-
-        // Scan for message start
-        if (memcmp(msg.hdr.pchMessageStart, Params().MessageStart(), MESSAGE_START_SIZE) != 0) {
-            LogPrintf("PROCESSMESSAGE: INVALID MESSAGESTART %s peer=%d\n", SanitizeString(msg.hdr.GetCommand()), pfrom->id);
-            fOk = false;
+        // Hand a run of messages that don't need the chainstate to the workers,
+        // or let them prepare a run that is processed here once it comes back
+        if ((IsAsyncMessage(msg) || IsPreparedMessage(msg)) && messageworkers.IsActive()) {
+            if (IsAsyncMessage(msg))
+                SubmitMessages(pfrom, it, IsAsyncMessage, false);
+            else
+                SubmitMessages(pfrom, it, IsPreparedMessage, true);
             break;
         }
 
-        // Read header
-        CMessageHeader& hdr = msg.hdr;
-        if (!hdr.IsValid()) {
-            LogPrintf("PROCESSMESSAGE: ERRORS IN HEADER %s peer=%d\n", SanitizeString(hdr.GetCommand()), pfrom->id);
-            continue;
-        }
-        string strCommand = hdr.GetCommand();
-
-        // Message size
-        unsigned int nMessageSize = hdr.nMessageSize;
-
-        // Checksum
-        CDataStream& vRecv = msg.vRecv;
-        uint256 hash = Hash(vRecv.begin(), vRecv.begin() + nMessageSize);
-        unsigned int nChecksum = 0;
-        memcpy(&nChecksum, &hash, sizeof(nChecksum));
-        if (nChecksum != hdr.nChecksum) {
-            LogPrintf("ProcessMessages(%s, %u bytes): CHECKSUM ERROR nChecksum=%08x hdr.nChecksum=%08x\n",
-                SanitizeString(strCommand), nMessageSize, nChecksum, hdr.nChecksum);
-            continue;
-        }
-
-        // Process message
-        bool fRet = false;
-        try {
-            fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime);
-            boost::this_thread::interruption_point();
-        } catch (std::ios_base::failure& e) {
-            pfrom->PushMessage("reject", strCommand, REJECT_MALFORMED, string("error parsing message"));
-            if (strstr(e.what(), "end of data")) {
-                // Allow exceptions from under-length message on vRecv
-                LogPrintf("ProcessMessages(%s, %u bytes): Exception '%s' caught, normally caused by a message being shorter than its stated length\n", SanitizeString(strCommand), nMessageSize, e.what());
-            } else if (strstr(e.what(), "size too large")) {
-                // Allow exceptions from over-long size
-                LogPrintf("ProcessMessages(%s, %u bytes): Exception '%s' caught\n", SanitizeString(strCommand), nMessageSize, e.what());
-            } else {
-                PrintExceptionContinue(&e, string("ProcessMessages() " + strCommand).c_str());
-            }
-        } catch (boost::thread_interrupted) {
-            throw;
-        } catch (std::exception& e) {
-            PrintExceptionContinue(&e, string("ProcessMessages() " + strCommand).c_str());
-        } catch (...) {
-            PrintExceptionContinue(NULL, string("ProcessMessages() " + strCommand).c_str());
-        }
-
-        if (!fRet)
-            LogPrintf("ProcessMessage(%s, %u bytes) FAILED peer=%d\n", SanitizeString(strCommand), nMessageSize, pfrom->id);
+        // at this point, any failure means we can delete the current message
+        it++;
 
-        break;
+        if (ProcessNetMessage(pfrom, msg, fOk) || !fOk)
+            break;
     }
 
     // In case the connection got shut down, its receive buffer was wiped
@@ -5785,6 +6767,15 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         if (!lockMain)
             return true;
 
+        // Apply misbehavior reported by message workers
+        std::vector<std::pair<NodeId, int> > vMisbehavior;
+        {
+            LOCK(cs_vPendingMisbehavior);
+            vMisbehavior.swap(vPendingMisbehavior);
+        }
+        for (const std::pair<NodeId, int>& item : vMisbehavior)
+            AddMisbehavior(item.first, item.second);
+
         // Address refresh broadcast
         static int64_t nLastRebroadcast;
         if (!IsInitialBlockDownload() && (GetTime() - nLastRebroadcast > 24 * 60 * 60)) {
@@ -5875,7 +6866,7 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             vInv.reserve(pto->vInventoryToSend.size());
             vInvWait.reserve(pto->vInventoryToSend.size());
             BOOST_FOREACH (const CInv& inv, pto->vInventoryToSend) {
-                if (pto->setInventoryKnown.count(inv))
+                if (pto->filterInventoryKnown.contains(CNode::InventoryKnownKey(inv)))
                     continue;
 
                 // trickle out tx inv to protect privacy
@@ -5894,13 +6885,11 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
                     }
                 }
 
-                // returns true if wasn't already contained in the set
-                if (pto->setInventoryKnown.insert(inv).second) {
-                    vInv.push_back(inv);
-                    if (vInv.size() >= 1000) {
-                        pto->PushMessage("inv", vInv);
-                        vInv.clear();
-                    }
+                pto->filterInventoryKnown.insert(CNode::InventoryKnownKey(inv));
+                vInv.push_back(inv);
+                if (vInv.size() >= 1000) {
+                    pto->PushMessage("inv", vInv);
+                    vInv.clear();
                 }
             }
             pto->vInventoryToSend = vInvWait;
@@ -5926,6 +6915,25 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             LogPrintf("Timeout downloading block %s from peer=%d, disconnecting\n", state.vBlocksInFlight.front().hash.ToString(), pto->id);
             pto->Disconnect();
         }
+        // Compact block requests and "getblocktxn" the peer didn't answer in time are dropped, the block
+        // is fetched in full instead, so that they don't hold up compact block relay from this peer
+        int64_t nCompactTimeout = nNow - 1000000 * COMPACT_BLOCK_TIMEOUT;
+        for (std::map<uint256, int64_t>::iterator it = state.mapCompactBlocksRequested.begin(); it != state.mapCompactBlocksRequested.end();) {
+            if (it->second < nCompactTimeout) {
+                LogPrint("net", "Timeout waiting for compact block %s from peer=%d\n", it->first.ToString(), pto->id);
+                if (!mapBlockIndex.count(it->first))
+                    pto->PushMessage("getdata", vector<CInv>(1, CInv(MSG_BLOCK, it->first)));
+                state.mapCompactBlocksRequested.erase(it++);
+            } else
+                ++it;
+        }
+        if (state.partialBlock && state.nPartialBlockTime < nCompactTimeout) {
+            uint256 hashBlock = state.partialBlock->header.GetHash();
+            LogPrint("net", "Timeout waiting for transactions of compact block %s from peer=%d\n", hashBlock.ToString(), pto->id);
+            if (!mapBlockIndex.count(hashBlock))
+                pto->PushMessage("getdata", vector<CInv>(1, CInv(MSG_BLOCK, hashBlock)));
+            state.partialBlock.reset();
+        }
 
         //
         // Message: getdata (blocks)
@@ -6039,12 +7047,17 @@ public:
     {
         // block headers
         BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
+        for (; it1 != mapBlockIndex.end(); it1++) {
+            CBlockIndex* pindex = (*it1).second;
+            if (pindex < pindexSnapshotArena || pindex >= pindexSnapshotArena + nSnapshotArenaSize)
+                delete pindex;
+        }
         mapBlockIndex.clear();
+        delete[] pindexSnapshotArena;
 
         // orphan transactions
-        mapOrphanTransactions.clear();
+        mapOrphanTransactionsByPeer.clear();
         mapOrphanTransactionsByPrev.clear();
+        mapOrphanTransactions.clear();
     }
 } instance_of_cmaincleanup;
@@ -45,6 +45,7 @@
 class CBlockIndex;
 class CBlockTreeDB;
 class CBloomFilter;
+class CCoinsViewBackgroundFlush;
 class CInv;
 class CScriptCheck;
 class CValidationInterface;
@@ -52,6 +53,7 @@ class CValidationState;
 
 struct CBlockTemplate;
 struct CNodeStateStats;
+struct COrphanStats;
 
 /** Default for -blockmaxsize and -blockminsize, which control the range of sizes the mining code will create **/
 static const unsigned int DEFAULT_BLOCK_MAX_SIZE = 750000;
@@ -70,6 +72,12 @@ static const unsigned int MAX_P2SH_SIGOPS = 15;
 static const unsigned int MAX_TX_SIGOPS = MAX_BLOCK_SIGOPS / 5;
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
+/** Default for -maxorphantxsize, maximum kilobytes of orphan transactions kept in memory */
+static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS_SIZE = 5000;
+/** Expiration time for orphan transactions in seconds */
+static const int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
+/** Minimum time between orphan transactions expire time checks in seconds */
+static const int64_t ORPHAN_TX_EXPIRE_INTERVAL = 5 * 60;
 /** The maximum size of a blk?????.dat file (since 0.8) */
 static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 /** The pre-allocation chunk size for blk?????.dat files (since 0.8) */
@@ -96,6 +104,10 @@ static const unsigned int MAX_HEADERS_RESULTS = 2000;
 static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
 /** Time to wait (in seconds) between writing blockchain state to disk. */
 static const unsigned int DATABASE_WRITE_INTERVAL = 3600;
+/** Default for -blockindexsnapshot, write a flat copy of the block index on shutdown for faster startup */
+static const bool DEFAULT_BLOCKINDEX_SNAPSHOT = false;
+/** Default for -blockservecache, MiB of serialized blocks kept for answering getdata */
+static const unsigned int DEFAULT_BLOCK_SERVE_CACHE = 16;
 /** Maximum length of reject messages. */
 static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
 /** Required by the Governance framework. */
@@ -129,10 +141,14 @@ extern CConditionVariable cvBlockChange;
 extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
+extern int nBlockPrefetch;
+extern int nMessageWorkers;
+extern size_t nBlockServeCacheSize;
+extern bool fCompactBlocks;
 extern bool fTxIndex;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
-extern unsigned int nCoinCacheSize;
+extern size_t nCoinCacheUsage;
 extern CFeeRate minRelayTxFee;
 extern bool fAlerts;
 
@@ -195,6 +211,8 @@ bool InitBlockIndex();
 bool LoadBlockIndex();
 /** Unload database information */
 void UnloadBlockIndex();
+/** Write the in-memory block index to a snapshot file that the next startup can load instead of the block tree database */
+bool WriteBlockIndexSnapshot();
 /** See whether the protocol update is enforced for connected nodes */
 int ActiveProtocol();
 /** Process protocol messages received from a given node */
@@ -208,6 +226,12 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the script checking thread for loose transactions */
+void ThreadTxScriptCheck();
+/** Run the thread that reads blocks ahead of ConnectTip */
+void ThreadBlockPrefetch();
+/** Run an instance of the thread processing messages that don't touch the chainstate */
+void ThreadMessageWorker();
 
 // ***TODO*** probably not the right place for these 2
 /** Check whether a block hash satisfies the proof-of-work requirement specified by nBits */
@@ -237,6 +261,8 @@ CBlockIndex* InsertBlockIndex(uint256 hash);
 // bool AbortNode(const std::string& msg, const std::string& userMessage = "");
 /** Get statistics from node state */
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats& stats);
+/** Get the orphan transaction pool statistics, requires cs_main */
+void GetOrphanStats(COrphanStats& stats);
 /** Increase a node's misbehavior score. */
 void Misbehaving(NodeId nodeid, int howmuch);
 /** Flush all state, indexes and buffers to disk. */
@@ -244,7 +270,19 @@ void FlushStateToDisk();
 
 
 /** (try to) add transaction to memory pool **/
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee = false, bool ignoreFees = false);
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee = false, bool ignoreFees = false, bool fOverrideMempoolLimit = false);
+
+/**
+ * Check a loose transaction and verify its scripts ahead of AcceptToMemoryPool,
+ * holding cs_main only to fetch the spent coins, so that its signatures are in
+ * the signature cache by the time AcceptToMemoryPool checks them. Mempool
+ * conflicts and transactions below the relay fee are not verified. Failures are
+ * left for AcceptToMemoryPool to report; returns whether the scripts verified.
+ */
+bool PreverifyTransaction(CTxMemPool& pool, const CTransaction& tx);
+
+/** Expire old transactions and evict the lowest feerate ones until the mempool fits in limit bytes */
+void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age);
 
 bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee = false, bool isDSTX = false);
 
@@ -253,6 +291,24 @@ int GetInputAgeIX(uint256 nTXHash, CTxIn& vin);
 bool GetCoinAge(const CTransaction& tx, unsigned int nTxTime, uint64_t& nCoinAge);
 int GetIXConfirmations(uint256 nTXHash);
 
+/** Orphan transaction pool state and what happened to orphans since startup */
+struct COrphanStats {
+    size_t nOrphans;
+    size_t nBytes;
+    size_t nPeers;
+    uint64_t nAdded;
+    uint64_t nRejected;      //!< too big to keep
+    uint64_t nAccepted;      //!< parent arrived, accepted to the mempool
+    uint64_t nRemoved;       //!< parent arrived, not accepted
+    uint64_t nExpired;
+    uint64_t nEvicted;       //!< over -maxorphantx or -maxorphantxsize
+    uint64_t nErasedForPeer; //!< sender disconnected
+    uint64_t nErasedForBlock; //!< included or conflicted by a block
+
+    COrphanStats() : nOrphans(0), nBytes(0), nPeers(0), nAdded(0), nRejected(0), nAccepted(0), nRemoved(0),
+                     nExpired(0), nEvicted(0), nErasedForPeer(0), nErasedForBlock(0) {}
+};
+
 struct CNodeStateStats {
     int nMisbehavior;
     int nSyncHeight;
@@ -414,6 +470,8 @@ public:
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
+/** Append the block at pos to ss exactly as it is stored on disk, without deserializing it */
+bool ReadRawBlockFromDisk(CDataStream& ss, const CDiskBlockPos& pos);
 
 
 /** Functions for validating blocks and updating the block tree */
@@ -532,6 +590,9 @@ extern CCoinsViewCache* pcoinsTip;
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB* pblocktree;
 
+/** Global variable that points to the layer writing pcoinsTip flushes to disk (protected by cs_main) */
+extern CCoinsViewBackgroundFlush* pcoinsflush;
+
 struct CBlockTemplate {
     CBlock block;
     std::vector<CAmount> vTxFees;
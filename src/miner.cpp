@@ -24,8 +24,10 @@
 #endif
 #include "servicenode-payments.h"
 
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/signals2/connection.hpp>
 #include <boost/thread.hpp>
-#include <boost/tuple/tuple.hpp>
 
 using namespace std;
 
@@ -34,54 +36,579 @@ using namespace std;
 // BlocknetMiner
 //
 
+uint64_t nLastBlockTx = 0;
+uint64_t nLastBlockSize = 0;
+int64_t nLastCoinStakeSearchInterval = 0;
+
+// Container for tracking updates to ancestor feerate as we include (parent)
+// transactions in a block
+struct CTxMemPoolModifiedEntry {
+    CTxMemPoolModifiedEntry(CTxMemPool::txiter entry)
+    {
+        iter = entry;
+        nSizeWithAncestors = entry->GetSizeWithAncestors();
+        nModFeesWithAncestors = entry->GetModFeesWithAncestors();
+    }
+
+    CTxMemPool::txiter iter;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+};
+
+// Comparator for CTxMemPool::txiter objects.
+// It simply compares the internal memory address of the CTxMemPoolEntry object
+// pointed to. This means it has no meaning, and is only useful for using them
+// as key in other indexes.
+struct CompareCTxMemPoolIter {
+    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
+    {
+        return &(*a) < &(*b);
+    }
+};
+
+struct modifiedentry_iter {
+    typedef CTxMemPool::txiter result_type;
+    result_type operator()(const CTxMemPoolModifiedEntry& entry) const
+    {
+        return entry.iter;
+    }
+};
+
+// This matches the calculation in CompareTxMemPoolEntryByAncestorFee,
+// except operating on CTxMemPoolModifiedEntry.
+struct CompareModifiedEntry {
+    bool operator()(const CTxMemPoolModifiedEntry& a, const CTxMemPoolModifiedEntry& b) const
+    {
+        double f1 = (double)a.nModFeesWithAncestors * b.nSizeWithAncestors;
+        double f2 = (double)b.nModFeesWithAncestors * a.nSizeWithAncestors;
+        if (f1 == f2) {
+            return CTxMemPool::CompareIteratorByHash()(a.iter, b.iter);
+        }
+        return f1 > f2;
+    }
+};
+
+// A comparator that sorts transactions based on number of ancestors.
+// This is sufficient to sort an ancestor package in an order that is valid
+// to appear in a block.
+struct CompareTxIterByAncestorCount {
+    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
+    {
+        if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
+            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        return CTxMemPool::CompareIteratorByHash()(a, b);
+    }
+};
+
+typedef boost::multi_index_container<
+    CTxMemPoolModifiedEntry,
+    boost::multi_index::indexed_by<
+        boost::multi_index::ordered_unique<
+            modifiedentry_iter,
+            CompareCTxMemPoolIter>,
+        // sorted by modified ancestor fee rate
+        boost::multi_index::ordered_non_unique<
+            // Reuse same tag from CTxMemPool's similar index
+            boost::multi_index::tag<ancestor_score>,
+            boost::multi_index::identity<CTxMemPoolModifiedEntry>,
+            CompareModifiedEntry> > >
+    indexed_modified_transaction_set;
+
+typedef indexed_modified_transaction_set::nth_index<0>::type::iterator modtxiter;
+typedef indexed_modified_transaction_set::index<ancestor_score>::type::iterator modtxscoreiter;
+
+struct update_for_parent_inclusion {
+    update_for_parent_inclusion(CTxMemPool::txiter it) : iter(it) {}
+
+    void operator()(CTxMemPoolModifiedEntry& e)
+    {
+        e.nModFeesWithAncestors -= iter->GetModifiedFee();
+        e.nSizeWithAncestors -= iter->GetTxSize();
+    }
+
+    CTxMemPool::txiter iter;
+};
+
+// We want to sort transactions by priority
+typedef std::pair<double, CTxMemPool::txiter> TxCoinAgePriority;
+struct TxCoinAgePriorityCompare {
+    bool operator()(const TxCoinAgePriority& a, const TxCoinAgePriority& b) const
+    {
+        if (a.first == b.first)
+            return CompareTxMemPoolEntryByAncestorFee()(*(b.second), *(a.second)); //Reverse order to make sort less than
+        return a.first < b.first;
+    }
+};
+
 //
-// Unconfirmed transactions in the memory pool often depend on other
-// transactions in the memory pool. When we select transactions from the
-// pool, we select by highest priority or fee rate, so we might consider
-// transactions that depend on transactions that aren't yet in the block.
-// The COrphan class keeps track of these 'temporary orphans' while
-// CreateBlock is figuring out which transactions to include.
+// Fills a block template with transactions from the memory pool: first the
+// highest priority ones, up to -blockprioritysize, then transaction packages
+// (a transaction with its in-mempool ancestors that aren't in the block yet)
+// in order of their fee rate, taken from the ancestor_score index of the
+// mempool so that the pool doesn't need to be sorted for every new block.
+// Caller holds cs_main and mempool.cs.
 //
-class COrphan
+class CBlockTxSelector
 {
-public:
-    const CTransaction* ptx;
-    set<uint256> setDependsOn;
-    CFeeRate feeRate;
-    double dPriority;
+private:
+    CBlockTemplate* pblocktemplate;
+    CCoinsViewCache view;
+    const int nHeight;
+    unsigned int nBlockMaxSize;
+    unsigned int nBlockPrioritySize;
+    unsigned int nBlockMinSize;
+    bool fPrintPriority;
+
+    // Transactions in the block, and those that were tried but can't be added
+    CTxMemPool::setEntries inBlock;
+    CTxMemPool::setEntries failedTx;
 
-    COrphan(const CTransaction* ptxIn) : ptx(ptxIn), feeRate(0), dPriority(0)
+public:
+    uint64_t nBlockSize;
+    uint64_t nBlockTx;
+    int nBlockSigOps;
+    CAmount nFees;
+
+    CBlockTxSelector(CBlockTemplate* pblocktemplateIn, int nHeightIn, unsigned int nBlockMaxSizeIn, unsigned int nBlockPrioritySizeIn, unsigned int nBlockMinSizeIn)
+        : pblocktemplate(pblocktemplateIn), view(pcoinsTip), nHeight(nHeightIn),
+          nBlockMaxSize(nBlockMaxSizeIn), nBlockPrioritySize(nBlockPrioritySizeIn), nBlockMinSize(nBlockMinSizeIn),
+          nBlockSize(1000), nBlockTx(0), nBlockSigOps(100), nFees(0)
     {
+        fPrintPriority = GetBoolArg("-printpriority", false);
     }
+
+    void AddPriorityTxs();
+    void AddPackageTxs();
+    bool AddNewTx(CTxMemPool::txiter iter);
+
+    /** Whether the transaction was considered: it is in the block or can't be added */
+    bool Contains(CTxMemPool::txiter iter) const { return inBlock.count(iter) || failedTx.count(iter); }
+
+private:
+    bool AddToBlock(CTxMemPool::txiter iter, double dPriority);
+    bool IsStillDependent(CTxMemPool::txiter iter) const;
+    void UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set& mapModifiedTx);
 };
 
-uint64_t nLastBlockTx = 0;
-uint64_t nLastBlockSize = 0;
-int64_t nLastCoinStakeSearchInterval = 0;
+bool CBlockTxSelector::AddToBlock(CTxMemPool::txiter iter, double dPriority)
+{
+    const CTransaction& tx = iter->GetTx();
+    if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight))
+        return false;
+
+    // Size limits
+    unsigned int nTxSize = iter->GetTxSize();
+    if (nBlockSize + nTxSize >= nBlockMaxSize)
+        return false;
+
+    // Legacy limits on sigOps:
+    unsigned int nTxSigOps = GetLegacySigOpCount(tx);
+    if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+        return false;
+
+    if (!view.HaveInputs(tx))
+        return false;
+
+    CAmount nTxFees = view.GetValueIn(tx) - tx.GetValueOut();
+
+    nTxSigOps += GetP2SHSigOpCount(tx, view);
+    if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+        return false;
+
+    // Note that flags: we don't want to set mempool/IsStandard()
+    // policy here, but we still have to ensure that the block we
+    // create only contains transactions that are valid in new blocks.
+    CValidationState state;
+    if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
+        return false;
+
+    CTxUndo txundo;
+    UpdateCoins(tx, state, view, txundo, nHeight);
+
+    // Added
+    pblocktemplate->block.vtx.push_back(tx);
+    pblocktemplate->vTxFees.push_back(nTxFees);
+    pblocktemplate->vTxSigOps.push_back(nTxSigOps);
+    nBlockSize += nTxSize;
+    ++nBlockTx;
+    nBlockSigOps += nTxSigOps;
+    nFees += nTxFees;
+    inBlock.insert(iter);
+
+    if (fPrintPriority) {
+        LogPrintf("priority %.1f fee %s txid %s\n",
+            dPriority, CFeeRate(iter->GetModifiedFee(), nTxSize).ToString(), tx.GetHash().ToString());
+    }
+    return true;
+}
 
-// We want to sort transactions by priority and fee rate, so:
-typedef boost::tuple<double, CFeeRate, const CTransaction*> TxPriority;
-class TxPriorityCompare
+bool CBlockTxSelector::IsStillDependent(CTxMemPool::txiter iter) const
 {
-    bool byFee;
+    BOOST_FOREACH (CTxMemPool::txiter parent, mempool.GetMemPoolParents(iter)) {
+        if (!inBlock.count(parent))
+            return true;
+    }
+    return false;
+}
+
+void CBlockTxSelector::AddPriorityTxs()
+{
+    // How much of the block should be dedicated to high-priority transactions,
+    // included regardless of the fees they pay
+    if (nBlockPrioritySize == 0)
+        return;
+
+    // This vector will be sorted into a priority queue:
+    std::vector<TxCoinAgePriority> vecPriority;
+    TxCoinAgePriorityCompare pricomparer;
+    std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash> waitPriMap;
+    typedef std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash>::iterator waitPriIter;
+
+    vecPriority.reserve(mempool.mapTx.size());
+    for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin(); mi != mempool.mapTx.end(); ++mi) {
+        double dPriority = mi->GetPriority(nHeight);
+        CAmount dummy;
+        mempool.ApplyDeltas(mi->GetTx().GetHash(), dPriority, dummy);
+        vecPriority.push_back(TxCoinAgePriority(dPriority, mi));
+    }
+    std::make_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+
+    while (!vecPriority.empty()) {
+        // Take highest priority transaction off the priority queue:
+        CTxMemPool::txiter iter = vecPriority.front().second;
+        double dPriority = vecPriority.front().first;
+        std::pop_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+        vecPriority.pop_back();
+
+        // Prioritise by fee once past the priority size or we run out of high-priority
+        // transactions
+        if (nBlockSize + iter->GetTxSize() >= nBlockPrioritySize || !AllowFree(dPriority))
+            break;
+
+        // If tx is dependent on other mempool txs which haven't yet been included
+        // then put it in the waitSet
+        if (IsStillDependent(iter)) {
+            waitPriMap.insert(std::make_pair(iter, dPriority));
+            continue;
+        }
+
+        if (!AddToBlock(iter, dPriority)) {
+            failedTx.insert(iter);
+            continue;
+        }
+
+        // This tx was successfully added, so add transactions that depend
+        // on this one to the priority queue to try again
+        BOOST_FOREACH (CTxMemPool::txiter child, mempool.GetMemPoolChildren(iter)) {
+            waitPriIter wpiter = waitPriMap.find(child);
+            if (wpiter != waitPriMap.end()) {
+                vecPriority.push_back(TxCoinAgePriority(wpiter->second, child));
+                std::push_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+                waitPriMap.erase(wpiter);
+            }
+        }
+    }
+}
+
+// Add descendants of given transactions to mapModifiedTx with ancestor
+// state updated assuming given transactions are inBlock.
+void CBlockTxSelector::UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set& mapModifiedTx)
+{
+    BOOST_FOREACH (const CTxMemPool::txiter it, alreadyAdded) {
+        CTxMemPool::setEntries descendants;
+        mempool.CalculateDescendants(it, descendants);
+        // Insert all descendants (not yet in block) into the modified set
+        BOOST_FOREACH (CTxMemPool::txiter desc, descendants) {
+            if (alreadyAdded.count(desc))
+                continue;
+            modtxiter mit = mapModifiedTx.find(desc);
+            if (mit == mapModifiedTx.end()) {
+                CTxMemPoolModifiedEntry modEntry(desc);
+                modEntry.nSizeWithAncestors -= it->GetTxSize();
+                modEntry.nModFeesWithAncestors -= it->GetModifiedFee();
+                mapModifiedTx.insert(modEntry);
+            } else {
+                mapModifiedTx.modify(mit, update_for_parent_inclusion(it));
+            }
+        }
+    }
+}
+
+// This transaction selection algorithm orders the mempool based
+// on feerate of a transaction including all unconfirmed ancestors.
+// Since we don't remove transactions from the mempool as we select them
+// for block inclusion, we need an alternate method of updating the feerate
+// of a transaction with its not-yet-selected ancestors as we go.
+// This is accomplished by walking the in-mempool descendants of selected
+// transactions and storing a temporary modified state in mapModifiedTx.
+// Each time through the loop, we compare the best transaction in
+// mapModifiedTx with the next transaction in the mempool to decide what
+// transaction package to work on next.
+void CBlockTxSelector::AddPackageTxs()
+{
+    // mapModifiedTx will store sorted packages after they are modified
+    // because some of their txs are already in the block
+    indexed_modified_transaction_set mapModifiedTx;
+
+    // Start by adding all descendants of previously added txs to mapModifiedTx
+    // and modifying them for their already included ancestors
+    UpdatePackagesForAdded(inBlock, mapModifiedTx);
+
+    CTxMemPool::indexed_transaction_set::index<ancestor_score>::type::iterator mi = mempool.mapTx.get<ancestor_score>().begin();
+    CTxMemPool::txiter iter;
+    while (mi != mempool.mapTx.get<ancestor_score>().end() || !mapModifiedTx.empty()) {
+        // First try to find a new transaction in mapTx to evaluate.
+        if (mi != mempool.mapTx.get<ancestor_score>().end()) {
+            CTxMemPool::txiter it = mempool.mapTx.project<0>(mi);
+            if (mapModifiedTx.count(it) || inBlock.count(it) || failedTx.count(it)) {
+                ++mi;
+                continue;
+            }
+        }
+
+        // Now that mi is not stale, determine which transaction to evaluate:
+        // the next entry from mapTx, or the best from mapModifiedTx?
+        bool fUsingModified = false;
+
+        modtxscoreiter modit = mapModifiedTx.get<ancestor_score>().begin();
+        if (mi == mempool.mapTx.get<ancestor_score>().end()) {
+            // We're out of entries in mapTx; use the entry from mapModifiedTx
+            iter = modit->iter;
+            fUsingModified = true;
+        } else {
+            // Try to compare the mapTx entry to the mapModifiedTx entry
+            iter = mempool.mapTx.project<0>(mi);
+            if (modit != mapModifiedTx.get<ancestor_score>().end() &&
+                CompareModifiedEntry()(*modit, CTxMemPoolModifiedEntry(iter))) {
+                // The best entry in mapModifiedTx has higher score
+                // than the one from mapTx.
+                // Switch which transaction (package) to consider
+                iter = modit->iter;
+                fUsingModified = true;
+            } else {
+                // Either no entry in mapModifiedTx, or it's worse than mapTx.
+                // Increment mi for the next loop iteration.
+                ++mi;
+            }
+        }
+
+        // We skip mapTx entries that are inBlock, and mapModifiedTx shouldn't
+        // contain anything that is inBlock.
+        assert(!inBlock.count(iter));
+
+        uint64_t packageSize = iter->GetSizeWithAncestors();
+        CAmount packageFees = iter->GetModFeesWithAncestors();
+        if (fUsingModified) {
+            packageSize = modit->nSizeWithAncestors;
+            packageFees = modit->nModFeesWithAncestors;
+        }
+
+        // Skip free transactions if we're past the minimum block size;
+        // everything else we might consider has a lower fee rate
+        if (packageFees < ::minRelayTxFee.GetFee(packageSize) && nBlockSize >= nBlockMinSize)
+            return;
+
+        CTxMemPool::setEntries ancestors;
+        bool fFailed = nBlockSize + packageSize >= nBlockMaxSize;
+        if (!fFailed) {
+            uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+            std::string dummy;
+            mempool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+            BOOST_FOREACH (CTxMemPool::txiter ancestor, ancestors) {
+                if (failedTx.count(ancestor)) {
+                    fFailed = true;
+                    break;
+                }
+            }
+        }
+        if (fFailed) {
+            // Since we always look at the best entry in mapModifiedTx,
+            // we must erase failed entries so that we can consider the
+            // next best entry on the next loop iteration
+            if (fUsingModified)
+                mapModifiedTx.get<ancestor_score>().erase(modit);
+            failedTx.insert(iter);
+            continue;
+        }
+
+        // Only the ancestors that aren't in the block yet belong to the package
+        std::vector<CTxMemPool::txiter> sortedEntries;
+        BOOST_FOREACH (CTxMemPool::txiter ancestor, ancestors) {
+            if (!inBlock.count(ancestor))
+                sortedEntries.push_back(ancestor);
+        }
+        sortedEntries.push_back(iter);
+        // Sort the entries in a valid order for the block
+        std::sort(sortedEntries.begin(), sortedEntries.end(), CompareTxIterByAncestorCount());
+
+        CTxMemPool::setEntries added;
+        for (size_t i = 0; i < sortedEntries.size(); ++i) {
+            // Once a transaction of the package fails, its descendants in
+            // the package would fail as well
+            if (!AddToBlock(sortedEntries[i], sortedEntries[i]->GetPriority(nHeight))) {
+                failedTx.insert(sortedEntries[i]);
+                break;
+            }
+            added.insert(sortedEntries[i]);
+        }
+        // Erase from the modified set, if present
+        BOOST_FOREACH (CTxMemPool::txiter it, sortedEntries) {
+            mapModifiedTx.erase(it);
+        }
+        if (!added.count(iter))
+            failedTx.insert(iter);
+
+        // Update transactions that depend on each of these
+        UpdatePackagesForAdded(added, mapModifiedTx);
+    }
+}
+
+// Append a transaction that entered the mempool after the selection was made.
+// Its in-mempool parents must be in the block already, a transaction that
+// waits on one that was skipped is left for the next full selection.
+// Returns false if the block is too full to take it, in which case a full
+// selection would pick the best paying transactions again.
+bool CBlockTxSelector::AddNewTx(CTxMemPool::txiter iter)
+{
+    if (Contains(iter) || IsStillDependent(iter))
+        return true;
+
+    // Free transactions only go into the part of the block below the minimum size
+    if (iter->GetModifiedFee() < ::minRelayTxFee.GetFee(iter->GetTxSize()) && nBlockSize >= nBlockMinSize)
+        return true;
+
+    if (nBlockSize + iter->GetTxSize() >= nBlockMaxSize)
+        return false;
+
+    if (!AddToBlock(iter, iter->GetPriority(nHeight)))
+        failedTx.insert(iter);
+    return true;
+}
+
+//
+// The transactions of the next block, kept up to date as transactions enter
+// and leave the mempool, so that a staker that found a kernel can sign its
+// block without running the transaction selection first. New transactions
+// are appended in arrival order. The selection is only made again when the
+// tip or the block size settings change, a transaction the candidate looked
+// at leaves the pool, the block is full or the selection got old; the latter
+// lets time locked transactions that became final and better paying packages
+// in. Protected by mempool.cs, bringing it up to date also needs cs_main.
+//
+class CBlockTemplateCandidate
+{
+private:
+    //! Select again after this many seconds
+    static const int64_t MAX_CANDIDATE_AGE = 60;
+    //! Select again rather than queue more new transactions than this
+    static const size_t MAX_CANDIDATE_PENDING = 10000;
+
+    bool fActive;
+    bool fStale;
+    uint256 hashPrevBlock;
+    int nHeight;
+    int64_t nTimeSelected;
+    unsigned int nBlockMaxSize;
+    unsigned int nBlockPrioritySize;
+    unsigned int nBlockMinSize;
+
+    // Transactions added to the mempool since the last update
+    std::vector<uint256> vPending;
+    boost::scoped_ptr<CBlockTemplate> ptemplate;
+    boost::scoped_ptr<CBlockTxSelector> pselector;
+
+    boost::signals2::scoped_connection connAdded;
+    boost::signals2::scoped_connection connRemoved;
+
+    void EntryAdded(const CTransaction& tx)
+    {
+        if (fStale)
+            return;
+        if (vPending.size() >= MAX_CANDIDATE_PENDING) {
+            fStale = true;
+            vPending.clear();
+            return;
+        }
+        vPending.push_back(tx.GetHash());
+    }
+
+    void EntryRemoved(const CTransaction& tx)
+    {
+        // Once stale the selector may refer to entries that are gone
+        if (fStale)
+            return;
+        CTxMemPool::txiter it = mempool.mapTx.find(tx.GetHash());
+        if (it != mempool.mapTx.end() && pselector->Contains(it))
+            fStale = true;
+    }
+
+    void Select(int nHeightIn, unsigned int nBlockMaxSizeIn, unsigned int nBlockPrioritySizeIn, unsigned int nBlockMinSizeIn)
+    {
+        vPending.clear();
+        pselector.reset();
+        ptemplate.reset(new CBlockTemplate());
+        pselector.reset(new CBlockTxSelector(ptemplate.get(), nHeightIn, nBlockMaxSizeIn, nBlockPrioritySizeIn, nBlockMinSizeIn));
+        pselector->AddPriorityTxs();
+        pselector->AddPackageTxs();
+
+        fStale = false;
+        hashPrevBlock = chainActive.Tip()->GetBlockHash();
+        nHeight = nHeightIn;
+        nTimeSelected = GetTime();
+        nBlockMaxSize = nBlockMaxSizeIn;
+        nBlockPrioritySize = nBlockPrioritySizeIn;
+        nBlockMinSize = nBlockMinSizeIn;
+    }
 
 public:
-    TxPriorityCompare(bool _byFee) : byFee(_byFee) {}
+    CBlockTemplateCandidate() : fActive(false), fStale(true), nHeight(0), nTimeSelected(0),
+                                nBlockMaxSize(0), nBlockPrioritySize(0), nBlockMinSize(0) {}
 
-    bool operator()(const TxPriority& a, const TxPriority& b)
+    // Caller holds cs_main and mempool.cs
+    void Update(int nHeightIn, unsigned int nBlockMaxSizeIn, unsigned int nBlockPrioritySizeIn, unsigned int nBlockMinSizeIn)
     {
-        if (byFee) {
-            if (a.get<1>() == b.get<1>())
-                return a.get<0>() < b.get<0>();
-            return a.get<1>() < b.get<1>();
-        } else {
-            if (a.get<0>() == b.get<0>())
-                return a.get<1>() < b.get<1>();
-            return a.get<0>() < b.get<0>();
+        if (!fActive) {
+            // Only follow the mempool once blocks are being made
+            connAdded = mempool.NotifyEntryAdded.connect(boost::bind(&CBlockTemplateCandidate::EntryAdded, this, _1));
+            connRemoved = mempool.NotifyEntryRemoved.connect(boost::bind(&CBlockTemplateCandidate::EntryRemoved, this, _1));
+            fActive = true;
+        }
+
+        int64_t nNow = GetTime();
+        if (fStale || hashPrevBlock != chainActive.Tip()->GetBlockHash() || nHeight != nHeightIn ||
+            nBlockMaxSize != nBlockMaxSizeIn || nBlockPrioritySize != nBlockPrioritySizeIn || nBlockMinSize != nBlockMinSizeIn ||
+            nNow < nTimeSelected || nNow - nTimeSelected >= MAX_CANDIDATE_AGE) {
+            Select(nHeightIn, nBlockMaxSizeIn, nBlockPrioritySizeIn, nBlockMinSizeIn);
+            return;
+        }
+
+        BOOST_FOREACH (const uint256& hash, vPending) {
+            CTxMemPool::txiter it = mempool.mapTx.find(hash);
+            if (it == mempool.mapTx.end())
+                continue;
+            if (!pselector->AddNewTx(it)) {
+                Select(nHeightIn, nBlockMaxSizeIn, nBlockPrioritySizeIn, nBlockMinSizeIn);
+                return;
+            }
         }
+        vPending.clear();
+    }
+
+    // Append the selected transactions to pblocktemplate, after Update
+    void CopyTo(CBlockTemplate* pblocktemplate, uint64_t& nBlockSize, uint64_t& nBlockTx, CAmount& nFees) const
+    {
+        CBlock& block = pblocktemplate->block;
+        block.vtx.insert(block.vtx.end(), ptemplate->block.vtx.begin(), ptemplate->block.vtx.end());
+        pblocktemplate->vTxFees.insert(pblocktemplate->vTxFees.end(), ptemplate->vTxFees.begin(), ptemplate->vTxFees.end());
+        pblocktemplate->vTxSigOps.insert(pblocktemplate->vTxSigOps.end(), ptemplate->vTxSigOps.begin(), ptemplate->vTxSigOps.end());
+        nBlockSize = pselector->nBlockSize;
+        nBlockTx = pselector->nBlockTx;
+        nFees = pselector->nFees;
     }
 };
 
+static CBlockTemplateCandidate blockCandidate;
+
 void UpdateTime(CBlockHeader* pblock, const CBlockIndex* pindexPrev)
 {
     pblock->nTime = std::max(pindexPrev->GetMedianTimePast() + 1, GetAdjustedTime());
@@ -116,10 +643,31 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
     pblocktemplate->vTxFees.push_back(-1);   // updated at end
     pblocktemplate->vTxSigOps.push_back(-1); // updated at end
 
+    // Largest block you're willing to create:
+    unsigned int nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
+    // Limit to betweeen 1K and MAX_BLOCK_SIZE-1K for sanity:
+    nBlockMaxSize = std::max((unsigned int)1000, std::min((unsigned int)(MAX_BLOCK_SIZE - 1000), nBlockMaxSize));
+
+    // How much of the block should be dedicated to high-priority transactions,
+    // included regardless of the fees they pay
+    unsigned int nBlockPrioritySize = GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE);
+    nBlockPrioritySize = std::min(nBlockMaxSize, nBlockPrioritySize);
+
+    // Minimum block size you want to create; block will be filled with free transactions
+    // until there are no more or the block reaches this size:
+    unsigned int nBlockMinSize = GetArg("-blockminsize", DEFAULT_BLOCK_MIN_SIZE);
+    nBlockMinSize = std::min(nBlockMaxSize, nBlockMinSize);
+
     // ppcoin: if coinstake available add coinstake tx
     static int64_t nLastCoinStakeSearchTime = GetAdjustedTime(); // only initialized at startup
 
     if (fProofOfStake) {
+        // Bring the transactions up to date while looking for a kernel, rather than after finding one
+        {
+            LOCK2(cs_main, mempool.cs);
+            blockCandidate.Update(chainActive.Height() + 1, nBlockMaxSize, nBlockPrioritySize, nBlockMinSize);
+        }
+
         boost::this_thread::interruption_point();
         pblock->nTime = GetAdjustedTime();
         CBlockIndex* pindexPrev = chainActive.Tip();
@@ -143,21 +691,6 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
             return NULL;
     }
 
-    // Largest block you're willing to create:
-    unsigned int nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
-    // Limit to betweeen 1K and MAX_BLOCK_SIZE-1K for sanity:
-    nBlockMaxSize = std::max((unsigned int)1000, std::min((unsigned int)(MAX_BLOCK_SIZE - 1000), nBlockMaxSize));
-
-    // How much of the block should be dedicated to high-priority transactions,
-    // included regardless of the fees they pay
-    unsigned int nBlockPrioritySize = GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE);
-    nBlockPrioritySize = std::min(nBlockMaxSize, nBlockPrioritySize);
-
-    // Minimum block size you want to create; block will be filled with free transactions
-    // until there are no more or the block reaches this size:
-    unsigned int nBlockMinSize = GetArg("-blockminsize", DEFAULT_BLOCK_MIN_SIZE);
-    nBlockMinSize = std::min(nBlockMaxSize, nBlockMinSize);
-
     // Collect memory pool transactions into the block
     CAmount nFees = 0;
 
@@ -166,171 +699,11 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
 
         CBlockIndex* pindexPrev = chainActive.Tip();
         const int nHeight = pindexPrev->nHeight + 1;
-        CCoinsViewCache view(pcoinsTip);
-
-        // Priority order to process transactions
-        list<COrphan> vOrphan; // list memory doesn't move
-        map<uint256, vector<COrphan*> > mapDependers;
-        bool fPrintPriority = GetBoolArg("-printpriority", false);
-
-        // This vector will be sorted into a priority queue:
-        vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-        for (map<uint256, CTxMemPoolEntry>::iterator mi = mempool.mapTx.begin();
-             mi != mempool.mapTx.end(); ++mi) {
-            const CTransaction& tx = mi->second.GetTx();
-            if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight))
-                continue;
-
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            CAmount nTotalIn = 0;
-            bool fMissingInputs = false;
-            BOOST_FOREACH (const CTxIn& txin, tx.vin) {
-                // Read prev transaction
-                if (!view.HaveCoins(txin.prevout.hash)) {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash)) {
-                        LogPrintf("ERROR: mempool transaction missing input\n");
-                        if (fDebug) assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
-                        break;
-                    }
-
-                    // Has to wait for dependencies
-                    if (!porphan) {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx[txin.prevout.hash].GetTx().vout[txin.prevout.n].nValue;
-                    continue;
-                }
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                assert(coins);
-
-                CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
-
-                int nConf = nHeight - coins->nHeight;
-
-                dPriority += (double)nValueIn * nConf;
-            }
-            if (fMissingInputs) continue;
-
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
-
-            uint256 hash = tx.GetHash();
-            mempool.ApplyDeltas(hash, dPriority, nTotalIn);
-
-            CFeeRate feeRate(nTotalIn - tx.GetValueOut(), nTxSize);
-
-            if (porphan) {
-                porphan->dPriority = dPriority;
-                porphan->feeRate = feeRate;
-            } else
-                vecPriority.push_back(TxPriority(dPriority, feeRate, &mi->second.GetTx()));
-        }
 
-        // Collect transactions into block
-        uint64_t nBlockSize = 1000;
+        uint64_t nBlockSize = 0;
         uint64_t nBlockTx = 0;
-        int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
-
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-
-        while (!vecPriority.empty()) {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            CFeeRate feeRate = vecPriority.front().get<1>();
-            const CTransaction& tx = *(vecPriority.front().get<2>());
-
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
-
-            // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            if (nBlockSize + nTxSize >= nBlockMaxSize)
-                continue;
-
-            // Legacy limits on sigOps:
-            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
-
-            // Skip free transactions if we're past the minimum block size:
-            const uint256& hash = tx.GetHash();
-            double dPriorityDelta = 0;
-            CAmount nFeeDelta = 0;
-            mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
-            if (fSortedByFee && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
-                continue;
-
-            // Prioritise by fee once past the priority size or we run out of high-priority
-            // transactions:
-            if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority))) {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            }
-
-            if (!view.HaveInputs(tx))
-                continue;
-
-            CAmount nTxFees = view.GetValueIn(tx) - tx.GetValueOut();
-
-            nTxSigOps += GetP2SHSigOpCount(tx, view);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
-
-            // Note that flags: we don't want to set mempool/IsStandard()
-            // policy here, but we still have to ensure that the block we
-            // create only contains transactions that are valid in new blocks.
-            CValidationState state;
-            if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
-                continue;
-
-            CTxUndo txundo;
-            UpdateCoins(tx, state, view, txundo, nHeight);
-
-            // Added
-            pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
-
-            if (fPrintPriority) {
-                LogPrintf("priority %.1f fee %s txid %s\n",
-                    dPriority, feeRate.ToString(), tx.GetHash().ToString());
-            }
-
-            // Add transactions that depend on this one to the priority queue
-            if (mapDependers.count(hash)) {
-                BOOST_FOREACH (COrphan* porphan, mapDependers[hash]) {
-                    if (!porphan->setDependsOn.empty()) {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty()) {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->feeRate, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
-                    }
-                }
-            }
-        }
+        blockCandidate.Update(nHeight, nBlockMaxSize, nBlockPrioritySize, nBlockMinSize);
+        blockCandidate.CopyTo(pblocktemplate.get(), nBlockSize, nBlockTx, nFees);
 
         if (!fProofOfStake) {
             //Servicenode and general budget payments
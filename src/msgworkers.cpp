@@ -0,0 +1,103 @@
+// Copyright (c) 2018 The Blocknet developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "msgworkers.h"
+
+#include "util.h"
+
+#include <iterator>
+
+#include <boost/thread.hpp>
+
+extern boost::condition_variable messageHandlerCondition;
+
+//! Set in the threads running CMessageWorkers::Thread
+static boost::thread_specific_ptr<bool> ptrWorkerThread;
+
+bool CMessageWorkers::IsWorkerThread()
+{
+    return ptrWorkerThread.get() != NULL;
+}
+
+bool CMessageWorkers::IsActive()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return nThreads > 0;
+}
+
+void CMessageWorkers::Submit(CNode* pnode, std::deque<CNetMessage>& vMsgs, bool fPrepareOnly)
+{
+    boost::shared_ptr<Job> job(new Job());
+    job->pnode = pnode;
+    job->vMsgs.swap(vMsgs);
+    job->fPrepareOnly = fPrepareOnly;
+    pnode->fRecvMsgAsync = true;
+    {
+        LOCK(cs_vNodes);
+        pnode->AddRef();
+    }
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    queue.push_back(job);
+    condWorker.notify_one();
+}
+
+void CMessageWorkers::Finish(Job& job)
+{
+    CNode* pnode = job.pnode;
+    {
+        LOCK(pnode->cs_vRecvMsg);
+        if (job.fPrepareOnly && !pnode->fDisconnect) {
+            for (std::deque<CNetMessage>::iterator it = job.vMsgs.begin(); it != job.vMsgs.end(); ++it)
+                it->fPrepared = true;
+            pnode->vRecvMsg.insert(pnode->vRecvMsg.begin(), std::make_move_iterator(job.vMsgs.begin()),
+                std::make_move_iterator(job.vMsgs.end()));
+        }
+        pnode->fRecvMsgAsync = false;
+    }
+    {
+        LOCK(cs_vNodes);
+        pnode->Release();
+    }
+    messageHandlerCondition.notify_one();
+}
+
+void CMessageWorkers::Thread(ProcessFn process, PrepareFn prepare)
+{
+    ptrWorkerThread.reset(new bool(true));
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nThreads++;
+    }
+    try {
+        while (true) {
+            boost::shared_ptr<Job> job;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (queue.empty())
+                    condWorker.wait(lock); // interruption point
+                job = queue.front();
+                queue.pop_front();
+            }
+
+            try {
+                if (prepare)
+                    prepare(job->pnode, job->vMsgs);
+                for (std::deque<CNetMessage>::iterator it = job->vMsgs.begin(); it != job->vMsgs.end(); ++it) {
+                    if (job->fPrepareOnly || job->pnode->fDisconnect)
+                        break;
+                    process(job->pnode, *it);
+                }
+            } catch (const boost::thread_interrupted&) {
+                Finish(*job);
+                throw;
+            }
+            Finish(*job);
+        }
+    } catch (const boost::thread_interrupted&) {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nThreads--;
+        throw;
+    }
+}
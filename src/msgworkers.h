@@ -0,0 +1,89 @@
+// Copyright (c) 2018 The Blocknet developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_MSGWORKERS_H
+#define BITCOIN_MSGWORKERS_H
+
+#include "net.h"
+
+#include <deque>
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+/** Default for -msgworkers, number of threads processing messages that don't touch the chainstate (0 = disabled) */
+static const int DEFAULT_MESSAGE_WORKERS = 2;
+/** Maximum for -msgworkers */
+static const int MAX_MESSAGE_WORKERS = 16;
+/** Maximum number of messages of one peer handed to a worker at once */
+static const unsigned int MAX_MESSAGE_WORKER_BATCH = 64;
+
+/**
+ * Pool of threads processing network messages next to ThreadMessageHandler,
+ * so that a flood of servicenode, budget, XBridge or XRouter traffic does not
+ * delay block and transaction relay.
+ *
+ * The message handler moves a run of consecutive messages of one peer out of
+ * its receive queue and submits them as a job. While the job is pending the
+ * peer is marked with fRecvMsgAsync and the message handler leaves its
+ * remaining messages alone, so every peer's messages are still processed
+ * strictly in the order they arrived, while different peers proceed in
+ * parallel.
+ *
+ * Messages that have to be processed by the message handler, like loose
+ * transactions, can still be prepared by the workers: such a job only runs the
+ * prepare step and then returns the messages to the front of the peer's
+ * receive queue, marked fPrepared.
+ */
+class CMessageWorkers
+{
+public:
+    typedef boost::function<void(CNode*, CNetMessage&)> ProcessFn;
+    typedef boost::function<void(CNode*, const std::deque<CNetMessage>&)> PrepareFn;
+
+private:
+    struct Job {
+        CNode* pnode;
+        std::deque<CNetMessage> vMsgs;
+        bool fPrepareOnly;
+    };
+
+    //! Mutex to protect the inner state
+    boost::mutex mutex;
+
+    //! Workers wait on this for jobs
+    boost::condition_variable condWorker;
+
+    //! Jobs not picked up yet, in submission order
+    std::deque<boost::shared_ptr<Job> > queue;
+
+    //! Number of running worker threads
+    int nThreads;
+
+    /** Hand the peer, and for a prepare only job its messages, back to the message handler */
+    void Finish(Job& job);
+
+public:
+    CMessageWorkers() : nThreads(0) {}
+
+    /** Whether jobs can be submitted; without workers everything is processed by the message handler */
+    bool IsActive();
+
+    /**
+     * Process vMsgs (which are taken over) on a worker. The caller holds
+     * pnode->cs_vRecvMsg; the node is marked busy and referenced until done.
+     * With fPrepareOnly the messages are only prepared and then put back.
+     */
+    void Submit(CNode* pnode, std::deque<CNetMessage>& vMsgs, bool fPrepareOnly = false);
+
+    /** Worker thread; prepare is called for every job, then process for every message of it */
+    void Thread(ProcessFn process, PrepareFn prepare = PrepareFn());
+
+    /** Whether the calling thread is a message worker */
+    static bool IsWorkerThread();
+};
+
+#endif // BITCOIN_MSGWORKERS_H
@@ -15,6 +15,7 @@
 #include "addrman.h"
 #include "chainparams.h"
 #include "clientversion.h"
+#include "memusage.h"
 #include "miner.h"
 #include "obfuscation.h"
 #include "primitives/transaction.h"
@@ -26,6 +27,7 @@
 #include <string.h>
 #else
 #include <fcntl.h>
+#include <sys/uio.h>
 #endif
 
 #ifdef USE_UPNP
@@ -41,6 +43,9 @@
 // Dump addresses to peers.dat every 15 minutes (900s)
 #define DUMP_ADDRESSES_INTERVAL 900
 
+// Maximum number of queued messages handed to a single sendmsg call
+#define MAX_SEND_IOV 64
+
 #if !defined(HAVE_MSG_NOSIGNAL) && !defined(MSG_NOSIGNAL)
 #define MSG_NOSIGNAL 0
 #endif
@@ -82,12 +87,18 @@ static bool vfLimited[NET_MAX] = {};
 static CNode* pnodeLocalHost = NULL;
 uint64_t nLocalHostNonce = 0;
 static std::vector<ListenSocket> vhListenSocket;
+#ifdef USE_EPOLL
+//! epoll instance of the socket handler, -1 if it waits with select()
+static int hEpoll = -1;
+//! Maximum number of events fetched by one epoll_wait() call
+static const int EPOLL_MAX_EVENTS = 256;
+#endif
 CAddrMan addrman;
 bool fAddressesInitialized = false;
 
 vector<CNode*> vNodes;
 CCriticalSection cs_vNodes;
-map<CInv, CDataStream> mapRelay;
+map<CInv, CSerializedNetMsg> mapRelay;
 deque<pair<int64_t, CInv> > vRelayExpiration;
 CCriticalSection cs_mapRelay;
 limitedmap<CInv, int64_t> mapAlreadyAskedFor(MAX_INV_SZ);
@@ -117,6 +128,16 @@ void AddOneShot(string strDest)
     vOneShots.push_back(strDest);
 }
 
+/** Whether the socket handler is able to wait on this socket */
+static bool IsServiceableSocket(SOCKET hSocket)
+{
+#ifdef USE_EPOLL
+    if (hEpoll != -1)
+        return true;
+#endif
+    return IsSelectableSocket(hSocket);
+}
+
 unsigned short GetListenPort()
 {
     return (unsigned short)(GetArg("-port", Params().GetDefaultPort()));
@@ -403,7 +424,7 @@ CNode* ConnectNode(CAddress addrConnect, const char* pszDest, bool obfuScationMa
     bool proxyConnectionFailed = false;
     if (pszDest ? ConnectSocketByName(addrConnect, hSocket, pszDest, Params().GetDefaultPort(), nConnectTimeout, &proxyConnectionFailed) :
                   ConnectSocket(addrConnect, hSocket, nConnectTimeout, &proxyConnectionFailed)) {
-        if (!IsSelectableSocket(hSocket)) {
+        if (!IsServiceableSocket(hSocket)) {
             LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
             CloseSocket(hSocket);
             return NULL;
@@ -593,6 +614,17 @@ void CNode::copyStats(CNodeStats& stats)
 
     // Leave string empty if addrLocal invalid (not filled in yet)
     stats.addrLocal = addrLocal.IsValid() ? addrLocal.ToString() : "";
+
+    {
+        LOCK(cs_vSend);
+        stats.nSendQueueMsgs = vSendMsg.size();
+        stats.nSendQueueBytes = nSendSize;
+        stats.nSendQueueMemory = GetSendQueueMemoryUsage();
+    }
+    {
+        LOCK(cs_inventory);
+        stats.nInventoryMemory = GetInventoryMemoryUsage();
+    }
 }
 #undef X
 
@@ -681,13 +713,74 @@ int CNetMessage::readData(const char* pch, unsigned int nBytes)
 }
 
 
+// requires LOCK(cs_vSend)
+static void SocketSendError(CNode* pnode)
+{
+    int nErr = WSAGetLastError();
+    if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS) {
+        LogPrintf("socket send error %s\n", NetworkErrorString(nErr));
+        pnode->CloseSocketDisconnect();
+    }
+}
+
 // requires LOCK(cs_vSend)
 void SocketSendData(CNode* pnode)
 {
-    std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
+    std::deque<CSerializedNetMsg>::iterator it = pnode->vSendMsg.begin();
 
+#ifndef WIN32
+    // Gather the queued messages into as few system calls as possible; the
+    // buffers are written straight from the queue, shared or not.
+    while (it != pnode->vSendMsg.end()) {
+        struct iovec iov[MAX_SEND_IOV];
+        int nIov = 0;
+        size_t nOffset = pnode->nSendOffset;
+        size_t nWanted = 0;
+        for (std::deque<CSerializedNetMsg>::iterator itIov = it; itIov != pnode->vSendMsg.end() && nIov < MAX_SEND_IOV; ++itIov, ++nIov) {
+            const CSerializeData& data = **itIov;
+            assert(data.size() > nOffset);
+            iov[nIov].iov_base = (void*)&data[nOffset];
+            iov[nIov].iov_len = data.size() - nOffset;
+            nWanted += iov[nIov].iov_len;
+            nOffset = 0;
+        }
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = nIov;
+        ssize_t nBytes = sendmsg(pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (nBytes <= 0) {
+            if (nBytes < 0)
+                SocketSendError(pnode);
+            // couldn't send anything at all
+            break;
+        }
+
+        pnode->nLastSend = GetTime();
+        pnode->nSendBytes += nBytes;
+        pnode->RecordBytesSent(nBytes);
+        size_t nSent = nBytes;
+        while (nSent > 0) {
+            size_t nSize = (*it)->size();
+            size_t nLeft = nSize - pnode->nSendOffset;
+            if (nSent < nLeft) {
+                pnode->nSendOffset += nSent;
+                break;
+            }
+            nSent -= nLeft;
+            pnode->nSendOffset = 0;
+            pnode->nSendSize -= nSize;
+            it++;
+        }
+        if ((size_t)nBytes < nWanted) {
+            // could not send everything; stop sending more
+            break;
+        }
+    }
+#else
     while (it != pnode->vSendMsg.end()) {
-        const CSerializeData& data = *it;
+        const CSerializeData& data = **it;
         assert(data.size() > pnode->nSendOffset);
         int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
         if (nBytes > 0) {
@@ -704,18 +797,13 @@ void SocketSendData(CNode* pnode)
                 break;
             }
         } else {
-            if (nBytes < 0) {
-                // error
-                int nErr = WSAGetLastError();
-                if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS) {
-                    LogPrintf("socket send error %s\n", NetworkErrorString(nErr));
-                    pnode->CloseSocketDisconnect();
-                }
-            }
+            if (nBytes < 0)
+                SocketSendError(pnode);
             // couldn't send anything at all
             break;
         }
     }
+#endif
 
     if (it == pnode->vSendMsg.end()) {
         assert(pnode->nSendOffset == 0);
@@ -726,65 +814,198 @@ void SocketSendData(CNode* pnode)
 
 static list<CNode*> vNodesDisconnected;
 
-void ThreadSocketHandler()
+static void DisconnectNodes(unsigned int& nPrevNodeCount)
 {
-    unsigned int nPrevNodeCount = 0;
-    while (true) {
-        //
-        // Disconnect nodes
-        //
-        {
-            LOCK(cs_vNodes);
-            // Disconnect unused nodes
-            vector<CNode*> vNodesCopy = vNodes;
-            BOOST_FOREACH (CNode* pnode, vNodesCopy) {
-                if (pnode->fDisconnect ||
-                    (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0 && pnode->ssSend.empty())) {
-                    // remove from vNodes
-                    vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+    {
+        LOCK(cs_vNodes);
+        // Disconnect unused nodes
+        vector<CNode*> vNodesCopy = vNodes;
+        BOOST_FOREACH (CNode* pnode, vNodesCopy) {
+            if (pnode->fDisconnect ||
+                (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0 && pnode->ssSend.empty())) {
+                // remove from vNodes
+                vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
 
-                    // release outbound grant (if any)
-                    pnode->grantOutbound.Release();
+                // release outbound grant (if any)
+                pnode->grantOutbound.Release();
 
-                    // close socket and cleanup
-                    pnode->CloseSocketDisconnect();
+                // close socket and cleanup
+                pnode->CloseSocketDisconnect();
 
-                    // hold in disconnected pool until all refs are released
-                    if (pnode->fNetworkNode || pnode->fInbound)
-                        pnode->Release();
-                    vNodesDisconnected.push_back(pnode);
-                }
+                // hold in disconnected pool until all refs are released
+                if (pnode->fNetworkNode || pnode->fInbound)
+                    pnode->Release();
+                vNodesDisconnected.push_back(pnode);
             }
         }
-        {
-            // Delete disconnected nodes
-            list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
-            BOOST_FOREACH (CNode* pnode, vNodesDisconnectedCopy) {
-                // wait until threads are done using it
-                if (pnode->GetRefCount() <= 0) {
-                    bool fDelete = false;
-                    {
-                        TRY_LOCK(pnode->cs_vSend, lockSend);
-                        if (lockSend) {
-                            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                            if (lockRecv) {
-                                TRY_LOCK(pnode->cs_inventory, lockInv);
-                                if (lockInv)
-                                    fDelete = true;
-                            }
+    }
+    {
+        // Delete disconnected nodes
+        list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
+        BOOST_FOREACH (CNode* pnode, vNodesDisconnectedCopy) {
+            // wait until threads are done using it
+            if (pnode->GetRefCount() <= 0) {
+                bool fDelete = false;
+                {
+                    TRY_LOCK(pnode->cs_vSend, lockSend);
+                    if (lockSend) {
+                        TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                        if (lockRecv) {
+                            TRY_LOCK(pnode->cs_inventory, lockInv);
+                            if (lockInv)
+                                fDelete = true;
                         }
                     }
-                    if (fDelete) {
-                        vNodesDisconnected.remove(pnode);
-                        delete pnode;
-                    }
+                }
+                if (fDelete) {
+                    vNodesDisconnected.remove(pnode);
+                    delete pnode;
                 }
             }
         }
-        if (vNodes.size() != nPrevNodeCount) {
-            nPrevNodeCount = vNodes.size();
-            uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
+    }
+    if (vNodes.size() != nPrevNodeCount) {
+        nPrevNodeCount = vNodes.size();
+        uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
+    }
+}
+
+static void AcceptConnection(const ListenSocket& hListenSocket)
+{
+    struct sockaddr_storage sockaddr;
+    socklen_t len = sizeof(sockaddr);
+    SOCKET hSocket = accept(hListenSocket.socket, (struct sockaddr*)&sockaddr, &len);
+    CAddress addr;
+    int nInbound = 0;
+
+    if (hSocket != INVALID_SOCKET)
+        if (!addr.SetSockAddr((const struct sockaddr*)&sockaddr))
+            LogPrintf("Warning: Unknown socket family\n");
+
+    bool whitelisted = hListenSocket.whitelisted || CNode::IsWhitelistedRange(addr);
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH (CNode* pnode, vNodes)
+            if (pnode->fInbound)
+                nInbound++;
+    }
+
+    if (hSocket == INVALID_SOCKET) {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK)
+            LogPrintf("socket error accept failed: %s\n", NetworkErrorString(nErr));
+    } else if (!IsServiceableSocket(hSocket)) {
+        LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
+        CloseSocket(hSocket);
+    } else if (nInbound >= CNode::MaxConnections() - CNode::MaxOutboundConnections()) {
+        LogPrint("net", "connection from %s dropped (full)\n", addr.ToString());
+        CloseSocket(hSocket);
+    } else if (CNode::IsBanned(addr) && !whitelisted) {
+        LogPrintf("connection from %s dropped (banned)\n", addr.ToString());
+        CloseSocket(hSocket);
+    } else {
+        CNode* pnode = new CNode(hSocket, addr, "", true);
+        pnode->AddRef();
+        pnode->fWhitelisted = whitelisted;
+
+        {
+            LOCK(cs_vNodes);
+            vNodes.push_back(pnode);
+        }
+    }
+}
+
+/**
+ * Whether the node can take more data from its socket: there is no
+ * (complete) message in the receive buffer, or there is space left in it.
+ */
+static bool NodeWantsRecv(CNode* pnode)
+{
+    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+    return lockRecv && (pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
+                           pnode->GetTotalRecvSize() <= ReceiveFloodSize());
+}
+
+/**
+ * Read once from the node's socket. Returns false if the socket is known
+ * to be drained (or closed), true if there may be more data to read.
+ */
+static bool SocketRecvData(CNode* pnode)
+{
+    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+    if (!lockRecv)
+        return true;
+
+    // typical socket buffer is 8K-64K
+    char pchBuf[0x10000];
+    int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+    if (nBytes > 0) {
+        if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
+            pnode->CloseSocketDisconnect();
+        pnode->nLastRecv = GetTime();
+        pnode->nRecvBytes += nBytes;
+        pnode->RecordBytesRecv(nBytes);
+        // a short read means the socket buffer was emptied
+        return nBytes == sizeof(pchBuf);
+    } else if (nBytes == 0) {
+        // socket closed gracefully
+        if (!pnode->fDisconnect)
+            LogPrint("net", "socket closed\n");
+        pnode->CloseSocketDisconnect();
+    } else if (nBytes < 0) {
+        // error
+        int nErr = WSAGetLastError();
+        if (nErr == WSAEWOULDBLOCK)
+            return false;
+        // an interrupted read didn't empty the socket, try again
+        if (nErr == WSAEMSGSIZE || nErr == WSAEINTR || nErr == WSAEINPROGRESS)
+            return true;
+        if (!pnode->fDisconnect)
+            LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
+        pnode->CloseSocketDisconnect();
+    }
+    return false;
+}
+
+static void InactivityCheck(CNode* pnode)
+{
+    //
+    // Inactivity checking (xrouter clients should timeout after 15 seconds)
+    //
+    int64_t nTime = GetTime();
+    if (nTime - pnode->nTimeConnected > 60) {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0) {
+            LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
+            pnode->fDisconnect = true;
+        } else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL) {
+            LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
+            pnode->fDisconnect = true;
+        } else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90 * 60)) {
+            LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
+            pnode->fDisconnect = true;
+        } else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros()) {
+            LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            pnode->fDisconnect = true;
         }
+    }
+
+    // Disconnect xrouter client if there's no pending queries
+    if (pnode->isXRouter() && !xrouter::App::instance().hasPendingQuery(pnode->addr.ToString())
+        && fServiceNode && nTime - pnode->lastXRouterMsg() >= 15)
+    {
+        LogPrintf("disconnecting xrouter client: %s\n", pnode->addr.ToString());
+        pnode->fDisconnect = true;
+    }
+}
+
+static void ThreadSocketHandlerSelect()
+{
+    unsigned int nPrevNodeCount = 0;
+    while (true) {
+        //
+        // Disconnect nodes
+        //
+        DisconnectNodes(nPrevNodeCount);
 
         //
         // Find which sockets have data to receive
@@ -839,12 +1060,8 @@ void ThreadSocketHandler()
                         continue;
                     }
                 }
-                {
-                    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                    if (lockRecv && (pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
-                                        pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
-                        FD_SET(pnode->hSocket, &fdsetRecv);
-                }
+                if (NodeWantsRecv(pnode))
+                    FD_SET(pnode->hSocket, &fdsetRecv);
             }
         }
 
@@ -868,49 +1085,8 @@ void ThreadSocketHandler()
         // Accept new connections
         //
         BOOST_FOREACH (const ListenSocket& hListenSocket, vhListenSocket) {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv)) {
-                struct sockaddr_storage sockaddr;
-                socklen_t len = sizeof(sockaddr);
-                SOCKET hSocket = accept(hListenSocket.socket, (struct sockaddr*)&sockaddr, &len);
-                CAddress addr;
-                int nInbound = 0;
-
-                if (hSocket != INVALID_SOCKET)
-                    if (!addr.SetSockAddr((const struct sockaddr*)&sockaddr))
-                        LogPrintf("Warning: Unknown socket family\n");
-
-                bool whitelisted = hListenSocket.whitelisted || CNode::IsWhitelistedRange(addr);
-                {
-                    LOCK(cs_vNodes);
-                    BOOST_FOREACH (CNode* pnode, vNodes)
-                        if (pnode->fInbound)
-                            nInbound++;
-                }
-
-                if (hSocket == INVALID_SOCKET) {
-                    int nErr = WSAGetLastError();
-                    if (nErr != WSAEWOULDBLOCK)
-                        LogPrintf("socket error accept failed: %s\n", NetworkErrorString(nErr));
-                } else if (!IsSelectableSocket(hSocket)) {
-                    LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
-                    CloseSocket(hSocket);
-                } else if (nInbound >= CNode::MaxConnections() - CNode::MaxOutboundConnections()) {
-                    LogPrint("net", "connection from %s dropped (full)\n", addr.ToString());
-                    CloseSocket(hSocket);
-                } else if (CNode::IsBanned(addr) && !whitelisted) {
-                    LogPrintf("connection from %s dropped (banned)\n", addr.ToString());
-                    CloseSocket(hSocket);
-                } else {
-                    CNode* pnode = new CNode(hSocket, addr, "", true);
-                    pnode->AddRef();
-                    pnode->fWhitelisted = whitelisted;
-
-                    {
-                        LOCK(cs_vNodes);
-                        vNodes.push_back(pnode);
-                    }
-                }
-            }
+            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+                AcceptConnection(hListenSocket);
         }
 
         //
@@ -931,36 +1107,8 @@ void ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError)) {
-                TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                if (lockRecv) {
-                    {
-                        // typical socket buffer is 8K-64K
-                        char pchBuf[0x10000];
-                        int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-                        if (nBytes > 0) {
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
-                                pnode->CloseSocketDisconnect();
-                            pnode->nLastRecv = GetTime();
-                            pnode->nRecvBytes += nBytes;
-                            pnode->RecordBytesRecv(nBytes);
-                        } else if (nBytes == 0) {
-                            // socket closed gracefully
-                            if (!pnode->fDisconnect)
-                                LogPrint("net", "socket closed\n");
-                            pnode->CloseSocketDisconnect();
-                        } else if (nBytes < 0) {
-                            // error
-                            int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS) {
-                                if (!pnode->fDisconnect)
-                                    LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
-                                pnode->CloseSocketDisconnect();
-                            }
-                        }
-                    }
-                }
-            }
+            if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError))
+                SocketRecvData(pnode);
 
             //
             // Send
@@ -973,33 +1121,152 @@ void ThreadSocketHandler()
                     SocketSendData(pnode);
             }
 
-            //
-            // Inactivity checking (xrouter clients should timeout after 15 seconds)
-            //
-            int64_t nTime = GetTime();
-            if (nTime - pnode->nTimeConnected > 60) {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0) {
-                    LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
-                    pnode->fDisconnect = true;
-                } else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL) {
-                    LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                } else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90 * 60)) {
-                    LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
-                } else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros()) {
-                    LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
+            InactivityCheck(pnode);
+        }
+        {
+            LOCK(cs_vNodes);
+            BOOST_FOREACH (CNode* pnode, vNodesCopy)
+                pnode->Release();
+        }
+    }
+}
+
+#ifdef USE_EPOLL
+/**
+ * Socket handler loop on top of epoll. Every socket is registered once,
+ * edge-triggered, so the kernel only reports sockets whose state changed
+ * and nothing is rebuilt per iteration. Since an edge is reported only once,
+ * the readiness is remembered on the node (fSocketRecvReady/fSocketSendReady)
+ * until a read or write shows the socket has been drained or filled up.
+ * Otherwise this follows the same send-before-receive logic as the select()
+ * loop above.
+ */
+static void ThreadSocketHandlerEpoll()
+{
+    unsigned int nPrevNodeCount = 0;
+
+    // Listen sockets stay level-triggered; one connection is accepted per iteration
+    BOOST_FOREACH (const ListenSocket& hListenSocket, vhListenSocket) {
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = hListenSocket.socket;
+        if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, hListenSocket.socket, &event) == -1)
+            LogPrintf("epoll_ctl failed to add listen socket: %s\n", NetworkErrorString(errno));
+    }
+
+    std::vector<struct epoll_event> vEvents(EPOLL_MAX_EVENTS);
+    std::map<SOCKET, uint32_t> mapEvents;
+    while (true) {
+        //
+        // Disconnect nodes
+        //
+        DisconnectNodes(nPrevNodeCount);
+
+        //
+        // Register new sockets, and see whether any socket can make progress right away
+        //
+        bool fProgress = false;
+        {
+            LOCK(cs_vNodes);
+            BOOST_FOREACH (CNode* pnode, vNodes) {
+                if (pnode->hSocket == INVALID_SOCKET)
+                    continue;
+                if (!pnode->fSocketRegistered) {
+                    struct epoll_event event = {};
+                    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+                    event.data.fd = pnode->hSocket;
+                    if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, pnode->hSocket, &event) == -1 && errno != EEXIST) {
+                        LogPrintf("epoll_ctl failed to add socket: %s\n", NetworkErrorString(errno));
+                        pnode->CloseSocketDisconnect();
+                        continue;
+                    }
+                    pnode->fSocketRegistered = true;
+                    // Whatever happened before registration is not reported; just try
+                    pnode->fSocketRecvReady = true;
+                    pnode->fSocketSendReady = true;
+                }
+                {
+                    TRY_LOCK(pnode->cs_vSend, lockSend);
+                    if (lockSend && !pnode->vSendMsg.empty()) {
+                        fProgress |= pnode->fSocketSendReady;
+                        continue;
+                    }
                 }
+                if (pnode->fSocketRecvReady && NodeWantsRecv(pnode))
+                    fProgress = true;
+            }
+        }
+
+        int nEvents = epoll_wait(hEpoll, &vEvents[0], vEvents.size(), fProgress ? 0 : 50);
+        boost::this_thread::interruption_point();
+
+        mapEvents.clear();
+        if (nEvents == -1) {
+            if (errno != EINTR) {
+                LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(errno));
+                MilliSleep(50);
             }
+        }
+        for (int i = 0; i < nEvents; i++)
+            mapEvents[vEvents[i].data.fd] |= vEvents[i].events;
 
-            // Disconnect xrouter client if there's no pending queries
-            if (pnode->isXRouter() && !xrouter::App::instance().hasPendingQuery(pnode->addr.ToString())
-                && fServiceNode && nTime - pnode->lastXRouterMsg() >= 15)
+        //
+        // Accept new connections
+        //
+        BOOST_FOREACH (const ListenSocket& hListenSocket, vhListenSocket) {
+            if (hListenSocket.socket != INVALID_SOCKET && mapEvents.count(hListenSocket.socket))
+                AcceptConnection(hListenSocket);
+        }
+
+        //
+        // Service each socket
+        //
+        vector<CNode*> vNodesCopy;
+        {
+            LOCK(cs_vNodes);
+            vNodesCopy = vNodes;
+            BOOST_FOREACH (CNode* pnode, vNodesCopy)
+                pnode->AddRef();
+        }
+        BOOST_FOREACH (CNode* pnode, vNodesCopy) {
+            boost::this_thread::interruption_point();
+
+            if (pnode->hSocket == INVALID_SOCKET || !pnode->fSocketRegistered)
+                continue;
+            std::map<SOCKET, uint32_t>::const_iterator it = mapEvents.find(pnode->hSocket);
+            if (it != mapEvents.end()) {
+                if (it->second & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                    pnode->fSocketRecvReady = true;
+                if (it->second & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+                    pnode->fSocketSendReady = true;
+            }
+
+            //
+            // Send
+            //
+            bool fSendPending = false;
             {
-                LogPrintf("disconnecting xrouter client: %s\n", pnode->addr.ToString());
-                pnode->fDisconnect = true;
+                TRY_LOCK(pnode->cs_vSend, lockSend);
+                if (lockSend && !pnode->vSendMsg.empty()) {
+                    if (pnode->fSocketSendReady) {
+                        SocketSendData(pnode);
+                        // Whatever is left did not fit into the socket buffer; wait for EPOLLOUT
+                        if (!pnode->vSendMsg.empty())
+                            pnode->fSocketSendReady = false;
+                    }
+                    fSendPending = !pnode->vSendMsg.empty();
+                }
             }
+
+            //
+            // Receive, unless the send buffer has to be drained first
+            //
+            if (pnode->hSocket == INVALID_SOCKET)
+                continue;
+            if (!fSendPending && pnode->fSocketRecvReady && NodeWantsRecv(pnode))
+                pnode->fSocketRecvReady = SocketRecvData(pnode);
+
+            InactivityCheck(pnode);
         }
         {
             LOCK(cs_vNodes);
@@ -1008,6 +1275,18 @@ void ThreadSocketHandler()
         }
     }
 }
+#endif
+
+void ThreadSocketHandler()
+{
+#ifdef USE_EPOLL
+    if (hEpoll != -1) {
+        ThreadSocketHandlerEpoll();
+        return;
+    }
+#endif
+    ThreadSocketHandlerSelect();
+}
 
 
 #ifdef USE_UPNP
@@ -1434,7 +1713,7 @@ void ThreadMessageHandler()
                     if (!g_signals.ProcessMessages(pnode))
                         pnode->CloseSocketDisconnect();
 
-                    if (pnode->nSendSize < SendBufferSize()) {
+                    if (pnode->nSendSize < SendBufferSize() && !pnode->fRecvMsgAsync) {
                         if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete())) {
                             fSleep = false;
                         }
@@ -1612,6 +1891,18 @@ void static Discover(boost::thread_group& /*threadGroup*/)
 #endif
 }
 
+#ifdef USE_EPOLL
+bool InitSocketEvents()
+{
+    if (hEpoll == -1) {
+        hEpoll = epoll_create1(EPOLL_CLOEXEC);
+        if (hEpoll == -1)
+            LogPrintf("Failed to create epoll instance (%s), falling back to select()\n", NetworkErrorString(errno));
+    }
+    return hEpoll != -1;
+}
+#endif
+
 void StartNode(boost::thread_group& threadGroup)
 {
     uiInterface.InitMessage(_("Loading addresses..."));
@@ -1649,6 +1940,10 @@ void StartNode(boost::thread_group& threadGroup)
     // Map ports with UPnP
     MapPort(GetBoolArg("-upnp", DEFAULT_UPNP));
 
+#ifdef USE_EPOLL
+    LogPrintf("Using %s to wait for socket events\n", hEpoll != -1 ? "epoll" : "select()");
+#endif
+
     // Send and receive from sockets, accept connections
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "net", &ThreadSocketHandler));
 
@@ -1709,6 +2004,11 @@ public:
         vNodes.clear();
         vNodesDisconnected.clear();
         vhListenSocket.clear();
+#ifdef USE_EPOLL
+        if (hEpoll != -1)
+            close(hEpoll);
+        hEpoll = -1;
+#endif
         delete semOutbound;
         semOutbound = NULL;
         delete pnodeLocalHost;
@@ -1748,8 +2048,10 @@ void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
             vRelayExpiration.pop_front();
         }
 
-        // Save original serialized message so newer versions are preserved
-        mapRelay.insert(std::make_pair(inv, ss));
+        // Save original serialized message so newer versions are preserved; the
+        // finished message is shared by every peer that asks for it
+        if (!mapRelay.count(inv))
+            mapRelay.insert(std::make_pair(inv, MakeNetMsg("tx", ss)));
         vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
     }
     LOCK(cs_vNodes);
@@ -1770,12 +2072,13 @@ void RelayTransactionLockReq(const CTransaction& tx, bool relayToAll)
     CInv inv(MSG_TXLOCK_REQUEST, tx.GetHash());
 
     //broadcast the new lock
+    CSerializedNetMsg msg = MakeNetMsg("ix", tx);
     LOCK(cs_vNodes);
     BOOST_FOREACH (CNode* pnode, vNodes) {
         if (!relayToAll && !pnode->fRelayTxes)
             continue;
 
-        pnode->PushMessage("ix", tx);
+        pnode->PushSerializedMessage(msg);
     }
 }
 
@@ -1945,7 +2248,9 @@ bool CAddrDB::Read(CAddrMan& addr)
 unsigned int ReceiveFloodSize() { return 1000 * GetArg("-maxreceivebuffer", 5 * 1000); }
 unsigned int SendBufferSize() { return 1000 * GetArg("-maxsendbuffer", 1 * 1000); }
 
-CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fInboundIn) : ssSend(SER_NETWORK, INIT_PROTO_VERSION), setAddrKnown(5000)
+CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fInboundIn) : ssSend(SER_NETWORK, INIT_PROTO_VERSION),
+                                                                                           setAddrKnown(5000),
+                                                                                           filterInventoryKnown(std::max(SendBufferSize() / 100, (unsigned int)1000), 0.000001)
 {
     nServices = 0;
     hSocket = hSocketIn;
@@ -1969,11 +2274,16 @@ CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fIn
     nRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
+    fRecvMsgAsync = false;
+    fSocketRegistered = false;
+    fSocketRecvReady = false;
+    fSocketSendReady = false;
     hashContinue = 0;
     nStartingHeight = -1;
     fGetAddr = false;
     fRelayTxes = false;
-    setInventoryKnown.max_size(SendBufferSize() / 1000);
+    fSupportsCompactBlocks = false;
+    fPreferHeaderAndIDs = false;
     pfilter = new CBloomFilter();
     nPingNonceSent = 0;
     nPingUsecStart = 0;
@@ -2076,22 +2386,11 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
         return;
     }
 
-    // Set the size
-    unsigned int nSize = ssSend.size() - CMessageHeader::HEADER_SIZE;
-    memcpy((char*)&ssSend[CMessageHeader::MESSAGE_SIZE_OFFSET], &nSize, sizeof(nSize));
-
-    // Set the checksum
-    uint256 hash = Hash(ssSend.begin() + CMessageHeader::HEADER_SIZE, ssSend.end());
-    unsigned int nChecksum = 0;
-    memcpy(&nChecksum, &hash, sizeof(nChecksum));
-    assert(ssSend.size() >= CMessageHeader::CHECKSUM_OFFSET + sizeof(nChecksum));
-    memcpy((char*)&ssSend[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
-
-    LogPrint("net", "(%d bytes) peer=%d\n", nSize, id);
+    LogPrint("net", "(%d bytes) peer=%d\n", ssSend.size() - CMessageHeader::HEADER_SIZE, id);
 
-    std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
-    ssSend.GetAndClear(*it);
-    nSendSize += (*it).size();
+    CSerializedNetMsg msg = FinalizeNetMsg(ssSend);
+    std::deque<CSerializedNetMsg>::iterator it = vSendMsg.insert(vSendMsg.end(), msg);
+    nSendSize += msg->size();
 
     // If write queue empty, attempt "optimistic write"
     if (it == vSendMsg.begin())
@@ -2099,3 +2398,56 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
 
     LEAVE_CRITICAL_SECTION(cs_vSend);
 }
+
+void CNode::PushSerializedMessage(const CSerializedNetMsg& msg)
+{
+    LOCK(cs_vSend);
+    if (fDebug) {
+        const char* pszCommand = &(*msg)[MESSAGE_START_SIZE];
+        LogPrint("net", "sending: %s (%d bytes, shared) peer=%d\n",
+            SanitizeString(std::string(pszCommand, strnlen(pszCommand, CMessageHeader::COMMAND_SIZE))),
+            msg->size() - CMessageHeader::HEADER_SIZE, id);
+    }
+
+    vSendMsg.push_back(msg);
+    nSendSize += msg->size();
+
+    // If write queue was empty, attempt "optimistic write"
+    if (vSendMsg.size() == 1)
+        SocketSendData(this);
+}
+
+size_t CNode::GetSendQueueMemoryUsage() const
+{
+    size_t nUsage = 0;
+    BOOST_FOREACH (const CSerializedNetMsg& msg, vSendMsg) {
+        // use_count() only drifts while another peer drops its reference; good enough for reporting
+        nUsage += memusage::MallocUsage(msg->capacity() + sizeof(CSerializeData)) / std::max(msg.use_count(), 1L);
+    }
+    return nUsage + memusage::MallocUsage(vSendMsg.size() * sizeof(CSerializedNetMsg));
+}
+
+size_t CNode::GetInventoryMemoryUsage() const
+{
+    return filterInventoryKnown.DynamicMemoryUsage() +
+           memusage::DynamicUsage(vInventoryToSend) +
+           memusage::DynamicUsage(mapAskFor);
+}
+
+CSerializedNetMsg FinalizeNetMsg(CDataStream& ss)
+{
+    // Set the size
+    unsigned int nSize = ss.size() - CMessageHeader::HEADER_SIZE;
+    memcpy((char*)&ss[CMessageHeader::MESSAGE_SIZE_OFFSET], &nSize, sizeof(nSize));
+
+    // Set the checksum
+    uint256 hash = Hash(ss.begin() + CMessageHeader::HEADER_SIZE, ss.end());
+    unsigned int nChecksum = 0;
+    memcpy(&nChecksum, &hash, sizeof(nChecksum));
+    assert(ss.size() >= CMessageHeader::CHECKSUM_OFFSET + sizeof(nChecksum));
+    memcpy((char*)&ss[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
+
+    boost::shared_ptr<CSerializeData> msg(new CSerializeData());
+    ss.GetAndClear(*msg);
+    return msg;
+}
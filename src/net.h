@@ -28,6 +28,7 @@
 
 #include <boost/filesystem/path.hpp>
 #include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/signals2/signal.hpp>
 
 class CAddrMan;
@@ -59,6 +60,12 @@ static const bool DEFAULT_UPNP = false;
 #endif
 /** The maximum number of entries in mapAskFor */
 static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
+/** -socketevents default, how the socket handler waits for socket readiness */
+#ifdef USE_EPOLL
+static const char* const DEFAULT_SOCKETEVENTS = "epoll";
+#else
+static const char* const DEFAULT_SOCKETEVENTS = "select";
+#endif
 
 unsigned int ReceiveFloodSize();
 unsigned int SendBufferSize();
@@ -76,6 +83,10 @@ CNode* OpenXRouterConnection(const CAddress& addrConnect, const char* strDest =
 void MapPort(bool fUseUPnP);
 unsigned short GetListenPort();
 bool BindListenPort(const CService& bindAddr, std::string& strError, bool fWhitelisted = false);
+#ifdef USE_EPOLL
+/** Create the epoll instance of the socket handler; false if it has to fall back to select() */
+bool InitSocketEvents();
+#endif
 void StartNode(boost::thread_group& threadGroup);
 bool StopNode();
 void SocketSendData(CNode* pnode);
@@ -132,7 +143,27 @@ static int nMaxOutboundConnections{nMaxOutboundNavtiveConnections};
 
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
-extern std::map<CInv, CDataStream> mapRelay;
+/**
+ * A complete network message (header and payload) as it goes over the wire.
+ * Immutable once built, so the same buffer can sit in the send queue of any
+ * number of peers without being copied.
+ */
+typedef boost::shared_ptr<const CSerializeData> CSerializedNetMsg;
+
+/** Fill in size and checksum of the message in ss (which starts with a header) and take over its data */
+CSerializedNetMsg FinalizeNetMsg(CDataStream& ss);
+
+/** Serialize a message once, for queueing it to many peers with CNode::PushSerializedMessage */
+template <typename T1>
+CSerializedNetMsg MakeNetMsg(const char* pszCommand, const T1& a1)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss.reserve(10000);
+    ss << CMessageHeader(pszCommand, 0) << a1;
+    return FinalizeNetMsg(ss);
+}
+
+extern std::map<CInv, CSerializedNetMsg> mapRelay;
 extern std::deque<std::pair<int64_t, CInv> > vRelayExpiration;
 extern CCriticalSection cs_mapRelay;
 extern limitedmap<CInv, int64_t> mapAlreadyAskedFor;
@@ -170,6 +201,10 @@ public:
     double dPingTime;
     double dPingWait;
     std::string addrLocal;
+    size_t nSendQueueMsgs;
+    size_t nSendQueueBytes;
+    size_t nSendQueueMemory;
+    size_t nInventoryMemory;
 };
 
 
@@ -187,6 +222,8 @@ public:
 
     int64_t nTime; // time (in microseconds) of message receipt.
 
+    bool fPrepared; // already prepared by a message worker
+
     CNetMessage(int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), vRecv(nTypeIn, nVersionIn)
     {
         hdrbuf.resize(24);
@@ -194,6 +231,7 @@ public:
         nHdrPos = 0;
         nDataPos = 0;
         nTime = 0;
+        fPrepared = false;
     }
 
     bool complete() const
@@ -225,12 +263,18 @@ public:
     size_t nSendSize;   // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<CSerializeData> vSendMsg;
+    std::deque<CSerializedNetMsg> vSendMsg;
     CCriticalSection cs_vSend;
 
+    // socket readiness as last reported by epoll; only used by the socket handler thread
+    bool fSocketRegistered;
+    bool fSocketRecvReady;
+    bool fSocketSendReady;
+
     std::deque<CInv> vRecvGetData;
     std::deque<CNetMessage> vRecvMsg;
     CCriticalSection cs_vRecvMsg;
+    bool fRecvMsgAsync; // earlier messages are being processed by a message worker (protected by cs_vRecvMsg)
     uint64_t nRecvBytes;
     int nRecvVersion;
 
@@ -259,6 +303,10 @@ public:
     // b) the peer may tell us in their version message that we should not relay tx invs
     //    until they have initialized their bloom filter.
     bool fRelayTxes;
+    // The peer sent "sendcmpct" and understands compact blocks
+    bool fSupportsCompactBlocks;
+    // The peer wants new blocks pushed to it as "cmpctblock" rather than announced by inv
+    bool fPreferHeaderAndIDs;
     // Should be 'true' only if we connected to this node to actually mix funds.
     // In this case node will be released automatically via CServicenodeMan::ProcessServicenodeConnections().
     // Connecting to verify connectability/status or connecting for sending/relaying single message
@@ -302,7 +350,7 @@ public:
     std::set<uint256> setKnown;
 
     // inventory based relay
-    mruset<CInv> setInventoryKnown;
+    CRollingBloomFilter filterInventoryKnown;
     std::vector<CInv> vInventoryToSend;
     CCriticalSection cs_inventory;
     std::multimap<int64_t, CInv> mapAskFor;
@@ -397,11 +445,23 @@ public:
     }
 
 
+    /**
+     * Key of inv in filterInventoryKnown. Transactions and blocks are known by
+     * hash, other inventory shares the txid with them (MSG_DSTX,
+     * MSG_TXLOCK_REQUEST) and is told apart by its type.
+     */
+    static uint256 InventoryKnownKey(const CInv& inv)
+    {
+        if (inv.type == MSG_TX || inv.type == MSG_BLOCK)
+            return inv.hash;
+        return Hash(BEGIN(inv.type), END(inv.type), BEGIN(inv.hash), END(inv.hash));
+    }
+
     void AddInventoryKnown(const CInv& inv)
     {
         {
             LOCK(cs_inventory);
-            setInventoryKnown.insert(inv);
+            filterInventoryKnown.insert(InventoryKnownKey(inv));
         }
     }
 
@@ -409,7 +469,7 @@ public:
     {
         {
             LOCK(cs_inventory);
-            if (!setInventoryKnown.count(inv))
+            if (!filterInventoryKnown.contains(InventoryKnownKey(inv)))
                 vInventoryToSend.push_back(inv);
         }
     }
@@ -425,6 +485,19 @@ public:
     // TODO: Document the precondition of this function.  Is cs_vSend locked?
     void EndMessage() UNLOCK_FUNCTION(cs_vSend);
 
+    /** Queue a message built with MakeNetMsg; the buffer is shared, not copied */
+    void PushSerializedMessage(const CSerializedNetMsg& msg);
+
+    /**
+     * Memory held by the send queue. Buffers shared with other peers are
+     * attributed in equal parts to everyone holding them, so the sum over
+     * all peers is what the queues really use. Requires cs_vSend.
+     */
+    size_t GetSendQueueMemoryUsage() const;
+
+    /** Memory held by the inventory relay state: known inventory, invs to send and asked for. Requires cs_inventory. */
+    size_t GetInventoryMemoryUsage() const;
+
     void PushVersion();
 
 
@@ -19,7 +19,9 @@
 #include <boost/lexical_cast.hpp>
 
 #include <algorithm>
+#include <atomic>
 #include <boost/assign/list_of.hpp>
+#include <boost/thread.hpp>
 #include <openssl/rand.h>
 
 using namespace std;
@@ -2161,14 +2163,82 @@ bool CObfuScationSigner::SignMessage(std::string strMessage, std::string& errorM
     return true;
 }
 
+namespace {
+
+/**
+ * Valid message signature cache, so that pings, broadcasts and votes relayed
+ * by several peers or checked again when cleaning up don't repeat the public
+ * key recovery. Entries are the hash of (message hash, signature, key id).
+ */
+class CMessageSignatureCache
+{
+private:
+    std::set<uint256> setValid;
+    boost::shared_mutex cs_sigcache;
+    std::atomic<uint64_t> nHits;
+    std::atomic<uint64_t> nMisses;
+
+public:
+    CMessageSignatureCache() : nHits(0), nMisses(0) {}
+
+    static uint256 Entry(const uint256& hash, const std::vector<unsigned char>& vchSig, const CKeyID& keyID)
+    {
+        CHashWriter ss(SER_GETHASH, 0);
+        ss << hash << vchSig << keyID;
+        return ss.GetHash();
+    }
+
+    bool Get(const uint256& entry)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+        if (setValid.count(entry)) {
+            nHits++;
+            return true;
+        }
+        nMisses++;
+        return false;
+    }
+
+    void Set(const uint256& entry)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
+
+        while (setValid.size() >= OBFUSCATION_SIGCACHE_SIZE) {
+            // Evict a random entry, like the script signature cache does
+            std::set<uint256>::iterator it = setValid.lower_bound(GetRandHash());
+            if (it == setValid.end())
+                it = setValid.begin();
+            setValid.erase(it);
+        }
+        setValid.insert(entry);
+    }
+
+    void GetStats(size_t& nEntries, uint64_t& nHitsOut, uint64_t& nMissesOut)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+        nEntries = setValid.size();
+        nHitsOut = nHits;
+        nMissesOut = nMisses;
+    }
+};
+
+CMessageSignatureCache messageSignatureCache;
+
+}
+
 bool CObfuScationSigner::VerifyMessage(CPubKey pubkey, vector<unsigned char>& vchSig, std::string strMessage, std::string& errorMessage)
 {
     CHashWriter ss(SER_GETHASH, 0);
     ss << strMessageMagic;
     ss << strMessage;
+    uint256 hash = ss.GetHash();
+
+    uint256 entry = CMessageSignatureCache::Entry(hash, vchSig, pubkey.GetID());
+    if (messageSignatureCache.Get(entry))
+        return true;
 
     CPubKey pubkey2;
-    if (!pubkey2.RecoverCompact(ss.GetHash(), vchSig)) {
+    if (!pubkey2.RecoverCompact(hash, vchSig)) {
         errorMessage = _("Error recovering public key.");
         return false;
     }
@@ -2176,7 +2246,16 @@ bool CObfuScationSigner::VerifyMessage(CPubKey pubkey, vector<unsigned char>& vc
     if (fDebug && pubkey2.GetID() != pubkey.GetID())
         LogPrintf("CObfuScationSigner::VerifyMessage -- keys don't match: %s %s\n", pubkey2.GetID().ToString(), pubkey.GetID().ToString());
 
-    return (pubkey2.GetID() == pubkey.GetID());
+    if (pubkey2.GetID() != pubkey.GetID())
+        return false;
+
+    messageSignatureCache.Set(entry);
+    return true;
+}
+
+void CObfuScationSigner::GetCacheStats(size_t& nEntries, uint64_t& nHits, uint64_t& nMisses)
+{
+    messageSignatureCache.GetStats(nEntries, nHits, nMisses);
 }
 
 bool CObfuscationQueue::Sign()
@@ -42,6 +42,9 @@ class CActiveServicenode;
 #define OBFUSCATION_QUEUE_TIMEOUT 30
 #define OBFUSCATION_SIGNING_TIMEOUT 15
 
+// valid message signatures remembered by CObfuScationSigner::VerifyMessage
+#define OBFUSCATION_SIGCACHE_SIZE 50000
+
 // used for anonymous relaying of inputs/outputs/sigs
 #define OBFUSCATION_RELAY_IN 1
 #define OBFUSCATION_RELAY_OUT 2
@@ -258,6 +261,8 @@ public:
     bool SignMessage(std::string strMessage, std::string& errorMessage, std::vector<unsigned char>& vchSig, CKey key);
     /// Verify the message, returns true if succcessful
     bool VerifyMessage(CPubKey pubkey, std::vector<unsigned char>& vchSig, std::string strMessage, std::string& errorMessage);
+    /// Size and lookup counters of the cache of verified message signatures
+    void GetCacheStats(size_t& nEntries, uint64_t& nHits, uint64_t& nMisses);
 };
 
 /** Used to keep track of current status of Obfuscation pool
@@ -72,6 +72,11 @@ enum {
     // but no longer do as of protocol version 70011 (= NO_BLOOM_VERSION)
     NODE_BLOOM = (1 << 2),
 
+    // NODE_COMPACT_BLOCKS means the node understands "sendcmpct", "cmpctblock",
+    // "getblocktxn" and "blocktxn". Protocol versions from 70713 on are taken by
+    // the new chain (NEW_CHAIN_VERSION), so this can't be told by version.
+    NODE_COMPACT_BLOCKS = (1 << 3),
+
     // Bits 24-31 are reserved for temporary experiments. Just pick a bit that
     // isn't getting used, or one not being used much, and notify the
     // bitcoin-development mailing list. Remember that service bits are just
@@ -164,7 +169,9 @@ enum {
     MSG_SERVICENODE_QUORUM,
     MSG_SERVICENODE_ANNOUNCE,
     MSG_SERVICENODE_PING,
-    MSG_DSTX
+    MSG_DSTX,
+    // Like MSG_FILTERED_BLOCK, only used in getdata, for blocks to be sent as "cmpctblock"
+    MSG_CMPCT_BLOCK
 };
 
 #endif // BITCOIN_PROTOCOL_H
@@ -0,0 +1,228 @@
+// Copyright (c) 2018 The Blocknet developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "recordfile.h"
+
+#include "chainparams.h"
+#include "util.h"
+
+#include <boost/filesystem.hpp>
+
+/** Follows the magic message and network magic; older files continue with the data itself */
+static const uint32_t RECORDFILE_MARKER = 0x31434552; // "REC1"
+
+CRecordFile::CRecordFile(const std::string& strFilename, const std::string& strMagicMessageIn) : strMagicMessage(strMagicMessageIn),
+                                                                                                 nFileRecords(0),
+                                                                                                 fKnown(false),
+                                                                                                 fForeign(false)
+{
+    path = GetDataDir() / strFilename;
+}
+
+uint32_t CRecordFile::Checksum(const uint256& key, const std::vector<unsigned char>& vchData)
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << key << vchData;
+    return (uint32_t)ss.GetHash().Get64(0);
+}
+
+CRecordFile::ReadResult CRecordFile::ReadHeader(CDataStream& ss) const
+{
+    try {
+        std::string strMagicMessageTmp;
+        ss >> strMagicMessageTmp;
+        if (strMagicMessage != strMagicMessageTmp)
+            return IncorrectMagicMessage;
+
+        unsigned char pchMsgTmp[4];
+        ss >> FLATDATA(pchMsgTmp);
+        if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp)))
+            return IncorrectMagicNumber;
+
+        uint32_t nMarker;
+        ss >> nMarker;
+        if (nMarker != RECORDFILE_MARKER)
+            return IncorrectFormat;
+    } catch (const std::exception&) {
+        return IncorrectFormat;
+    }
+    return Ok;
+}
+
+CRecordFile::ReadResult CRecordFile::Read(RecordMap& mapRecords)
+{
+    fKnown = false;
+    mapRecords.clear();
+
+    FILE* file = fopen(path.string().c_str(), "rb");
+    CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        error("%s : Failed to open file %s", __func__, path.string());
+        return FileError;
+    }
+
+    std::vector<unsigned char> vchFile;
+    try {
+        vchFile.resize(boost::filesystem::file_size(path));
+        if (!vchFile.empty())
+            filein.read((char*)&vchFile[0], vchFile.size());
+    } catch (const std::exception& e) {
+        error("%s : I/O error - %s", __func__, e.what());
+        return FileError;
+    }
+    filein.fclose();
+
+    CDataStream ss(vchFile, SER_DISK, CLIENT_VERSION);
+    ReadResult result = ReadHeader(ss);
+    if (result == IncorrectMagicMessage || result == IncorrectMagicNumber)
+        fForeign = true;
+    if (result != Ok) {
+        error("%s : Invalid header in %s", __func__, path.string());
+        return result;
+    }
+
+    size_t nCorrupt = 0;
+    size_t nUnreadable = 0;
+    nFileRecords = 0;
+    mapHashes.clear();
+    while (!ss.empty()) {
+        uint256 key;
+        std::vector<unsigned char> vchData;
+        uint32_t nChecksum;
+        try {
+            nUnreadable = ss.size();
+            ss >> key >> vchData >> nChecksum;
+            nUnreadable = 0;
+        } catch (const std::exception&) {
+            // torn write at the end of the file, or a damaged length; either
+            // way there is no telling where the next record starts
+            break;
+        }
+        nFileRecords++;
+        if (nChecksum != Checksum(key, vchData)) {
+            nCorrupt++;
+            continue;
+        }
+        if (vchData.empty()) {
+            mapRecords.erase(key);
+            mapHashes.erase(key);
+        } else {
+            mapHashes[key] = Hash(vchData.begin(), vchData.end());
+            mapRecords[key].swap(vchData);
+        }
+    }
+
+    if (nCorrupt || nUnreadable)
+        LogPrintf("%s : %s has %u corrupt records (older versions of them may have been read instead) and %u unreadable bytes at the end\n",
+            __func__, path.filename().string(), nCorrupt, nUnreadable);
+
+    // Appending after damage would keep it around; the next write starts over
+    fKnown = !nCorrupt && !nUnreadable;
+    return Ok;
+}
+
+bool CRecordFile::Rewrite(const RecordMap& mapRecords)
+{
+    boost::filesystem::path pathTmp = path;
+    pathTmp += ".new";
+
+    FILE* file = fopen(pathTmp.string().c_str(), "wb");
+    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull())
+        return error("%s : Failed to open file %s", __func__, pathTmp.string());
+
+    mapHashes.clear();
+    try {
+        fileout << strMagicMessage << FLATDATA(Params().MessageStart()) << RECORDFILE_MARKER;
+        for (RecordMap::const_iterator it = mapRecords.begin(); it != mapRecords.end(); ++it) {
+            fileout << it->first << it->second << Checksum(it->first, it->second);
+            mapHashes[it->first] = Hash(it->second.begin(), it->second.end());
+        }
+        FileCommit(fileout.Get());
+    } catch (const std::exception& e) {
+        fKnown = false;
+        return error("%s : Serialize or I/O error - %s", __func__, e.what());
+    }
+    fileout.fclose();
+
+    if (!RenameOver(pathTmp, path)) {
+        fKnown = false;
+        return error("%s : Rename-into-place failed", __func__);
+    }
+    nFileRecords = mapRecords.size();
+    fKnown = true;
+    return true;
+}
+
+bool CRecordFile::Write(const RecordMap& mapRecords)
+{
+    if (!fKnown && !fForeign && boost::filesystem::exists(path)) {
+        // Not read this session; don't clobber someone else's file
+        FILE* file = fopen(path.string().c_str(), "rb");
+        CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
+        if (!filein.IsNull()) {
+            std::vector<unsigned char> vchHeader(std::min(boost::filesystem::file_size(path), (uintmax_t)256));
+            try {
+                if (!vchHeader.empty())
+                    filein.read((char*)&vchHeader[0], vchHeader.size());
+                CDataStream ss(vchHeader, SER_DISK, CLIENT_VERSION);
+                ReadResult result = ReadHeader(ss);
+                fForeign = (result == IncorrectMagicMessage || result == IncorrectMagicNumber);
+            } catch (const std::exception&) {
+            }
+        }
+    }
+    if (fForeign)
+        return error("%s : %s is not ours, please fix it manually", __func__, path.string());
+
+    // Records to append: new or changed ones, and erasures of the ones gone
+    std::vector<std::pair<uint256, const std::vector<unsigned char>*> > vChanged;
+    std::vector<uint256> vChangedHashes;
+    static const std::vector<unsigned char> vchErased;
+    if (fKnown) {
+        for (RecordMap::const_iterator it = mapRecords.begin(); it != mapRecords.end(); ++it) {
+            uint256 hash = Hash(it->second.begin(), it->second.end());
+            std::map<uint256, uint256>::const_iterator mi = mapHashes.find(it->first);
+            if (mi == mapHashes.end() || mi->second != hash) {
+                vChanged.push_back(std::make_pair(it->first, &it->second));
+                vChangedHashes.push_back(hash);
+            }
+        }
+        for (std::map<uint256, uint256>::const_iterator mi = mapHashes.begin(); mi != mapHashes.end(); ++mi) {
+            if (!mapRecords.count(mi->first))
+                vChanged.push_back(std::make_pair(mi->first, &vchErased));
+        }
+    }
+
+    if (!fKnown || nFileRecords + vChanged.size() > 2 * mapRecords.size() + 100)
+        return Rewrite(mapRecords);
+
+    if (vChanged.empty())
+        return true;
+
+    FILE* file = fopen(path.string().c_str(), "ab");
+    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull())
+        return error("%s : Failed to open file %s", __func__, path.string());
+
+    try {
+        for (size_t i = 0; i < vChanged.size(); i++) {
+            const uint256& key = vChanged[i].first;
+            const std::vector<unsigned char>& vchData = *vChanged[i].second;
+            fileout << key << vchData << Checksum(key, vchData);
+            if (vchData.empty())
+                mapHashes.erase(key);
+            else
+                mapHashes[key] = vChangedHashes[i];
+            nFileRecords++;
+        }
+        FileCommit(fileout.Get());
+    } catch (const std::exception& e) {
+        // part of the records may have made it, start over next time
+        fKnown = false;
+        return error("%s : Serialize or I/O error - %s", __func__, e.what());
+    }
+    fileout.fclose();
+    return true;
+}
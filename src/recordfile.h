@@ -0,0 +1,113 @@
+// Copyright (c) 2018 The Blocknet developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_RECORDFILE_H
+#define BITCOIN_RECORDFILE_H
+
+#include "clientversion.h"
+#include "hash.h"
+#include "streams.h"
+#include "uint256.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+/**
+ * File of checksummed records, the format of mncache.dat and budget.dat.
+ *
+ * After a header (magic message, network magic, format marker) the file holds
+ * records of a key, the serialized data and a checksum over both. A later
+ * record for the same key replaces an earlier one and a record without data
+ * erases it. A dump therefore only appends the records that changed since the
+ * file was last read or written. Once most records in the file are stale, it is
+ * rewritten.
+ *
+ * A record whose key or data is damaged fails its checksum and costs just that
+ * record; if it was an update or erasure, the older version of the record is
+ * read instead. Damage to a length ends the readable part of the file there,
+ * losing every record after it.
+ */
+class CRecordFile
+{
+public:
+    typedef std::map<uint256, std::vector<unsigned char> > RecordMap;
+
+    enum ReadResult {
+        Ok,
+        FileError,
+        IncorrectMagicMessage,
+        IncorrectMagicNumber,
+        IncorrectFormat
+    };
+
+private:
+    boost::filesystem::path path;
+    std::string strMagicMessage;
+
+    //! Hashes of the data of the live records in the file, valid if fKnown
+    std::map<uint256, uint256> mapHashes;
+    //! Number of records in the file, including replaced and erased ones
+    size_t nFileRecords;
+    //! Whether the file on disk is described by mapHashes
+    bool fKnown;
+    //! The file belongs to something else, never overwrite it
+    bool fForeign;
+
+    ReadResult ReadHeader(CDataStream& ss) const;
+    bool Rewrite(const RecordMap& mapRecords);
+
+public:
+    CRecordFile(const std::string& strFilename, const std::string& strMagicMessageIn);
+
+    /** Read the live records; records failing their checksum are skipped */
+    ReadResult Read(RecordMap& mapRecords);
+
+    /** Make the file hold exactly mapRecords, appending what changed where possible */
+    bool Write(const RecordMap& mapRecords);
+
+    /** Short checksum stored with a record to detect damage on disk */
+    static uint32_t Checksum(const uint256& key, const std::vector<unsigned char>& vchData);
+
+    /** Key of the record of one object of a kind (chType), identified by id */
+    template <typename T>
+    static uint256 GetKey(char chType, const T& id)
+    {
+        CHashWriter ss(SER_GETHASH, 0);
+        ss << chType << id;
+        return ss.GetHash();
+    }
+
+    /** Add the record of one object; the data holds the kind and id as well */
+    template <typename K, typename V>
+    static void Add(RecordMap& mapRecords, char chType, const K& id, const V& obj)
+    {
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        ss << chType << id << obj;
+        mapRecords[GetKey(chType, id)].assign(ss.begin(), ss.end());
+    }
+
+    /** Add a record for every entry of a map */
+    template <typename K, typename V>
+    static void AddMap(RecordMap& mapRecords, char chType, const std::map<K, V>& mapObjs)
+    {
+        for (typename std::map<K, V>::const_iterator it = mapObjs.begin(); it != mapObjs.end(); ++it)
+            Add(mapRecords, chType, it->first, it->second);
+    }
+
+    /** Read the id and object following the kind of a record into a map */
+    template <typename K, typename V>
+    static void ReadMapEntry(CDataStream& ss, std::map<K, V>& mapObjs)
+    {
+        K id;
+        V obj;
+        ss >> id >> obj;
+        mapObjs.erase(id);
+        mapObjs.insert(std::make_pair(id, obj));
+    }
+};
+
+#endif // BITCOIN_RECORDFILE_H
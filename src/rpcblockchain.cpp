@@ -165,10 +165,17 @@ Value getrawmempool(const Array& params, bool fHelp)
             "  \"transactionid\" : {       (json object)\n"
             "    \"size\" : n,             (numeric) transaction size in bytes\n"
             "    \"fee\" : n,              (numeric) transaction fee in blocknet\n"
+            "    \"modifiedfee\" : n,      (numeric) transaction fee with fee deltas used for mining priority\n"
             "    \"time\" : n,             (numeric) local time transaction entered pool in seconds since 1 Jan 1970 GMT\n"
             "    \"height\" : n,           (numeric) block height when transaction entered pool\n"
             "    \"startingpriority\" : n, (numeric) priority when transaction entered pool\n"
             "    \"currentpriority\" : n,  (numeric) transaction priority now\n"
+            "    \"descendantcount\" : n,  (numeric) number of in-mempool descendant transactions (including this one)\n"
+            "    \"descendantsize\" : n,   (numeric) size of in-mempool descendants (including this one)\n"
+            "    \"descendantfees\" : n,   (numeric) modified fees (see above) of in-mempool descendants (including this one)\n"
+            "    \"ancestorcount\" : n,    (numeric) number of in-mempool ancestor transactions (including this one)\n"
+            "    \"ancestorsize\" : n,     (numeric) size of in-mempool ancestors (including this one)\n"
+            "    \"ancestorfees\" : n,     (numeric) modified fees (see above) of in-mempool ancestors (including this one)\n"
             "    \"depends\" : [           (array) unconfirmed transactions used as inputs for this transaction\n"
             "        \"transactionid\",    (string) parent transaction id\n"
             "       ... ]\n"
@@ -184,16 +191,22 @@ Value getrawmempool(const Array& params, bool fHelp)
     if (fVerbose) {
         LOCK(mempool.cs);
         Object o;
-        BOOST_FOREACH (const PAIRTYPE(uint256, CTxMemPoolEntry) & entry, mempool.mapTx) {
-            const uint256& hash = entry.first;
-            const CTxMemPoolEntry& e = entry.second;
+        BOOST_FOREACH (const CTxMemPoolEntry& e, mempool.mapTx) {
+            const uint256& hash = e.GetTx().GetHash();
             Object info;
             info.push_back(Pair("size", (int)e.GetTxSize()));
             info.push_back(Pair("fee", ValueFromAmount(e.GetFee())));
+            info.push_back(Pair("modifiedfee", ValueFromAmount(e.GetModifiedFee())));
             info.push_back(Pair("time", e.GetTime()));
             info.push_back(Pair("height", (int)e.GetHeight()));
             info.push_back(Pair("startingpriority", e.GetPriority(e.GetHeight())));
             info.push_back(Pair("currentpriority", e.GetPriority(chainActive.Height())));
+            info.push_back(Pair("descendantcount", e.GetCountWithDescendants()));
+            info.push_back(Pair("descendantsize", e.GetSizeWithDescendants()));
+            info.push_back(Pair("descendantfees", e.GetModFeesWithDescendants()));
+            info.push_back(Pair("ancestorcount", e.GetCountWithAncestors()));
+            info.push_back(Pair("ancestorsize", e.GetSizeWithAncestors()));
+            info.push_back(Pair("ancestorfees", e.GetModFeesWithAncestors()));
             const CTransaction& tx = e.GetTx();
             set<string> setDepends;
             BOOST_FOREACH (const CTxIn& txin, tx.vin) {
@@ -627,6 +640,22 @@ Value getmempoolinfo(const Array& params, bool fHelp)
             "{\n"
             "  \"size\": xxxxx                (numeric) Current tx count\n"
             "  \"bytes\": xxxxx               (numeric) Sum of all tx sizes\n"
+            "  \"usage\": xxxxx               (numeric) Total memory usage for the mempool\n"
+            "  \"maxmempool\": xxxxx          (numeric) Maximum memory usage for the mempool\n"
+            "  \"mempoolminfee\": xxxxx       (numeric) Minimum fee for tx to be accepted\n"
+            "  \"orphans\": {                 (json object) Transactions waiting for a missing parent\n"
+            "     \"size\": xxxxx             (numeric) Current orphan count\n"
+            "     \"bytes\": xxxxx            (numeric) Sum of all orphan sizes\n"
+            "     \"peers\": xxxxx            (numeric) Number of peers orphans came from\n"
+            "     \"added\": xxxxx            (numeric) Orphans stored since startup\n"
+            "     \"rejected\": xxxxx         (numeric) Orphans too big to store\n"
+            "     \"accepted\": xxxxx         (numeric) Orphans accepted to the mempool once their parent arrived\n"
+            "     \"removed\": xxxxx          (numeric) Orphans not accepted once their parent arrived\n"
+            "     \"expired\": xxxxx          (numeric) Orphans expired\n"
+            "     \"evicted\": xxxxx          (numeric) Orphans evicted to stay within -maxorphantx and -maxorphantxsize\n"
+            "     \"erasedforpeer\": xxxxx    (numeric) Orphans erased because their sender disconnected\n"
+            "     \"erasedforblock\": xxxxx   (numeric) Orphans erased because a block included or conflicted them\n"
+            "  }\n"
             "}\n"
             "\nExamples:\n" +
             HelpExampleCli("getmempoolinfo", "") + HelpExampleRpc("getmempoolinfo", ""));
@@ -634,6 +663,29 @@ Value getmempoolinfo(const Array& params, bool fHelp)
     Object ret;
     ret.push_back(Pair("size", (int64_t)mempool.size()));
     ret.push_back(Pair("bytes", (int64_t)mempool.GetTotalTxSize()));
+    ret.push_back(Pair("usage", (int64_t)mempool.DynamicMemoryUsage()));
+    size_t maxmempool = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
+    ret.push_back(Pair("maxmempool", (int64_t)maxmempool));
+    ret.push_back(Pair("mempoolminfee", ValueFromAmount(mempool.GetMinFee(maxmempool).GetFeePerK())));
+
+    COrphanStats stats;
+    {
+        LOCK(cs_main);
+        GetOrphanStats(stats);
+    }
+    Object orphans;
+    orphans.push_back(Pair("size", (uint64_t)stats.nOrphans));
+    orphans.push_back(Pair("bytes", (uint64_t)stats.nBytes));
+    orphans.push_back(Pair("peers", (uint64_t)stats.nPeers));
+    orphans.push_back(Pair("added", stats.nAdded));
+    orphans.push_back(Pair("rejected", stats.nRejected));
+    orphans.push_back(Pair("accepted", stats.nAccepted));
+    orphans.push_back(Pair("removed", stats.nRemoved));
+    orphans.push_back(Pair("expired", stats.nExpired));
+    orphans.push_back(Pair("evicted", stats.nEvicted));
+    orphans.push_back(Pair("erasedforpeer", stats.nErasedForPeer));
+    orphans.push_back(Pair("erasedforblock", stats.nErasedForBlock));
+    ret.push_back(Pair("orphans", orphans));
 
     return ret;
 }
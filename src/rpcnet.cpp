@@ -113,6 +113,10 @@ Value getpeerinfo(const Array& params, bool fHelp)
             "    \"lastrecv\": ttt,           (numeric) The time in seconds since epoch (Jan 1 1970 GMT) of the last receive\n"
             "    \"bytessent\": n,            (numeric) The total bytes sent\n"
             "    \"bytesrecv\": n,            (numeric) The total bytes received\n"
+            "    \"sendqueuemsgs\": n,        (numeric) The number of messages waiting to be sent\n"
+            "    \"sendqueuebytes\": n,       (numeric) The bytes waiting to be sent\n"
+            "    \"sendqueuemem\": n,         (numeric) The memory used by the send queue, with buffers shared between peers split among them\n"
+            "    \"inventorymem\": n,         (numeric) The memory used to track the inventory known to, to be sent to and asked from the peer\n"
             "    \"conntime\": ttt,           (numeric) The connection time in seconds since epoch (Jan 1 1970 GMT)\n"
             "    \"pingtime\": n,             (numeric) ping time\n"
             "    \"pingwait\": n,             (numeric) ping wait\n"
@@ -151,6 +155,10 @@ Value getpeerinfo(const Array& params, bool fHelp)
         obj.push_back(Pair("lastrecv", stats.nLastRecv));
         obj.push_back(Pair("bytessent", stats.nSendBytes));
         obj.push_back(Pair("bytesrecv", stats.nRecvBytes));
+        obj.push_back(Pair("sendqueuemsgs", (uint64_t)stats.nSendQueueMsgs));
+        obj.push_back(Pair("sendqueuebytes", (uint64_t)stats.nSendQueueBytes));
+        obj.push_back(Pair("sendqueuemem", (uint64_t)stats.nSendQueueMemory));
+        obj.push_back(Pair("inventorymem", (uint64_t)stats.nInventoryMemory));
         obj.push_back(Pair("conntime", stats.nTimeConnected));
         obj.push_back(Pair("pingtime", stats.dPingTime));
         if (stats.dPingWait > 0.0)
@@ -1141,6 +1141,8 @@ Value sendrawtransaction(const Array& params, bool fHelp)
     if (params.size() > 1)
         fOverrideFees = params[1].get_bool();
 
+    PreverifyTransaction(mempool, tx);
+
     LOCK(cs_main);
 
     CCoinsViewCache& view = *pcoinsTip;
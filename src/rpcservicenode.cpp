@@ -14,6 +14,7 @@
 #include "servicenodeconfig.h"
 #include "servicenodeman.h"
 #include "rpcserver.h"
+#include "swifttx.h"
 #include "utilmoneystr.h"
 #include "tinyformat.h"
 #include "primitives/transaction.h"
@@ -202,6 +203,26 @@ Value servicenode(const Array& params, bool fHelp)
             obj.push_back(Pair("enabled", mnodeman.CountEnabled()));
             obj.push_back(Pair("inqueue", nCount));
 
+            size_t nEntries;
+            uint64_t nHits, nMisses;
+            obfuScationSigner.GetCacheStats(nEntries, nHits, nMisses);
+            Object sigcache;
+            sigcache.push_back(Pair("entries", (uint64_t)nEntries));
+            sigcache.push_back(Pair("hits", nHits));
+            sigcache.push_back(Pair("misses", nMisses));
+            obj.push_back(Pair("sigcache", sigcache));
+
+            size_t nLocks;
+            uint64_t nCompleted;
+            int64_t nAvgLockMs, nMaxLockMs;
+            GetSwiftTxStats(nLocks, nCompleted, nAvgLockMs, nMaxLockMs);
+            Object swifttx;
+            swifttx.push_back(Pair("locks", (uint64_t)nLocks));
+            swifttx.push_back(Pair("completed", nCompleted));
+            swifttx.push_back(Pair("avglockms", nAvgLockMs));
+            swifttx.push_back(Pair("maxlockms", nMaxLockMs));
+            obj.push_back(Pair("swifttx", swifttx));
+
             return obj;
         }
         return mnodeman.size();
@@ -8,6 +8,7 @@
 #include "main.h"
 
 #include "addrman.h"
+#include "checkqueue.h"
 #include "servicenode-budget.h"
 #include "servicenode-sync.h"
 #include "servicenode.h"
@@ -260,39 +261,20 @@ void CBudgetManager::SubmitFinalBudget()
 // CBudgetDB
 //
 
-CBudgetDB::CBudgetDB()
+static CRecordFile& GetBudgetFile()
 {
-    pathDB = GetDataDir() / "budget.dat";
-    strMagicMessage = "ServicenodeBudget";
+    static CRecordFile file("budget.dat", "ServicenodeBudget");
+    return file;
 }
 
 bool CBudgetDB::Write(const CBudgetManager& objToSave)
 {
-    LOCK(objToSave.cs);
-
     int64_t nStart = GetTimeMillis();
 
-    // serialize, checksum data up to that point, then append checksum
-    CDataStream ssObj(SER_DISK, CLIENT_VERSION);
-    ssObj << strMagicMessage;                   // servicenode cache file specific magic message
-    ssObj << FLATDATA(Params().MessageStart()); // network specific magic number
-    ssObj << objToSave;
-    uint256 hash = Hash(ssObj.begin(), ssObj.end());
-    ssObj << hash;
-
-    // open output file, and associate with CAutoFile
-    FILE* file = fopen(pathDB.string().c_str(), "wb");
-    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("%s : Failed to open file %s", __func__, pathDB.string());
-
-    // Write and commit header, data
-    try {
-        fileout << ssObj;
-    } catch (std::exception& e) {
-        return error("%s : Serialize or I/O error - %s", __func__, e.what());
-    }
-    fileout.fclose();
+    CRecordFile::RecordMap mapRecords;
+    objToSave.GetRecords(mapRecords);
+    if (!GetBudgetFile().Write(mapRecords))
+        return false;
 
     LogPrintf("Written info to budget.dat  %dms\n", GetTimeMillis() - nStart);
 
@@ -301,85 +283,32 @@ bool CBudgetDB::Write(const CBudgetManager& objToSave)
 
 CBudgetDB::ReadResult CBudgetDB::Read(CBudgetManager& objToLoad, bool fDryRun)
 {
-    LOCK(objToLoad.cs);
-
     int64_t nStart = GetTimeMillis();
-    // open input file, and associate with CAutoFile
-    FILE* file = fopen(pathDB.string().c_str(), "rb");
-    CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull()) {
-        error("%s : Failed to open file %s", __func__, pathDB.string());
-        return FileError;
-    }
-
-    // use file size to size memory buffer
-    int fileSize = boost::filesystem::file_size(pathDB);
-    int dataSize = fileSize - sizeof(uint256);
-    // Don't try to resize to a negative number if file is small
-    if (dataSize < 0)
-        dataSize = 0;
-    vector<unsigned char> vchData;
-    vchData.resize(dataSize);
-    uint256 hashIn;
-
-    // read data and checksum from file
-    try {
-        filein.read((char*)&vchData[0], dataSize);
-        filein >> hashIn;
-    } catch (std::exception& e) {
-        error("%s : Deserialize or I/O error - %s", __func__, e.what());
-        return HashReadError;
-    }
-    filein.fclose();
-
-    CDataStream ssObj(vchData, SER_DISK, CLIENT_VERSION);
-
-    // verify stored checksum matches input data
-    uint256 hashTmp = Hash(ssObj.begin(), ssObj.end());
-    if (hashIn != hashTmp) {
-        error("%s : Checksum mismatch, data corrupted", __func__);
-        return IncorrectHash;
-    }
-
-
-    unsigned char pchMsgTmp[4];
-    std::string strMagicMessageTmp;
-    try {
-        // de-serialize file header (servicenode cache file specific magic message) and ..
-        ssObj >> strMagicMessageTmp;
-
-        // ... verify the message matches predefined one
-        if (strMagicMessage != strMagicMessageTmp) {
-            error("%s : Invalid servicenode cache magic message", __func__);
-            return IncorrectMagicMessage;
-        }
 
-
-        // de-serialize file header (network specific magic number) and ..
-        ssObj >> FLATDATA(pchMsgTmp);
-
-        // ... verify the network matches ours
-        if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp))) {
-            error("%s : Invalid network magic number", __func__);
-            return IncorrectMagicNumber;
-        }
-
-        // de-serialize data into CBudgetManager object
-        ssObj >> objToLoad;
-    } catch (std::exception& e) {
-        objToLoad.Clear();
-        error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    CRecordFile::RecordMap mapRecords;
+    switch (GetBudgetFile().Read(mapRecords)) {
+    case CRecordFile::Ok:
+        break;
+    case CRecordFile::FileError:
+        return FileError;
+    case CRecordFile::IncorrectMagicMessage:
+        return IncorrectMagicMessage;
+    case CRecordFile::IncorrectMagicNumber:
+        return IncorrectMagicNumber;
+    case CRecordFile::IncorrectFormat:
         return IncorrectFormat;
     }
+    if (fDryRun)
+        return Ok;
+
+    objToLoad.LoadRecords(mapRecords);
 
     LogPrintf("Loaded info from budget.dat  %dms\n", GetTimeMillis() - nStart);
     LogPrintf("  %s\n", objToLoad.ToString());
-    if (!fDryRun) {
-        LogPrintf("Budget manager - cleaning....\n");
-        objToLoad.CheckAndRemove();
-        LogPrintf("Budget manager - result:\n");
-        LogPrintf("  %s\n", objToLoad.ToString());
-    }
+    LogPrintf("Budget manager - cleaning....\n");
+    objToLoad.CheckAndRemove();
+    LogPrintf("Budget manager - result:\n");
+    LogPrintf("  %s\n", objToLoad.ToString());
 
     return Ok;
 }
@@ -388,29 +317,75 @@ void DumpBudgets()
 {
     int64_t nStart = GetTimeMillis();
 
+    // Records of a file that isn't ours are left alone by CRecordFile
     CBudgetDB budgetdb;
-    CBudgetManager tempBudget;
-
-    LogPrintf("Verifying budget.dat format...\n");
-    CBudgetDB::ReadResult readResult = budgetdb.Read(tempBudget, true);
-    // there was an error and it was not an error on file opening => do not proceed
-    if (readResult == CBudgetDB::FileError)
-        LogPrintf("Missing budgets file - budget.dat, will try to recreate\n");
-    else if (readResult != CBudgetDB::Ok) {
-        LogPrintf("Error reading budget.dat: ");
-        if (readResult == CBudgetDB::IncorrectFormat)
-            LogPrintf("magic is ok but data has invalid format, will try to recreate\n");
-        else {
-            LogPrintf("file format is unknown or invalid, please fix it manually\n");
-            return;
-        }
-    }
     LogPrintf("Writting info to budget.dat...\n");
     budgetdb.Write(budget);
 
     LogPrintf("Budget dump finished  %dms\n", GetTimeMillis() - nStart);
 }
 
+void CBudgetManager::GetRecords(CRecordFile::RecordMap& mapRecords) const
+{
+    LOCK(cs);
+
+    CRecordFile::AddMap(mapRecords, 'P', mapSeenServicenodeBudgetProposals);
+    CRecordFile::AddMap(mapRecords, 'V', mapSeenServicenodeBudgetVotes);
+    CRecordFile::AddMap(mapRecords, 'F', mapSeenFinalizedBudgets);
+    CRecordFile::AddMap(mapRecords, 'W', mapSeenFinalizedBudgetVotes);
+    CRecordFile::AddMap(mapRecords, 'v', mapOrphanServicenodeBudgetVotes);
+    CRecordFile::AddMap(mapRecords, 'w', mapOrphanFinalizedBudgetVotes);
+    CRecordFile::AddMap(mapRecords, 'p', mapProposals);
+    CRecordFile::AddMap(mapRecords, 'f', mapFinalizedBudgets);
+}
+
+void CBudgetManager::LoadRecords(const CRecordFile::RecordMap& mapRecords)
+{
+    LOCK(cs);
+    Clear();
+
+    int nInvalid = 0;
+    for (CRecordFile::RecordMap::const_iterator it = mapRecords.begin(); it != mapRecords.end(); ++it) {
+        CDataStream ss(it->second, SER_DISK, CLIENT_VERSION);
+        try {
+            char chType;
+            ss >> chType;
+            switch (chType) {
+            case 'P':
+                CRecordFile::ReadMapEntry(ss, mapSeenServicenodeBudgetProposals);
+                break;
+            case 'V':
+                CRecordFile::ReadMapEntry(ss, mapSeenServicenodeBudgetVotes);
+                break;
+            case 'F':
+                CRecordFile::ReadMapEntry(ss, mapSeenFinalizedBudgets);
+                break;
+            case 'W':
+                CRecordFile::ReadMapEntry(ss, mapSeenFinalizedBudgetVotes);
+                break;
+            case 'v':
+                CRecordFile::ReadMapEntry(ss, mapOrphanServicenodeBudgetVotes);
+                break;
+            case 'w':
+                CRecordFile::ReadMapEntry(ss, mapOrphanFinalizedBudgetVotes);
+                break;
+            case 'p':
+                CRecordFile::ReadMapEntry(ss, mapProposals);
+                break;
+            case 'f':
+                CRecordFile::ReadMapEntry(ss, mapFinalizedBudgets);
+                break;
+            default:
+                nInvalid++;
+            }
+        } catch (const std::exception&) {
+            nInvalid++;
+        }
+    }
+    if (nInvalid)
+        LogPrintf("CBudgetManager::LoadRecords - skipped %d invalid records\n", nInvalid);
+}
+
 bool CBudgetManager::AddFinalizedBudget(CFinalizedBudget& finalizedBudget)
 {
     LOCK(cs);
@@ -439,6 +414,7 @@ bool CBudgetManager::AddProposal(CBudgetProposal& budgetProposal)
     }
 
     mapProposals.insert(make_pair(budgetProposal.GetHash(), budgetProposal));
+    fRankingDirty = true;
     LogPrintf("CBudgetManager::AddProposal - proposal %s added\n", budgetProposal.GetName ().c_str ());
     return true;
 }
@@ -723,16 +699,30 @@ bool CBudgetManager::IsTransactionValid(const CTransaction& txNew, int nBlockHei
     return true;
 }
 
+// Drop the votes of servicenodes that are gone from the tallies, at most every SERVICENODE_CHECK_SECONDS
+void CBudgetManager::CheckProposalVotes()
+{
+    AssertLockHeld(cs);
+
+    if (GetTime() - nTimeVotesChecked < SERVICENODE_CHECK_SECONDS)
+        return;
+
+    for (auto &item : mapProposals)
+        item.second.CleanAndRemove(false);
+    fRankingDirty = true;
+    nTimeVotesChecked = GetTime();
+}
+
 std::vector<CBudgetProposal*> CBudgetManager::GetAllProposals()
 {
     LOCK(cs);
 
     std::vector<CBudgetProposal*> vBudgetProposalRet;
 
+    CheckProposalVotes();
+
     std::map<uint256, CBudgetProposal>::iterator it = mapProposals.begin();
     while (it != mapProposals.end()) {
-        (*it).second.CleanAndRemove(false);
-
         CBudgetProposal* pbudgetProposal = &((*it).second);
         vBudgetProposalRet.push_back(pbudgetProposal);
 
@@ -769,14 +759,17 @@ std::vector<CBudgetProposal*> CBudgetManager::GetBudget() {
     
     LOCK(cs);
     
-    // Sort budgets by votes
-    std::vector<std::pair<CBudgetProposal*, int>> vBudgetProposalsSort;
-    for (auto &item : mapProposals) {
-        CBudgetProposal *proposal = &(item.second);
-        proposal->CleanAndRemove(false);
-        vBudgetProposalsSort.emplace_back(proposal, proposal->Votes());
-    }
-    std::sort(vBudgetProposalsSort.begin(), vBudgetProposalsSort.end(), sortProposalsByVotes());
+    // Sort budgets by votes, unless no tally changed since the last time
+    CheckProposalVotes();
+    if (fRankingDirty || vRankedProposals.size() != mapProposals.size()) {
+        vRankedProposals.clear();
+        for (auto &item : mapProposals) {
+            CBudgetProposal *proposal = &(item.second);
+            vRankedProposals.emplace_back(proposal, proposal->Votes());
+        }
+        std::sort(vRankedProposals.begin(), vRankedProposals.end(), sortProposalsByVotes());
+        fRankingDirty = false;
+    }
     
     // Next superblock start
     int nBlockStart = chainHeight - chainHeight % GetBudgetPaymentCycleBlocks() + GetBudgetPaymentCycleBlocks();
@@ -787,7 +780,7 @@ std::vector<CBudgetProposal*> CBudgetManager::GetBudget() {
     CAmount nBudgetAllocated = 0;
     
     // Get valid proposals for the next superblock
-    for (auto &item : vBudgetProposalsSort) {
+    for (auto &item : vRankedProposals) {
         CBudgetProposal *pbudgetProposal = item.first;
         if (pbudgetProposal->fValid &&                                      // valid proposal
             pbudgetProposal->nBlockStart <= nBlockStart &&                  // valid start
@@ -958,6 +951,8 @@ void CBudgetManager::NewBlock()
         (*it2).second.CleanAndRemove(false);
         ++it2;
     }
+    fRankingDirty = true;
+    nTimeVotesChecked = GetTime();
 
     LogPrint("mnbudget", "CBudgetManager::NewBlock - mapFinalizedBudgets cleanup - size: %d\n", mapFinalizedBudgets.size());
     std::map<uint256, CFinalizedBudget>::iterator it3 = mapFinalizedBudgets.begin();
@@ -1193,6 +1188,101 @@ void CBudgetManager::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
     }
 }
 
+namespace {
+
+/** Signature check of a servicenode vote */
+class CBudgetVoteCheck
+{
+private:
+    CPubKey pubKeyServicenode;
+    std::vector<unsigned char> vchSig;
+    std::string strMessage;
+
+public:
+    CBudgetVoteCheck() {}
+    CBudgetVoteCheck(const CPubKey& pubKeyIn, const std::vector<unsigned char>& vchSigIn, const std::string& strMessageIn) :
+        pubKeyServicenode(pubKeyIn), vchSig(vchSigIn), strMessage(strMessageIn) {}
+
+    bool operator()()
+    {
+        // Only done to fill the signature cache; an invalid vote must not
+        // stop the queue from checking the rest, it's rejected when processed
+        std::string errorMessage;
+        obfuScationSigner.VerifyMessage(pubKeyServicenode, vchSig, strMessage, errorMessage);
+        return true;
+    }
+
+    void swap(CBudgetVoteCheck& check)
+    {
+        std::swap(pubKeyServicenode, check.pubKeyServicenode);
+        vchSig.swap(check.vchSig);
+        strMessage.swap(check.strMessage);
+    }
+};
+
+}
+
+static CCheckQueue<CBudgetVoteCheck> budgetvotecheckqueue(16);
+static boost::mutex csBudgetVoteCheckQueue;
+
+void ThreadBudgetVoteCheck()
+{
+    RenameThread("blocknetdx-votecheck");
+    budgetvotecheckqueue.Thread();
+}
+
+void CBudgetManager::PreverifyVotes(const std::deque<CNetMessage>& vMsgs)
+{
+    if (fLiteMode || !nScriptCheckThreads) return;
+    if (!servicenodeSync.IsBlockchainSynced()) return;
+
+    std::vector<CBudgetVoteCheck> vChecks;
+    BOOST_FOREACH (const CNetMessage& msg, vMsgs) {
+        std::string strCommand = msg.hdr.GetCommand();
+        if (strCommand != "mvote" && strCommand != "fbvote")
+            continue;
+
+        CDataStream vRecv(msg.vRecv);
+        CTxIn vin;
+        std::vector<unsigned char> vchSig;
+        std::string strMessage;
+        try {
+            if (strCommand == "mvote") {
+                CBudgetVote vote;
+                vRecv >> vote;
+                vin = vote.vin;
+                vchSig = vote.vchSig;
+                strMessage = vote.GetSignatureMessage();
+            } else {
+                CFinalizedBudgetVote vote;
+                vRecv >> vote;
+                vin = vote.vin;
+                vchSig = vote.vchSig;
+                strMessage = vote.GetSignatureMessage();
+            }
+        } catch (const std::exception&) {
+            continue; // reported when the message is processed
+        }
+
+        CPubKey pubKeyServicenode;
+        if (!mnodeman.GetServicenodePubKey(vin, pubKeyServicenode))
+            continue;
+        vChecks.push_back(CBudgetVoteCheck(pubKeyServicenode, vchSig, strMessage));
+    }
+
+    if (vChecks.size() < 2)
+        return;
+
+    // Somebody else is using the queue; the votes are checked one by one when processed
+    boost::unique_lock<boost::mutex> lock(csBudgetVoteCheckQueue, boost::try_to_lock);
+    if (!lock.owns_lock())
+        return;
+
+    CCheckQueueControl<CBudgetVoteCheck> control(&budgetvotecheckqueue);
+    control.Add(vChecks);
+    control.Wait();
+}
+
 bool CBudgetManager::PropExists(uint256 nHash)
 {
     if (mapProposals.count(nHash)) return true;
@@ -1367,7 +1457,11 @@ bool CBudgetManager::UpdateProposal(CBudgetVote& vote, CNode* pfrom, std::string
         return false;
     }
 
-    return mapProposals[vote.nProposalHash].AddOrUpdateVote(vote, strError);
+    if (!mapProposals[vote.nProposalHash].AddOrUpdateVote(vote, strError))
+        return false;
+
+    fRankingDirty = true;
+    return true;
 }
 
 bool CBudgetManager::UpdateFinalizedBudget(CFinalizedBudgetVote& vote, CNode* pfrom, std::string& strError)
@@ -1404,6 +1498,7 @@ CBudgetProposal::CBudgetProposal()
     nAmount = 0;
     nTime = 0;
     fValid = true;
+    nYeas = nNays = nAbstains = nAllYeas = nAllNays = 0;
 }
 
 CBudgetProposal::CBudgetProposal(std::string strProposalNameIn, std::string strURLIn, int nBlockStartIn, int nBlockEndIn, CScript addressIn, CAmount nAmountIn, uint256 nFeeTXHashIn)
@@ -1416,6 +1511,7 @@ CBudgetProposal::CBudgetProposal(std::string strProposalNameIn, std::string strU
     nAmount = nAmountIn;
     nFeeTXHash = nFeeTXHashIn;
     fValid = true;
+    nYeas = nNays = nAbstains = nAllYeas = nAllNays = 0;
 }
 
 CBudgetProposal::CBudgetProposal(const CBudgetProposal& other)
@@ -1430,6 +1526,11 @@ CBudgetProposal::CBudgetProposal(const CBudgetProposal& other)
     nFeeTXHash = other.nFeeTXHash;
     mapVotes = other.mapVotes;
     fValid = true;
+    nYeas = other.nYeas;
+    nNays = other.nNays;
+    nAbstains = other.nAbstains;
+    nAllYeas = other.nAllYeas;
+    nAllNays = other.nAllNays;
 }
 
 bool CBudgetProposal::IsValid(std::string& strError, bool fCheckCollateral)
@@ -1511,76 +1612,71 @@ bool CBudgetProposal::AddOrUpdateVote(CBudgetVote& vote, std::string& strError)
         return false;
     }
 
-    mapVotes[hash] = vote;
+    std::map<uint256, CBudgetVote>::iterator it = mapVotes.find(hash);
+    if (it != mapVotes.end()) {
+        CountVote((*it).second, -1);
+        (*it).second = vote;
+    } else {
+        mapVotes.insert(make_pair(hash, vote));
+    }
+    CountVote(vote, 1);
     return true;
 }
 
-// If servicenode voted for a proposal, but is now invalid -- remove the vote
-void CBudgetProposal::CleanAndRemove(bool fSignatureCheck)
+void CBudgetProposal::CountVote(const CBudgetVote& vote, int nCount)
 {
-    std::map<uint256, CBudgetVote>::iterator it = mapVotes.begin();
+    if (vote.nVote == VOTE_YES) nAllYeas += nCount;
+    if (vote.nVote == VOTE_NO) nAllNays += nCount;
 
-    while (it != mapVotes.end()) {
-        (*it).second.fValid = (*it).second.SignatureValid(fSignatureCheck);
-        ++it;
-    }
+    if (!vote.fValid) return;
+    if (vote.nVote == VOTE_YES) nYeas += nCount;
+    if (vote.nVote == VOTE_NO) nNays += nCount;
+    if (vote.nVote == VOTE_ABSTAIN) nAbstains += nCount;
 }
 
-double CBudgetProposal::GetRatio()
+void CBudgetProposal::UpdateTallies()
 {
-    int yeas = 0;
-    int nays = 0;
+    nYeas = nNays = nAbstains = nAllYeas = nAllNays = 0;
+    for (std::map<uint256, CBudgetVote>::const_iterator it = mapVotes.begin(); it != mapVotes.end(); ++it)
+        CountVote((*it).second, 1);
+}
 
+// If servicenode voted for a proposal, but is now invalid -- remove the vote
+void CBudgetProposal::CleanAndRemove(bool fSignatureCheck)
+{
     std::map<uint256, CBudgetVote>::iterator it = mapVotes.begin();
 
     while (it != mapVotes.end()) {
-        if ((*it).second.nVote == VOTE_YES) yeas++;
-        if ((*it).second.nVote == VOTE_NO) nays++;
+        bool fVoteValid = (*it).second.SignatureValid(fSignatureCheck);
+        if (fVoteValid != (*it).second.fValid) {
+            CountVote((*it).second, -1);
+            (*it).second.fValid = fVoteValid;
+            CountVote((*it).second, 1);
+        }
         ++it;
     }
+}
 
-    if (yeas + nays == 0) return 0.0f;
+double CBudgetProposal::GetRatio()
+{
+    if (nAllYeas + nAllNays == 0) return 0.0f;
 
-    return ((double)(yeas) / (double)(yeas + nays));
+    return ((double)(nAllYeas) / (double)(nAllYeas + nAllNays));
 }
 
 int CBudgetProposal::GetYeas()
 {
-    int ret = 0;
-
-    std::map<uint256, CBudgetVote>::iterator it = mapVotes.begin();
-    while (it != mapVotes.end()) {
-        if ((*it).second.nVote == VOTE_YES && (*it).second.fValid) ret++;
-        ++it;
-    }
-
-    return ret;
+    return nYeas;
 }
 
 int CBudgetProposal::GetNays()
 {
-    int ret = 0;
-
-    std::map<uint256, CBudgetVote>::iterator it = mapVotes.begin();
-    while (it != mapVotes.end()) {
-        if ((*it).second.nVote == VOTE_NO && (*it).second.fValid) ret++;
-        ++it;
-    }
-
-    return ret;
+    return nNays;
 }
 
 int CBudgetProposal::GetAbstains()
 {
-    int ret = 0;
-
-    std::map<uint256, CBudgetVote>::iterator it = mapVotes.begin();
-    while (it != mapVotes.end()) {
-        if ((*it).second.nVote == VOTE_ABSTAIN && (*it).second.fValid) ret++;
-        ++it;
-    }
-
-    return ret;
+    return nAbstains;
 }
 
 int CBudgetProposal::GetBlockStartCycle()
@@ -1684,6 +1780,11 @@ void CBudgetVote::Relay()
     RelayInv(inv);
 }
 
+std::string CBudgetVote::GetSignatureMessage() const
+{
+    return vin.prevout.ToStringShort() + nProposalHash.ToString() + boost::lexical_cast<std::string>(nVote) + boost::lexical_cast<std::string>(nTime);
+}
+
 bool CBudgetVote::Sign(CKey& keyServicenode, CPubKey& pubKeyServicenode)
 {
     // Choose coins to use
@@ -1691,7 +1792,7 @@ bool CBudgetVote::Sign(CKey& keyServicenode, CPubKey& pubKeyServicenode)
     CKey keyCollateralAddress;
 
     std::string errorMessage;
-    std::string strMessage = vin.prevout.ToStringShort() + nProposalHash.ToString() + boost::lexical_cast<std::string>(nVote) + boost::lexical_cast<std::string>(nTime);
+    std::string strMessage = GetSignatureMessage();
 
     if (!obfuScationSigner.SignMessage(strMessage, errorMessage, vchSig, keyServicenode)) {
         LogPrintf("CBudgetVote::Sign - Error upon calling SignMessage");
@@ -1709,7 +1810,7 @@ bool CBudgetVote::Sign(CKey& keyServicenode, CPubKey& pubKeyServicenode)
 bool CBudgetVote::SignatureValid(bool fSignatureCheck)
 {
     std::string errorMessage;
-    std::string strMessage = vin.prevout.ToStringShort() + nProposalHash.ToString() + boost::lexical_cast<std::string>(nVote) + boost::lexical_cast<std::string>(nTime);
+    std::string strMessage = GetSignatureMessage();
 
     CServicenode* pmn = mnodeman.Find(vin);
 
@@ -2120,6 +2221,11 @@ void CFinalizedBudgetVote::Relay()
     RelayInv(inv);
 }
 
+std::string CFinalizedBudgetVote::GetSignatureMessage() const
+{
+    return vin.prevout.ToStringShort() + nBudgetHash.ToString() + boost::lexical_cast<std::string>(nTime);
+}
+
 bool CFinalizedBudgetVote::Sign(CKey& keyServicenode, CPubKey& pubKeyServicenode)
 {
     // Choose coins to use
@@ -2127,7 +2233,7 @@ bool CFinalizedBudgetVote::Sign(CKey& keyServicenode, CPubKey& pubKeyServicenode
     CKey keyCollateralAddress;
 
     std::string errorMessage;
-    std::string strMessage = vin.prevout.ToStringShort() + nBudgetHash.ToString() + boost::lexical_cast<std::string>(nTime);
+    std::string strMessage = GetSignatureMessage();
 
     if (!obfuScationSigner.SignMessage(strMessage, errorMessage, vchSig, keyServicenode)) {
         LogPrintf("CFinalizedBudgetVote::Sign - Error upon calling SignMessage");
@@ -2146,7 +2252,7 @@ bool CFinalizedBudgetVote::SignatureValid(bool fSignatureCheck)
 {
     std::string errorMessage;
 
-    std::string strMessage = vin.prevout.ToStringShort() + nBudgetHash.ToString() + boost::lexical_cast<std::string>(nTime);
+    std::string strMessage = GetSignatureMessage();
 
     CServicenode* pmn = mnodeman.Find(vin);
 
@@ -12,6 +12,7 @@
 #include "main.h"
 #include "servicenode.h"
 #include "net.h"
+#include "recordfile.h"
 #include "sync.h"
 #include "util.h"
 #include <boost/lexical_cast.hpp>
@@ -39,6 +40,8 @@ extern std::vector<CFinalizedBudgetBroadcast> vecImmatureFinalizedBudgets;
 
 extern CBudgetManager budget;
 void DumpBudgets();
+/** Run an instance of the budget vote signature checking thread */
+void ThreadBudgetVoteCheck();
 
 // Define amount of blocks in budget payment cycle
 int GetBudgetPaymentCycleBlocks();
@@ -71,6 +74,7 @@ public:
 
     bool Sign(CKey& keyServicenode, CPubKey& pubKeyServicenode);
     bool SignatureValid(bool fSignatureCheck);
+    std::string GetSignatureMessage() const;
     void Relay();
 
     std::string GetVoteString()
@@ -123,6 +127,7 @@ public:
 
     bool Sign(CKey& keyServicenode, CPubKey& pubKeyServicenode);
     bool SignatureValid(bool fSignatureCheck);
+    std::string GetSignatureMessage() const;
     void Relay();
 
     uint256 GetHash()
@@ -146,14 +151,10 @@ public:
     }
 };
 
-/** Save Budget Manager (budget.dat)
+/** Save Budget Manager (budget.dat), a CRecordFile
  */
 class CBudgetDB
 {
-private:
-    boost::filesystem::path pathDB;
-    std::string strMagicMessage;
-
 public:
     enum ReadResult {
         Ok,
@@ -165,7 +166,6 @@ public:
         IncorrectFormat
     };
 
-    CBudgetDB();
     bool Write(const CBudgetManager& objToSave);
     ReadResult Read(CBudgetManager& objToLoad, bool fDryRun = false);
 };
@@ -182,6 +182,14 @@ private:
     map<uint256, uint256> mapCollateralTxids;
     bool allValidFinalPayees(std::vector<CTxBudgetPayment> &approvedPayees, int superblock);
 
+    //! Proposals ranked by votes for GetBudget, rebuilt when fRankingDirty
+    std::vector<std::pair<CBudgetProposal*, int> > vRankedProposals;
+    bool fRankingDirty;
+    //! When the votes of all proposals were last checked against the servicenode list
+    int64_t nTimeVotesChecked;
+
+    void CheckProposalVotes();
+
 public:
     // critical section to protect the inner data structures
     mutable CCriticalSection cs;
@@ -201,6 +209,8 @@ public:
     {
         mapProposals.clear();
         mapFinalizedBudgets.clear();
+        fRankingDirty = true;
+        nTimeVotesChecked = 0;
     }
 
     void ClearSeen()
@@ -211,6 +221,13 @@ public:
         mapSeenFinalizedBudgetVotes.clear();
     }
 
+    /// The state kept in budget.dat, one record per proposal, finalized budget or seen message
+    /// (every record is built on each dump, CRecordFile appends the ones that changed)
+    void GetRecords(CRecordFile::RecordMap& mapRecords) const;
+    /// Replace the state by the records read from budget.dat; all of them, the manager
+    /// holds its whole state in memory and has nothing it could load on demand
+    void LoadRecords(const CRecordFile::RecordMap& mapRecords);
+
     int sizeFinalized() { return (int)mapFinalizedBudgets.size(); }
     int sizeProposals() { return (int)mapProposals.size(); }
 
@@ -219,6 +236,8 @@ public:
     void Sync(CNode* node, uint256 nProp, bool fPartial = false);
 
     void ProcessMessage(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
+    /// Verify the signatures of the votes among a batch of messages in parallel, so that processing them hits the signature cache
+    void PreverifyVotes(const std::deque<CNetMessage>& vMsgs);
     void NewBlock();
     CBudgetProposal* FindProposal(const std::string& strProposalName);
     CBudgetProposal* FindProposal(uint256 nHash);
@@ -256,6 +275,7 @@ public:
         mapSeenFinalizedBudgetVotes.clear();
         mapOrphanServicenodeBudgetVotes.clear();
         mapOrphanFinalizedBudgetVotes.clear();
+        fRankingDirty = true;
     }
     void CheckAndRemove();
     std::string ToString() const;
@@ -275,6 +295,8 @@ public:
 
         READWRITE(mapProposals);
         READWRITE(mapFinalizedBudgets);
+        if (ser_action.ForRead())
+            fRankingDirty = true;
     }
 };
 
@@ -444,6 +466,18 @@ private:
     mutable CCriticalSection cs;
     CAmount nAlloted;
 
+protected:
+    //! Tallies of the valid votes in mapVotes, kept up to date by AddOrUpdateVote and CleanAndRemove
+    int nYeas;
+    int nNays;
+    int nAbstains;
+    //! Yes and no votes including invalid ones, for GetRatio
+    int nAllYeas;
+    int nAllNays;
+
+    void CountVote(const CBudgetVote& vote, int nCount);
+    void UpdateTallies();
+
 public:
     bool fValid;
     std::string strProposalName;
@@ -537,6 +571,8 @@ public:
 
         //for saving to the serialized db
         READWRITE(mapVotes);
+        if (ser_action.ForRead())
+            UpdateTallies();
     }
 };
 
@@ -565,6 +601,11 @@ public:
         swap(first.nTime, second.nTime);
         swap(first.nFeeTXHash, second.nFeeTXHash);
         first.mapVotes.swap(second.mapVotes);
+        swap(first.nYeas, second.nYeas);
+        swap(first.nNays, second.nNays);
+        swap(first.nAbstains, second.nAbstains);
+        swap(first.nAllYeas, second.nAllYeas);
+        swap(first.nAllNays, second.nAllNays);
     }
 
     CBudgetProposalBroadcast& operator=(CBudgetProposalBroadcast from)
@@ -22,6 +22,7 @@ CServicenodePayments servicenodePayments;
 
 CCriticalSection cs_vecPayments;
 CCriticalSection cs_mapServicenodeBlocks;
+CCriticalSection cs_setEligibleSnodes;
 CCriticalSection cs_mapServicenodePayeeVotes;
 
 //
@@ -440,42 +441,85 @@ bool CServicenodePaymentWinner::Sign(CKey& keyServicenode, CPubKey& pubKeyServic
 
 bool CServicenodePayments::GetBlockPayee(int nBlockHeight, CScript& payee)
 {
-    if (mapServicenodeBlocks.count(nBlockHeight)) {
-        return mapServicenodeBlocks[nBlockHeight].GetPayee(payee);
+    LOCK(cs_mapServicenodeBlocks);
+
+    std::map<int, CServicenodeBlockPayees>::iterator it = mapServicenodeBlocks.find(nBlockHeight);
+    if (it != mapServicenodeBlocks.end()) {
+        return it->second.GetPayee(payee);
     }
 
     return false;
 }
 
-// Is this servicenode scheduled to get paid soon?
+// Who is scheduled to get paid soon?
 // -- Only look ahead up to 8 blocks to allow for propagation of the latest 2 winners
-bool CServicenodePayments::IsScheduled(CServicenode& mn, int nNotBlockHeight)
+void CServicenodePayments::GetScheduledPayees(int nNotBlockHeight, std::set<CScript>& setPayees)
 {
+    setPayees.clear();
+
     LOCK(cs_mapServicenodeBlocks);
 
     int nHeight;
     {
         TRY_LOCK(cs_main, locked);
-        if (!locked || chainActive.Tip() == NULL) return false;
+        if (!locked || chainActive.Tip() == NULL) return;
         nHeight = chainActive.Tip()->nHeight;
     }
 
-    CScript mnpayee;
-    mnpayee = GetScriptForDestination(mn.pubKeyCollateralAddress.GetID());
-
     CScript payee;
     for (int64_t h = nHeight; h <= nHeight + 8; h++) {
         if (h == nNotBlockHeight) continue;
-        if (mapServicenodeBlocks.count(h)) {
-            if (mapServicenodeBlocks[h].GetPayee(payee)) {
-                if (mnpayee == payee) {
-                    return true;
-                }
-            }
-        }
+        std::map<int, CServicenodeBlockPayees>::iterator it = mapServicenodeBlocks.find(h);
+        if (it != mapServicenodeBlocks.end() && it->second.GetPayee(payee))
+            setPayees.insert(payee);
     }
+}
 
-    return false;
+// Is this servicenode scheduled to get paid soon?
+bool CServicenodePayments::IsScheduled(CServicenode& mn, int nNotBlockHeight)
+{
+    std::set<CScript> setPayees;
+    GetScheduledPayees(nNotBlockHeight, setPayees);
+
+    return setPayees.count(GetScriptForDestination(mn.pubKeyCollateralAddress.GetID())) > 0;
+}
+
+int CServicenodePayments::GetLastPaidHeight(const CScript& payee, int nMaxHeight)
+{
+    LOCK(cs_mapServicenodeBlocks);
+
+    std::map<CScript, std::set<int> >::const_iterator it = mapPayeeHeights.find(payee);
+    if (it == mapPayeeHeights.end())
+        return 0;
+
+    std::set<int>::const_iterator hi = it->second.upper_bound(nMaxHeight);
+    if (hi == it->second.begin())
+        return 0;
+
+    return *(--hi);
+}
+
+void CServicenodePayments::IndexBlockPayees(const CServicenodeBlockPayees& blockPayees)
+{
+    LOCK(cs_vecPayments);
+
+    BOOST_FOREACH (const CServicenodePayee& payee, blockPayees.vecPayments) {
+        if (payee.nVotes >= MNPAYMENTS_PAID_VOTES)
+            mapPayeeHeights[payee.scriptPubKey].insert(blockPayees.nBlockHeight);
+    }
+}
+
+void CServicenodePayments::UnindexBlockPayees(const CServicenodeBlockPayees& blockPayees)
+{
+    LOCK(cs_vecPayments);
+
+    BOOST_FOREACH (const CServicenodePayee& payee, blockPayees.vecPayments) {
+        std::map<CScript, std::set<int> >::iterator it = mapPayeeHeights.find(payee.scriptPubKey);
+        if (it == mapPayeeHeights.end()) continue;
+        it->second.erase(blockPayees.nBlockHeight);
+        if (it->second.empty())
+            mapPayeeHeights.erase(it);
+    }
 }
 
 bool CServicenodePayments::AddWinningServicenode(CServicenodePaymentWinner& winnerIn)
@@ -498,9 +542,10 @@ bool CServicenodePayments::AddWinningServicenode(CServicenodePaymentWinner& winn
             CServicenodeBlockPayees blockPayees(winnerIn.nBlockHeight);
             mapServicenodeBlocks[winnerIn.nBlockHeight] = blockPayees;
         }
-    }
 
-    mapServicenodeBlocks[winnerIn.nBlockHeight].AddPayee(winnerIn.payee, 1);
+        if (mapServicenodeBlocks[winnerIn.nBlockHeight].AddPayee(winnerIn.payee, 1) == MNPAYMENTS_PAID_VOTES)
+            mapPayeeHeights[winnerIn.payee].insert(winnerIn.nBlockHeight);
+    }
 
     return true;
 }
@@ -520,9 +565,8 @@ bool CServicenodeBlockPayees::IsTransactionValid(const CTransaction& txNew)
     CAmount requiredServicenodePayment = GetServicenodePayment(nBlockHeight, nReward);
 
     //require at least 6 signatures
-    BOOST_FOREACH (CServicenodePayee& payee, vecPayments)
-        if (payee.nVotes >= nMaxSignatures && payee.nVotes >= MNPAYMENTS_SIGNATURES_REQUIRED)
-            nMaxSignatures = payee.nVotes;
+    if (nBestPayee >= 0 && vecPayments[nBestPayee].nVotes >= MNPAYMENTS_SIGNATURES_REQUIRED)
+        nMaxSignatures = vecPayments[nBestPayee].nVotes;
 
     // if we don't have at least 6 signatures on a payee, approve whichever is the longest chain
     if (nMaxSignatures < MNPAYMENTS_SIGNATURES_REQUIRED) return true;
@@ -592,10 +636,33 @@ std::string CServicenodePayments::GetRequiredPaymentsString(int nBlockHeight)
 bool CServicenodePayments::IsTransactionValid(const CTransaction& txNew, int nBlockHeight)
 {
     if (IsSporkActive(SPORK_21_SNODE_PAYMENT)) { // enforce snode payments
-        std::set<std::string> eligibleSnodes;
-        auto snodes = mnodeman.GetFullServicenodeVector();
-        EligibleServicenodes(true, nBlockHeight, snodes, eligibleSnodes); // find all eligible snodes
+        // Eligibility depends on the input ages at the tip and on the size of
+        // the list, blocks validated against the same tip and list share one
+        // pass over it
+        uint256 hashTip;
+        {
+            LOCK(cs_main);
+            if (chainActive.Tip() != NULL)
+                hashTip = chainActive.Tip()->GetBlockHash();
+        }
+        int nSnodes = mnodeman.size();
+        bool fStale;
+        {
+            LOCK(cs_setEligibleSnodes);
+            fStale = hashTip != hashEligibleSnodesTip || nSnodes != nEligibleSnodesCount;
+        }
+        if (fStale) {
+            std::set<std::string> eligibleSnodes;
+            auto snodes = mnodeman.GetFullServicenodeVector();
+            EligibleServicenodes(true, nBlockHeight, snodes, eligibleSnodes); // find all eligible snodes
+
+            LOCK(cs_setEligibleSnodes);
+            setEligibleSnodes.swap(eligibleSnodes);
+            hashEligibleSnodesTip = hashTip;
+            nEligibleSnodesCount = nSnodes;
+        }
 
+        LOCK(cs_setEligibleSnodes);
         CAmount nReward = GetBlockValue(nBlockHeight);
         CAmount requiredServicenodePayment = GetServicenodePayment(nBlockHeight, nReward);
         for (const auto & out : txNew.vout) {
@@ -603,7 +670,7 @@ bool CServicenodePayments::IsTransactionValid(const CTransaction& txNew, int nBl
             if (!ExtractDestination(out.scriptPubKey, txAddr))
                 continue;
             const auto & addr = CBitcoinAddress(txAddr).ToString();
-            if (eligibleSnodes.count(addr) && out.nValue >= requiredServicenodePayment)
+            if (setEligibleSnodes.count(addr) && out.nValue >= requiredServicenodePayment)
                 return true;
         }
 
@@ -612,8 +679,9 @@ bool CServicenodePayments::IsTransactionValid(const CTransaction& txNew, int nBl
 
     LOCK(cs_mapServicenodeBlocks);
 
-    if (mapServicenodeBlocks.count(nBlockHeight)) {
-        return mapServicenodeBlocks[nBlockHeight].IsTransactionValid(txNew);
+    std::map<int, CServicenodeBlockPayees>::iterator it = mapServicenodeBlocks.find(nBlockHeight);
+    if (it != mapServicenodeBlocks.end()) {
+        return it->second.IsTransactionValid(txNew);
     }
 
     return true;
@@ -686,7 +754,11 @@ void CServicenodePayments::CleanPaymentList()
             LogPrint("mnpayments", "CServicenodePayments::CleanPaymentList - Removing old Servicenode payment - block %d\n", winner.nBlockHeight);
             servicenodeSync.mapSeenSyncMNW.erase((*it).first);
             mapServicenodePayeeVotes.erase(it++);
-            mapServicenodeBlocks.erase(winner.nBlockHeight);
+            std::map<int, CServicenodeBlockPayees>::iterator mi = mapServicenodeBlocks.find(winner.nBlockHeight);
+            if (mi != mapServicenodeBlocks.end()) {
+                UnindexBlockPayees(mi->second);
+                mapServicenodeBlocks.erase(mi);
+            }
         } else {
             ++it;
         }
@@ -15,6 +15,7 @@ using namespace std;
 
 extern CCriticalSection cs_vecPayments;
 extern CCriticalSection cs_mapServicenodeBlocks;
+extern CCriticalSection cs_setEligibleSnodes;
 extern CCriticalSection cs_mapServicenodePayeeVotes;
 
 class CServicenodePayments;
@@ -26,6 +27,8 @@ extern CServicenodePayments servicenodePayments;
 #define MNPAYMENTS_SIGNATURES_REQUIRED 6
 #define MNPAYMENTS_SIGNATURES_TOTAL 10
 #define MNPAYMENTS_SIGNATURES_TOTAL2 25
+// votes a payee needs for a block to count as its last payment
+#define MNPAYMENTS_PAID_VOTES 2
 
 void ProcessMessageServicenodePayments(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
 bool IsBlockPayeeValid(const CBlock& block, int nBlockHeight);
@@ -90,6 +93,17 @@ public:
 // Keep track of votes for payees from servicenodes
 class CServicenodeBlockPayees
 {
+private:
+    //! Position in vecPayments of the payee with the most votes (the first one on a tie), -1 if none
+    int nBestPayee;
+
+    void UpdateBestPayee(int i)
+    {
+        if (nBestPayee < 0 || vecPayments[i].nVotes > vecPayments[nBestPayee].nVotes ||
+            (vecPayments[i].nVotes == vecPayments[nBestPayee].nVotes && i < nBestPayee))
+            nBestPayee = i;
+    }
+
 public:
     int nBlockHeight;
     std::vector<CServicenodePayee> vecPayments;
@@ -97,42 +111,44 @@ public:
     CServicenodeBlockPayees()
     {
         nBlockHeight = 0;
+        nBestPayee = -1;
         vecPayments.clear();
     }
     CServicenodeBlockPayees(int nBlockHeightIn)
     {
         nBlockHeight = nBlockHeightIn;
+        nBestPayee = -1;
         vecPayments.clear();
     }
 
-    void AddPayee(CScript payeeIn, int nIncrement)
+    /** Add votes for a payee, returns the payee's votes; votes are never taken back */
+    int AddPayee(CScript payeeIn, int nIncrement)
     {
         LOCK(cs_vecPayments);
 
-        BOOST_FOREACH (CServicenodePayee& payee, vecPayments) {
-            if (payee.scriptPubKey == payeeIn) {
-                payee.nVotes += nIncrement;
-                return;
+        for (int i = 0; i < (int)vecPayments.size(); i++) {
+            if (vecPayments[i].scriptPubKey == payeeIn) {
+                vecPayments[i].nVotes += nIncrement;
+                UpdateBestPayee(i);
+                return vecPayments[i].nVotes;
             }
         }
 
         CServicenodePayee c(payeeIn, nIncrement);
         vecPayments.push_back(c);
+        UpdateBestPayee(vecPayments.size() - 1);
+        return nIncrement;
     }
 
     bool GetPayee(CScript& payee)
     {
         LOCK(cs_vecPayments);
 
-        int nVotes = -1;
-        BOOST_FOREACH (CServicenodePayee& p, vecPayments) {
-            if (p.nVotes > nVotes) {
-                payee = p.scriptPubKey;
-                nVotes = p.nVotes;
-            }
-        }
+        if (nBestPayee < 0)
+            return false;
 
-        return (nVotes > -1);
+        payee = vecPayments[nBestPayee].scriptPubKey;
+        return true;
     }
 
     bool HasPayeeWithVotes(CScript payee, int nVotesReq)
@@ -156,6 +172,11 @@ public:
     {
         READWRITE(nBlockHeight);
         READWRITE(vecPayments);
+        if (ser_action.ForRead()) {
+            nBestPayee = -1;
+            for (int i = 0; i < (int)vecPayments.size(); i++)
+                UpdateBestPayee(i);
+        }
     }
 };
 
@@ -237,6 +258,18 @@ private:
     int nSyncedFromPeer;
     int nLastBlockHeight;
 
+    //! Heights of the blocks each payee has at least MNPAYMENTS_PAID_VOTES votes for, guarded by cs_mapServicenodeBlocks
+    std::map<CScript, std::set<int> > mapPayeeHeights;
+
+    //! Collateral addresses of the servicenodes eligible for payment, guarded by cs_setEligibleSnodes
+    std::set<std::string> setEligibleSnodes;
+    //! Tip and list size setEligibleSnodes was computed for
+    uint256 hashEligibleSnodesTip;
+    int nEligibleSnodesCount;
+
+    void IndexBlockPayees(const CServicenodeBlockPayees& blockPayees);
+    void UnindexBlockPayees(const CServicenodeBlockPayees& blockPayees);
+
 public:
     std::map<uint256, CServicenodePaymentWinner> mapServicenodePayeeVotes;
     std::map<int, CServicenodeBlockPayees> mapServicenodeBlocks;
@@ -246,6 +279,7 @@ public:
     {
         nSyncedFromPeer = 0;
         nLastBlockHeight = 0;
+        nEligibleSnodesCount = -1;
     }
 
     void Clear()
@@ -253,6 +287,7 @@ public:
         LOCK2(cs_mapServicenodeBlocks, cs_mapServicenodePayeeVotes);
         mapServicenodeBlocks.clear();
         mapServicenodePayeeVotes.clear();
+        mapPayeeHeights.clear();
     }
 
     bool AddWinningServicenode(CServicenodePaymentWinner& winner);
@@ -265,6 +300,9 @@ public:
     bool GetBlockPayee(int nBlockHeight, CScript& payee);
     bool IsTransactionValid(const CTransaction& txNew, int nBlockHeight);
     bool IsScheduled(CServicenode& mn, int nNotBlockHeight);
+    void GetScheduledPayees(int nNotBlockHeight, std::set<CScript>& setPayees);
+    /** Height of the latest block up to nMaxHeight paying payee, 0 if none is known */
+    int GetLastPaidHeight(const CScript& payee, int nMaxHeight);
 
     bool CanVote(COutPoint outServicenode, int nBlockHeight)
     {
@@ -300,6 +338,12 @@ public:
     {
         READWRITE(mapServicenodePayeeVotes);
         READWRITE(mapServicenodeBlocks);
+        if (ser_action.ForRead()) {
+            LOCK(cs_mapServicenodeBlocks);
+            mapPayeeHeights.clear();
+            for (std::map<int, CServicenodeBlockPayees>::const_iterator it = mapServicenodeBlocks.begin(); it != mapServicenodeBlocks.end(); ++it)
+                IndexBlockPayees(it->second);
+        }
     }
 };
 
@@ -199,6 +199,8 @@ void CServicenodeSync::ProcessMessage(CNode* /*pfrom*/, std::string& strCommand,
             if (nItemID != syncState) return;
             sumServicenodeList += nCount;
             countServicenodeList++;
+            // a peer that only sends what differs from our list may have nothing to send
+            lastServicenodeList = GetTime();
             break;
         case (SERVICENODE_SYNC_MNW):
             if (nItemID != syncState) return;
@@ -178,7 +178,6 @@ uint256 CServicenode::CalculateScore(int /*mod*/, int64_t nBlockHeight)
     if (chainActive.Tip() == NULL) return 0;
 
     uint256 hash = 0;
-    uint256 aux = vin.prevout.hash + vin.prevout.n;
 
     if (!GetBlockHash(hash, nBlockHeight)) {
         LogPrintf("CalculateScore ERROR - nHeight %d - Returned 0\n", nBlockHeight);
@@ -189,12 +188,19 @@ uint256 CServicenode::CalculateScore(int /*mod*/, int64_t nBlockHeight)
     ss << hash;
     uint256 hash2 = ss.GetHash();
 
+    return CalculateScore(hash, hash2);
+}
+
+uint256 CServicenode::CalculateScore(const uint256& hashBlock, const uint256& hashBlockHash) const
+{
+    uint256 aux = vin.prevout.hash + vin.prevout.n;
+
     CHashWriter ss2(SER_GETHASH, PROTOCOL_VERSION);
-    ss2 << hash;
+    ss2 << hashBlock;
     ss2 << aux;
     uint256 hash3 = ss2.GetHash();
 
-    uint256 r = (hash3 > hash2 ? hash3 - hash2 : hash2 - hash3);
+    uint256 r = (hash3 > hashBlockHash ? hash3 - hashBlockHash : hashBlockHash - hash3);
 
     return r;
 }
@@ -281,31 +287,16 @@ int64_t CServicenode::GetLastPaid()
     const CBlockIndex* BlockReading = chainActive.Tip();
 
     int nMnCount = mnodeman.CountEnabled() * 1.25;
-    int n = 0;
-    for (unsigned int i = 1; BlockReading && BlockReading->nHeight > 0; i++) {
-        if (n >= nMnCount) {
-            return 0;
-        }
-        n++;
 
-        if (servicenodePayments.mapServicenodeBlocks.count(BlockReading->nHeight)) {
-            /*
-                Search for this payee, with at least 2 votes. This will aid in consensus allowing the network
-                to converge on the same payees quickly, then keep the same schedule.
-            */
-            if (servicenodePayments.mapServicenodeBlocks[BlockReading->nHeight].HasPayeeWithVotes(mnpayee, 2)) {
-                return BlockReading->nTime + nOffset;
-            }
-        }
-
-        if (BlockReading->pprev == NULL) {
-            assert(BlockReading);
-            break;
-        }
-        BlockReading = BlockReading->pprev;
-    }
+    /*
+        Search for this payee, with at least 2 votes, in the last nMnCount blocks. This will aid in consensus
+        allowing the network to converge on the same payees quickly, then keep the same schedule.
+    */
+    int nHeight = servicenodePayments.GetLastPaidHeight(mnpayee, BlockReading->nHeight);
+    if (nHeight <= 0 || BlockReading->nHeight - nHeight >= nMnCount)
+        return 0;
 
-    return 0;
+    return chainActive[nHeight]->nTime + nOffset;
 }
 
 std::string CServicenode::GetStatus()
@@ -604,7 +595,7 @@ bool CServicenodeBroadcast::CheckAndUpdate(int& nDos)
     if (pmn->pubKeyCollateralAddress == pubKeyCollateralAddress && !pmn->IsBroadcastedWithin(SERVICENODE_MIN_MNB_SECONDS)) {
         //take the newest entry
         LogPrint("servicenode", "mnb - Got updated entry for %s\n", vin.prevout.hash.ToString());
-        if (pmn->UpdateFromNewBroadcast((*this))) {
+        if (mnodeman.UpdateFromNewBroadcast(*pmn, *this)) {
             pmn->Check();
             if (pmn->IsEnabled()) Relay();
         }
@@ -214,6 +214,8 @@ public:
     }
 
     uint256 CalculateScore(int mod = 1, int64_t nBlockHeight = 0);
+    /// Score against a block whose hash (hashBlock) and hash of the hash (hashBlockHash) are already known
+    uint256 CalculateScore(const uint256& hashBlock, const uint256& hashBlockHash) const;
 
     ADD_SERIALIZE_METHODS;
 
@@ -45,38 +45,20 @@ struct CompareScoreMN {
 // CServicenodeDB
 //
 
-CServicenodeDB::CServicenodeDB()
+static CRecordFile& GetServicenodeFile()
 {
-    pathMN = GetDataDir() / "mncache.dat";
-    strMagicMessage = "ServicenodeCache";
+    static CRecordFile file("mncache.dat", "ServicenodeCache");
+    return file;
 }
 
 bool CServicenodeDB::Write(const CServicenodeMan& mnodemanToSave)
 {
     int64_t nStart = GetTimeMillis();
 
-    // serialize, checksum data up to that point, then append checksum
-    CDataStream ssServicenodes(SER_DISK, CLIENT_VERSION);
-    ssServicenodes << strMagicMessage;                   // servicenode cache file specific magic message
-    ssServicenodes << FLATDATA(Params().MessageStart()); // network specific magic number
-    ssServicenodes << mnodemanToSave;
-    uint256 hash = Hash(ssServicenodes.begin(), ssServicenodes.end());
-    ssServicenodes << hash;
-
-    // open output file, and associate with CAutoFile
-    FILE* file = fopen(pathMN.string().c_str(), "wb");
-    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("%s : Failed to open file %s", __func__, pathMN.string());
-
-    // Write and commit header, data
-    try {
-        fileout << ssServicenodes;
-    } catch (std::exception& e) {
-        return error("%s : Serialize or I/O error - %s", __func__, e.what());
-    }
-    //    FileCommit(fileout);
-    fileout.fclose();
+    CRecordFile::RecordMap mapRecords;
+    mnodemanToSave.GetRecords(mapRecords);
+    if (!GetServicenodeFile().Write(mapRecords))
+        return false;
 
     LogPrintf("Written info to mncache.dat  %dms\n", GetTimeMillis() - nStart);
     LogPrintf("  %s\n", mnodemanToSave.ToString());
@@ -87,80 +69,31 @@ bool CServicenodeDB::Write(const CServicenodeMan& mnodemanToSave)
 CServicenodeDB::ReadResult CServicenodeDB::Read(CServicenodeMan& mnodemanToLoad, bool fDryRun)
 {
     int64_t nStart = GetTimeMillis();
-    // open input file, and associate with CAutoFile
-    FILE* file = fopen(pathMN.string().c_str(), "rb");
-    CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull()) {
-        error("%s : Failed to open file %s", __func__, pathMN.string());
-        return FileError;
-    }
-
-    // use file size to size memory buffer
-    int fileSize = boost::filesystem::file_size(pathMN);
-    int dataSize = fileSize - sizeof(uint256);
-    // Don't try to resize to a negative number if file is small
-    if (dataSize < 0)
-        dataSize = 0;
-    vector<unsigned char> vchData;
-    vchData.resize(dataSize);
-    uint256 hashIn;
-
-    // read data and checksum from file
-    try {
-        filein.read((char*)&vchData[0], dataSize);
-        filein >> hashIn;
-    } catch (std::exception& e) {
-        error("%s : Deserialize or I/O error - %s", __func__, e.what());
-        return HashReadError;
-    }
-    filein.fclose();
-
-    CDataStream ssServicenodes(vchData, SER_DISK, CLIENT_VERSION);
-
-    // verify stored checksum matches input data
-    uint256 hashTmp = Hash(ssServicenodes.begin(), ssServicenodes.end());
-    if (hashIn != hashTmp) {
-        error("%s : Checksum mismatch, data corrupted", __func__);
-        return IncorrectHash;
-    }
 
-    unsigned char pchMsgTmp[4];
-    std::string strMagicMessageTmp;
-    try {
-        // de-serialize file header (servicenode cache file specific magic message) and ..
-
-        ssServicenodes >> strMagicMessageTmp;
-
-        // ... verify the message matches predefined one
-        if (strMagicMessage != strMagicMessageTmp) {
-            error("%s : Invalid servicenode cache magic message", __func__);
-            return IncorrectMagicMessage;
-        }
-
-        // de-serialize file header (network specific magic number) and ..
-        ssServicenodes >> FLATDATA(pchMsgTmp);
-
-        // ... verify the network matches ours
-        if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp))) {
-            error("%s : Invalid network magic number", __func__);
-            return IncorrectMagicNumber;
-        }
-        // de-serialize data into CServicenodeMan object
-        ssServicenodes >> mnodemanToLoad;
-    } catch (std::exception& e) {
-        mnodemanToLoad.Clear();
-        error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    CRecordFile::RecordMap mapRecords;
+    switch (GetServicenodeFile().Read(mapRecords)) {
+    case CRecordFile::Ok:
+        break;
+    case CRecordFile::FileError:
+        return FileError;
+    case CRecordFile::IncorrectMagicMessage:
+        return IncorrectMagicMessage;
+    case CRecordFile::IncorrectMagicNumber:
+        return IncorrectMagicNumber;
+    case CRecordFile::IncorrectFormat:
         return IncorrectFormat;
     }
+    if (fDryRun)
+        return Ok;
+
+    mnodemanToLoad.LoadRecords(mapRecords);
 
     LogPrintf("Loaded info from mncache.dat  %dms\n", GetTimeMillis() - nStart);
     LogPrintf("  %s\n", mnodemanToLoad.ToString());
-    if (!fDryRun) {
-        LogPrintf("Servicenode manager - cleaning....\n");
-        mnodemanToLoad.CheckAndRemove(true);
-        LogPrintf("Servicenode manager - result:\n");
-        LogPrintf("  %s\n", mnodemanToLoad.ToString());
-    }
+    LogPrintf("Servicenode manager - cleaning....\n");
+    mnodemanToLoad.CheckAndRemove(true);
+    LogPrintf("Servicenode manager - result:\n");
+    LogPrintf("  %s\n", mnodemanToLoad.ToString());
 
     return Ok;
 }
@@ -169,23 +102,8 @@ void DumpServicenodes()
 {
     int64_t nStart = GetTimeMillis();
 
+    // Records of a file that isn't ours are left alone by CRecordFile
     CServicenodeDB mndb;
-    CServicenodeMan tempMnodeman;
-
-    LogPrintf("Verifying mncache.dat format...\n");
-    CServicenodeDB::ReadResult readResult = mndb.Read(tempMnodeman, true);
-    // there was an error and it was not an error on file opening => do not proceed
-    if (readResult == CServicenodeDB::FileError)
-        LogPrintf("Missing servicenode cache file - mncache.dat, will try to recreate\n");
-    else if (readResult != CServicenodeDB::Ok) {
-        LogPrintf("Error reading mncache.dat: ");
-        if (readResult == CServicenodeDB::IncorrectFormat)
-            LogPrintf("magic is ok but data has invalid format, will try to recreate\n");
-        else {
-            LogPrintf("file format is unknown or invalid, please fix it manually\n");
-            return;
-        }
-    }
     LogPrintf("Writting info to mncache.dat...\n");
     mndb.Write(mnodeman);
 
@@ -195,6 +113,7 @@ void DumpServicenodes()
 CServicenodeMan::CServicenodeMan()
 {
     nDsqCount = 0;
+    fIndexesDirty = false;
 }
 
 bool CServicenodeMan::Add(CServicenode& mn)
@@ -208,6 +127,8 @@ bool CServicenodeMan::Add(CServicenode& mn)
     if (pmn == NULL) {
         LogPrint("servicenode", "CServicenodeMan: Adding new Servicenode %s - %i now\n", mn.vin.prevout.hash.ToString(), size() + 1);
         vServicenodes.push_back(mn);
+        AddToIndexes(vServicenodes.size() - 1);
+        mapRanks.clear();
         return true;
     }
 
@@ -278,6 +199,8 @@ void CServicenodeMan::CheckAndRemove(bool forceExpiredRemoval)
             }
 
             it = vServicenodes.erase(it);
+            fIndexesDirty = true;
+            mapRanks.clear();
         } else {
             ++it;
         }
@@ -335,10 +258,82 @@ void CServicenodeMan::CheckAndRemove(bool forceExpiredRemoval)
     }
 }
 
+void CServicenodeMan::GetRecords(CRecordFile::RecordMap& mapRecords) const
+{
+    LOCK(cs);
+
+    BOOST_FOREACH (const CServicenode& mn, vServicenodes)
+        CRecordFile::Add(mapRecords, 'n', mn.vin.prevout, mn);
+    CRecordFile::AddMap(mapRecords, 'a', mAskedUsForServicenodeList);
+    CRecordFile::AddMap(mapRecords, 'w', mWeAskedForServicenodeList);
+    CRecordFile::AddMap(mapRecords, 'e', mWeAskedForServicenodeListEntry);
+    CRecordFile::AddMap(mapRecords, 'b', mapSeenServicenodeBroadcast);
+    CRecordFile::AddMap(mapRecords, 'p', mapSeenServicenodePing);
+    CRecordFile::Add(mapRecords, 'd', 0, nDsqCount);
+}
+
+void CServicenodeMan::LoadRecords(const CRecordFile::RecordMap& mapRecords)
+{
+    LOCK(cs);
+    Clear();
+
+    int nInvalid = 0;
+    for (CRecordFile::RecordMap::const_iterator it = mapRecords.begin(); it != mapRecords.end(); ++it) {
+        CDataStream ss(it->second, SER_DISK, CLIENT_VERSION);
+        try {
+            char chType;
+            ss >> chType;
+            switch (chType) {
+            case 'n': {
+                COutPoint outpoint;
+                CServicenode mn;
+                ss >> outpoint >> mn;
+                vServicenodes.push_back(mn);
+                break;
+            }
+            case 'a':
+                CRecordFile::ReadMapEntry(ss, mAskedUsForServicenodeList);
+                break;
+            case 'w':
+                CRecordFile::ReadMapEntry(ss, mWeAskedForServicenodeList);
+                break;
+            case 'e':
+                CRecordFile::ReadMapEntry(ss, mWeAskedForServicenodeListEntry);
+                break;
+            case 'b':
+                CRecordFile::ReadMapEntry(ss, mapSeenServicenodeBroadcast);
+                break;
+            case 'p':
+                CRecordFile::ReadMapEntry(ss, mapSeenServicenodePing);
+                break;
+            case 'd': {
+                int nId;
+                ss >> nId >> nDsqCount;
+                break;
+            }
+            default:
+                nInvalid++;
+            }
+        } catch (const std::exception&) {
+            nInvalid++;
+        }
+    }
+    if (nInvalid)
+        LogPrintf("CServicenodeMan::LoadRecords - skipped %d invalid records\n", nInvalid);
+
+    fIndexesDirty = true;
+}
+
 void CServicenodeMan::Clear()
 {
     LOCK(cs);
     vServicenodes.clear();
+    mapIndexByOutpoint.clear();
+    mapIndexByPubKey.clear();
+    mapIndexByPayee.clear();
+    mapIndexByAddr.clear();
+    fIndexesDirty = false;
+    mapRanks.clear();
     mAskedUsForServicenodeList.clear();
     mWeAskedForServicenodeList.clear();
     mWeAskedForServicenodeListEntry.clear();
@@ -377,56 +372,129 @@ void CServicenodeMan::DsegUpdate(CNode* pnode)
         }
     }
 
-    pnode->PushMessage("dseg", CTxIn());
+    // Peers that know the digests skip the buckets of the list we already have,
+    // older ones ignore them and send everything
+    if (vServicenodes.empty())
+        pnode->PushMessage("dseg", CTxIn());
+    else
+        pnode->PushMessage("dseg", CTxIn(), GetListDigests());
     int64_t askAgain = GetTime() + SERVICENODES_DSEG_SECONDS;
     mWeAskedForServicenodeList[pnode->addr] = askAgain;
 }
 
-CServicenode* CServicenodeMan::Find(const CScript& payee)
+// The buckets are small enough that one that differs costs a few entries, and
+// the digests of all of them are small compared to an inventory of the list
+static unsigned int GetListBucket(const uint256& hashMNB)
+{
+    return hashMNB.Get64(0) % SERVICENODES_DSEG_BUCKETS;
+}
+
+std::vector<uint64_t> CServicenodeMan::GetListDigests()
 {
     LOCK(cs);
-    CScript payee2;
 
+    std::vector<uint64_t> vDigests(SERVICENODES_DSEG_BUCKETS, 0);
     BOOST_FOREACH (CServicenode& mn, vServicenodes) {
-        payee2 = GetScriptForDestination(mn.pubKeyCollateralAddress.GetID());
-        if (payee2 == payee)
-            return &mn;
+        if (mn.addr.IsRFC1918() || !mn.IsEnabled()) continue;
+
+        uint256 hash = CServicenodeBroadcast(mn).GetHash();
+        vDigests[GetListBucket(hash)] ^= hash.Get64(1);
     }
-    return NULL;
+    return vDigests;
+}
+
+void CServicenodeMan::AddToIndexes(size_t nPos)
+{
+    if (fIndexesDirty) return;
+
+    const CServicenode& mn = vServicenodes[nPos];
+    mapIndexByOutpoint.insert(make_pair(mn.vin.prevout, nPos));
+    mapIndexByPubKey.insert(make_pair(mn.pubKeyServicenode, nPos));
+    mapIndexByPayee.insert(make_pair(GetScriptForDestination(mn.pubKeyCollateralAddress.GetID()), nPos));
+    mapIndexByAddr.insert(make_pair(mn.addr.ToString(), nPos));
+}
+
+void CServicenodeMan::RebuildIndexes()
+{
+    mapIndexByOutpoint.clear();
+    mapIndexByPubKey.clear();
+    mapIndexByPayee.clear();
+    mapIndexByAddr.clear();
+    fIndexesDirty = false;
+
+    for (size_t i = 0; i < vServicenodes.size(); i++)
+        AddToIndexes(i);
+}
+
+void CServicenodeMan::Reindex()
+{
+    LOCK(cs);
+    fIndexesDirty = true;
+    mapRanks.clear();
+}
+
+bool CServicenodeMan::UpdateFromNewBroadcast(CServicenode& mn, CServicenodeBroadcast& mnb)
+{
+    LOCK(cs);
+    if (!mn.UpdateFromNewBroadcast(mnb))
+        return false;
+    Reindex();
+    return true;
+}
+
+CServicenode* CServicenodeMan::Find(const CScript& payee)
+{
+    LOCK(cs);
+    if (fIndexesDirty) RebuildIndexes();
+
+    std::map<CScript, size_t>::const_iterator it = mapIndexByPayee.find(payee);
+    if (it == mapIndexByPayee.end())
+        return NULL;
+    return &vServicenodes[it->second];
 }
 
 CServicenode* CServicenodeMan::Find(const CTxIn& vin)
 {
     LOCK(cs);
+    if (fIndexesDirty) RebuildIndexes();
 
-    BOOST_FOREACH (CServicenode& mn, vServicenodes) {
-        if (mn.vin.prevout == vin.prevout)
-            return &mn;
-    }
-    return NULL;
+    std::map<COutPoint, size_t>::const_iterator it = mapIndexByOutpoint.find(vin.prevout);
+    if (it == mapIndexByOutpoint.end())
+        return NULL;
+    return &vServicenodes[it->second];
+}
+
+bool CServicenodeMan::GetServicenodePubKey(const CTxIn& vin, CPubKey& pubKeyServicenode)
+{
+    LOCK(cs);
+    CServicenode* pmn = Find(vin);
+    if (pmn == NULL)
+        return false;
+    pubKeyServicenode = pmn->pubKeyServicenode;
+    return true;
 }
 
 
 CServicenode* CServicenodeMan::Find(const CPubKey& pubKeyServicenode)
 {
     LOCK(cs);
+    if (fIndexesDirty) RebuildIndexes();
 
-    BOOST_FOREACH (CServicenode& mn, vServicenodes) {
-        if (mn.pubKeyServicenode == pubKeyServicenode)
-            return &mn;
-    }
-    return NULL;
+    std::map<CPubKey, size_t>::const_iterator it = mapIndexByPubKey.find(pubKeyServicenode);
+    if (it == mapIndexByPubKey.end())
+        return NULL;
+    return &vServicenodes[it->second];
 }
 
 CServicenode* CServicenodeMan::Find(const std::string & nodeAddr)
 {
     LOCK(cs);
+    if (fIndexesDirty) RebuildIndexes();
 
-    for (CServicenode & mn : vServicenodes) {
-        if (mn.addr.ToString() == nodeAddr)
-            return &mn;
-    }
-    return nullptr;
+    auto it = mapIndexByAddr.find(nodeAddr);
+    if (it == mapIndexByAddr.end())
+        return nullptr;
+    return &vServicenodes[it->second];
 }
 
 //
@@ -444,12 +512,14 @@ CServicenode* CServicenodeMan::GetNextServicenodeInQueueForPayment(int nBlockHei
     */
 
     int nMnCount = CountEnabled();
+    std::set<CScript> setScheduled;
+    servicenodePayments.GetScheduledPayees(nBlockHeight, setScheduled);
     BOOST_FOREACH (CServicenode& mn, vServicenodes) {
         if (!servicenodePayments.ValidNode(mn, fFilterSigTime, nMnCount))
             continue;
 
         //it's in the list (up to 8 entries ahead of current block to allow propagation) -- so let's skip it
-        if (servicenodePayments.IsScheduled(mn, nBlockHeight)) continue;
+        if (setScheduled.count(GetScriptForDestination(mn.pubKeyCollateralAddress.GetID()))) continue;
 
         vecServicenodeLastPaid.push_back(make_pair(mn.SecondsSincePayment(), mn.vin));
     }
@@ -469,11 +539,19 @@ CServicenode* CServicenodeMan::GetNextServicenodeInQueueForPayment(int nBlockHei
     int nTenthNetwork = CountEnabled() / 10;
     int nCountTenth = 0;
     uint256 nHigh = 0;
+    uint256 hashBlock = 0;
+    if (!GetBlockHash(hashBlock, nBlockHeight - 100)) {
+        LogPrintf("CalculateScore ERROR - nHeight %d - Returned 0\n", nBlockHeight - 100);
+        return NULL;
+    }
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << hashBlock;
+    uint256 hashBlockHash = ss.GetHash();
     BOOST_FOREACH (PAIRTYPE(int64_t, CTxIn) & s, vecServicenodeLastPaid) {
         CServicenode* pmn = Find(s.second);
         if (!pmn) break;
 
-        uint256 n = pmn->CalculateScore(1, nBlockHeight - 100);
+        uint256 n = pmn->CalculateScore(hashBlock, hashBlockHash);
         if (n > nHigh) {
             nHigh = n;
             pBestServicenode = pmn;
@@ -540,37 +618,54 @@ CServicenode* CServicenodeMan::GetCurrentServiceNode(int mod, int64_t nBlockHeig
     return winner;
 }
 
-int CServicenodeMan::GetServicenodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
+const CServicenodeMan::CServicenodeRanks* CServicenodeMan::GetRanks(int64_t nBlockHeight, int minProtocol, RankFilter filter)
 {
-    std::vector<pair<int64_t, CTxIn> > vecServicenodeScores;
+    LOCK(cs);
 
     //make sure we know about this block
     uint256 hash = 0;
-    if (!GetBlockHash(hash, nBlockHeight)) return -1;
+    if (!GetBlockHash(hash, nBlockHeight)) return NULL;
+
+    // Servicenode states change with time, so a ranking is only reused for as long as
+    // the servicenodes themselves skip rechecking it
+    RanksKey key = make_pair(nBlockHeight, make_pair(minProtocol, (int)filter));
+    std::map<RanksKey, CServicenodeRanks>::iterator it = mapRanks.find(key);
+    if (it != mapRanks.end() && it->second.hashBlock == hash &&
+        GetTime() - it->second.nTimeCreated < SERVICENODE_CHECK_SECONDS)
+        return &it->second;
+
+    // the block part of the score is the same for every servicenode
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << hash;
+    uint256 hash2 = ss.GetHash();
+
+    std::vector<pair<int64_t, CTxIn> > vecServicenodeScores;
+    vecServicenodeScores.reserve(vServicenodes.size());
 
-    // scan for winner
     BOOST_FOREACH (CServicenode& mn, vServicenodes) {
         if (mn.protocolVersion < minProtocol) {
             if (fDebug)
                 LogPrintf("Skipping Servicenode %s with obsolete version: %d)\n", mn.vin.prevout.hash.ToString(), mn.protocolVersion);
             continue;
         }
-        if (fOnlyActive) {
+        if (filter != RANKS_ALL) {
             mn.Check();
 
-            if (mn.GetServicenodeInputAge() < vServicenodes.size())
-                continue;
+            if (filter == RANKS_ACTIVE) {
+                if (mn.GetServicenodeInputAge() < vServicenodes.size())
+                    continue;
 
-            auto snodeAge = GetAdjustedTime() - mn.sigTime;
-            if (snodeAge < SERVICENODE_DELAY_SECONDS) {
-                if (fDebug)
-                    LogPrintf("Skipping recently activated Servicenode %s with age: %ld\n", mn.vin.prevout.hash.ToString(), snodeAge);
-                continue;
+                auto snodeAge = GetAdjustedTime() - mn.sigTime;
+                if (snodeAge < SERVICENODE_DELAY_SECONDS) {
+                    if (fDebug)
+                        LogPrintf("Skipping recently activated Servicenode %s with age: %ld\n", mn.vin.prevout.hash.ToString(), snodeAge);
+                    continue;
+                }
             }
 
             if (!mn.IsEnabled()) continue;
         }
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
+        uint256 n = mn.CalculateScore(hash, hash2);
         int64_t n2 = n.GetCompact(false);
 
         vecServicenodeScores.push_back(make_pair(n2, mn.vin));
@@ -578,15 +673,35 @@ int CServicenodeMan::GetServicenodeRank(const CTxIn& vin, int64_t nBlockHeight,
 
     sort(vecServicenodeScores.rbegin(), vecServicenodeScores.rend(), CompareScoreTxIn());
 
-    int rank = 0;
+    // keep the rankings of the most recent blocks
+    if (it == mapRanks.end() && mapRanks.size() >= SERVICENODES_RANKS_CACHE_SIZE)
+        mapRanks.erase(mapRanks.begin());
+
+    CServicenodeRanks& ranks = mapRanks[key];
+    ranks.hashBlock = hash;
+    ranks.nTimeCreated = GetTime();
+    ranks.vRanked.clear();
+    ranks.mapRank.clear();
+    ranks.vRanked.reserve(vecServicenodeScores.size());
     BOOST_FOREACH (PAIRTYPE(int64_t, CTxIn) & s, vecServicenodeScores) {
-        rank++;
-        if (s.second.prevout == vin.prevout) {
-            return rank;
-        }
+        ranks.vRanked.push_back(s.second);
+        ranks.mapRank[s.second.prevout] = ranks.vRanked.size();
     }
 
-    return -1;
+    return &ranks;
+}
+
+int CServicenodeMan::GetServicenodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
+{
+    LOCK(cs);
+
+    const CServicenodeRanks* ranks = GetRanks(nBlockHeight, minProtocol, fOnlyActive ? RANKS_ACTIVE : RANKS_ALL);
+    if (ranks == NULL) return -1;
+
+    std::map<COutPoint, int>::const_iterator it = ranks->mapRank.find(vin.prevout);
+    if (it == ranks->mapRank.end()) return -1;
+
+    return it->second;
 }
 
 std::vector<pair<int, CServicenode> > CServicenodeMan::GetServicenodeRanks(int64_t nBlockHeight, int minProtocol)
@@ -594,10 +709,16 @@ std::vector<pair<int, CServicenode> > CServicenodeMan::GetServicenodeRanks(int64
     std::vector<pair<int64_t, CServicenode> > vecServicenodeScores;
     std::vector<pair<int, CServicenode> > vecServicenodeRanks;
 
+    LOCK(cs);
+
     //make sure we know about this block
     uint256 hash = 0;
     if (!GetBlockHash(hash, nBlockHeight)) return vecServicenodeRanks;
 
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << hash;
+    uint256 hash2 = ss.GetHash();
+
     // scan for winner
     BOOST_FOREACH (CServicenode& mn, vServicenodes) {
         mn.Check();
@@ -609,7 +730,7 @@ std::vector<pair<int, CServicenode> > CServicenodeMan::GetServicenodeRanks(int64
             continue;
         }
 
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
+        uint256 n = mn.CalculateScore(hash, hash2);
         int64_t n2 = n.GetCompact(false);
 
         vecServicenodeScores.push_back(make_pair(n2, mn));
@@ -628,33 +749,12 @@ std::vector<pair<int, CServicenode> > CServicenodeMan::GetServicenodeRanks(int64
 
 CServicenode* CServicenodeMan::GetServicenodeByRank(int nRank, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
 {
-    std::vector<pair<int64_t, CTxIn> > vecServicenodeScores;
-
-    // scan for winner
-    BOOST_FOREACH (CServicenode& mn, vServicenodes) {
-        if (mn.protocolVersion < minProtocol) continue;
-        if (fOnlyActive) {
-            mn.Check();
-            if (!mn.IsEnabled()) continue;
-        }
-
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
-
-        vecServicenodeScores.push_back(make_pair(n2, mn.vin));
-    }
+    LOCK(cs);
 
-    sort(vecServicenodeScores.rbegin(), vecServicenodeScores.rend(), CompareScoreTxIn());
+    const CServicenodeRanks* ranks = GetRanks(nBlockHeight, minProtocol, fOnlyActive ? RANKS_ENABLED : RANKS_ALL);
+    if (ranks == NULL || nRank < 1 || nRank > (int)ranks->vRanked.size()) return NULL;
 
-    int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CTxIn) & s, vecServicenodeScores) {
-        rank++;
-        if (rank == nRank) {
-            return Find(s.second);
-        }
-    }
-
-    return NULL;
+    return Find(ranks->vRanked[nRank - 1]);
 }
 
 void CServicenodeMan::ProcessServicenodeConnections()
@@ -752,6 +852,14 @@ void CServicenodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CDat
         CTxIn vin;
         vRecv >> vin;
 
+        // Digests of the list the peer has already, see DsegUpdate
+        std::vector<uint64_t> vTheirDigests, vOurDigests;
+        if (vin == CTxIn() && !vRecv.empty()) {
+            vRecv >> vTheirDigests;
+            if (vTheirDigests.size() == SERVICENODES_DSEG_BUCKETS)
+                vOurDigests = GetListDigests();
+        }
+
         if (vin == CTxIn()) { //only should ask for this once
             //local network
             bool isLocal = (pfrom->addr.IsRFC1918() || pfrom->addr.IsLocal());
@@ -773,15 +881,23 @@ void CServicenodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CDat
 
 
         int nInvCount = 0;
+        int nSkipped = 0;
 
         BOOST_FOREACH (CServicenode& mn, vServicenodes) {
             if (mn.addr.IsRFC1918()) continue; //local network
 
             if (mn.IsEnabled()) {
-                LogPrint("servicenode", "dseg - Sending Servicenode entry - %s \n", mn.vin.prevout.hash.ToString());
                 if (vin == CTxIn() || vin == mn.vin) {
                     CServicenodeBroadcast mnb = CServicenodeBroadcast(mn);
                     uint256 hash = mnb.GetHash();
+                    if (!vOurDigests.empty()) {
+                        unsigned int nBucket = GetListBucket(hash);
+                        if (vOurDigests[nBucket] == vTheirDigests[nBucket]) {
+                            nSkipped++;
+                            continue;
+                        }
+                    }
+                    LogPrint("servicenode", "dseg - Sending Servicenode entry - %s \n", mn.vin.prevout.hash.ToString());
                     pfrom->PushInventory(CInv(MSG_SERVICENODE_ANNOUNCE, hash));
                     nInvCount++;
 
@@ -797,7 +913,7 @@ void CServicenodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CDat
 
         if (vin == CTxIn()) {
             pfrom->PushMessage("ssc", SERVICENODE_SYNC_LIST, nInvCount);
-            LogPrint("servicenode", "dseg - Sent %d Servicenode entries to peer %i\n", nInvCount, pfrom->GetId());
+            LogPrint("servicenode", "dseg - Sent %d Servicenode entries to peer %i, %d known to it\n", nInvCount, pfrom->GetId(), nSkipped);
         }
     }
 }
@@ -811,6 +927,8 @@ void CServicenodeMan::Remove(CTxIn vin)
         if ((*it).vin == vin) {
             LogPrint("servicenode", "CServicenodeMan: Removing Servicenode %s - %i now\n", (*it).vin.prevout.hash.ToString(), size() - 1);
             vServicenodes.erase(it);
+            fIndexesDirty = true;
+            mapRanks.clear();
             break;
         }
         ++it;
@@ -831,7 +949,7 @@ void CServicenodeMan::UpdateServicenodeList(CServicenodeBroadcast mnb)
         if (Add(mn)) {
             servicenodeSync.AddedServicenodeList(mnb.GetHash());
         }
-    } else if (pmn->UpdateFromNewBroadcast(mnb)) {
+    } else if (UpdateFromNewBroadcast(*pmn, mnb)) {
         servicenodeSync.AddedServicenodeList(mnb.GetHash());
     }
 }
@@ -12,11 +12,14 @@
 #include "main.h"
 #include "servicenode.h"
 #include "net.h"
+#include "recordfile.h"
 #include "sync.h"
 #include "util.h"
 
 #define SERVICENODES_DUMP_SECONDS (15 * 60)
 #define SERVICENODES_DSEG_SECONDS (3 * 60 * 60)
+#define SERVICENODES_RANKS_CACHE_SIZE 32
+#define SERVICENODES_DSEG_BUCKETS 256
 
 using namespace std;
 
@@ -25,14 +28,10 @@ class CServicenodeMan;
 extern CServicenodeMan mnodeman;
 void DumpServicenodes();
 
-/** Access to the MN database (mncache.dat)
+/** Access to the MN database (mncache.dat), a CRecordFile
  */
 class CServicenodeDB
 {
-private:
-    boost::filesystem::path pathMN;
-    std::string strMagicMessage;
-
 public:
     enum ReadResult {
         Ok,
@@ -44,7 +43,6 @@ public:
         IncorrectFormat
     };
 
-    CServicenodeDB();
     bool Write(const CServicenodeMan& mnodemanToSave);
     ReadResult Read(CServicenodeMan& mnodemanToLoad, bool fDryRun = false);
 };
@@ -67,6 +65,40 @@ private:
     // which Servicenodes we've asked for
     std::map<COutPoint, int64_t> mWeAskedForServicenodeListEntry;
 
+    // positions in vServicenodes by outpoint, servicenode pubkey, payee and address,
+    // the first entry wins for keys shared by several servicenodes
+    std::map<COutPoint, size_t> mapIndexByOutpoint;
+    std::map<CPubKey, size_t> mapIndexByPubKey;
+    std::map<CScript, size_t> mapIndexByPayee;
+    std::map<std::string, size_t> mapIndexByAddr;
+    // the indexes must be rebuilt before the next lookup
+    bool fIndexesDirty;
+
+    void AddToIndexes(size_t nPos);
+    void RebuildIndexes();
+
+    // which servicenodes are ranked
+    enum RankFilter {
+        RANKS_ALL,     // every servicenode at or above the protocol
+        RANKS_ENABLED, // enabled ones only
+        RANKS_ACTIVE   // enabled ones that are old enough to be ranked
+    };
+
+    // servicenodes of one block ordered by score, best first
+    struct CServicenodeRanks {
+        uint256 hashBlock;
+        int64_t nTimeCreated;
+        std::vector<CTxIn> vRanked;
+        std::map<COutPoint, int> mapRank;
+    };
+
+    typedef std::pair<int64_t, std::pair<int, int> > RanksKey;
+    // ranks by (block height, min protocol, filter), dropped whenever the list changes
+    std::map<RanksKey, CServicenodeRanks> mapRanks;
+
+    /// Get (and cache) the ranking of the servicenodes for a block, NULL if the block isn't known
+    const CServicenodeRanks* GetRanks(int64_t nBlockHeight, int minProtocol, RankFilter filter);
+
 public:
     // Keep track of all broadcasts I've seen
     map<uint256, CServicenodeBroadcast> mapSeenServicenodeBroadcast;
@@ -90,11 +122,23 @@ public:
 
         READWRITE(mapSeenServicenodeBroadcast);
         READWRITE(mapSeenServicenodePing);
+
+        if (ser_action.ForRead()) {
+            fIndexesDirty = true;
+            mapRanks.clear();
+        }
     }
 
     CServicenodeMan();
     CServicenodeMan(CServicenodeMan& other);
 
+    /// The state kept in mncache.dat, one record per servicenode, seen message or request
+    /// (every record is built on each dump, CRecordFile appends the ones that changed)
+    void GetRecords(CRecordFile::RecordMap& mapRecords) const;
+    /// Replace the state by the records read from mncache.dat; all of them, the manager
+    /// holds its whole state in memory and has nothing it could load on demand
+    void LoadRecords(const CRecordFile::RecordMap& mapRecords);
+
     /// Add an entry
     bool Add(CServicenode& mn);
 
@@ -114,12 +158,24 @@ public:
 
     void DsegUpdate(CNode* pnode);
 
+    /// Digests of the broadcast hashes of the servicenodes a dseg answer lists, by bucket
+    std::vector<uint64_t> GetListDigests();
+
+    /// The keys of an entry (pubkeys, address, protocol) were updated from a broadcast
+    void Reindex();
+
+    /// Update an entry of this list from a newer broadcast, keeping the indexes in sync
+    bool UpdateFromNewBroadcast(CServicenode& mn, CServicenodeBroadcast& mnb);
+
     /// Find an entry
     CServicenode* Find(const CScript& payee);
     CServicenode* Find(const CTxIn& vin);
     CServicenode* Find(const CPubKey& pubKeyServicenode);
     CServicenode* Find(const std::string & nodeAddr);
 
+    /// Copy the key of an entry, safe to use after the list changed
+    bool GetServicenodePubKey(const CTxIn& vin, CPubKey& pubKeyServicenode);
+
     /// Find an entry in the servicenode list that is next to be paid
     CServicenode* GetNextServicenodeInQueueForPayment(int nBlockHeight, bool fFilterSigTime, int& nCount);
 
@@ -12,6 +12,9 @@
 #include "util.h"
 #include <boost/lexical_cast.hpp>
 
+#include <atomic>
+#include <memory>
+
 using namespace std;
 using namespace boost;
 
@@ -20,9 +23,77 @@ class CSporkManager;
 
 CSporkManager sporkManager;
 
+CCriticalSection cs_sporks;
 std::map<uint256, CSporkMessage> mapSporks;
 std::map<int, CSporkMessage> mapSporksActive;
 
+/**
+ * Values of all sporks, the network's over the defaults, -1 if unknown.
+ * A table is never changed once published; every spork update publishes a
+ * new one, so IsSporkActive and GetSporkValue read a consistent table from
+ * any thread without taking a lock.
+ */
+struct CSporkTable {
+    int64_t nValues[SPORK_END - SPORK_START + 1];
+};
+
+static int64_t GetSporkDefault(int nSporkID)
+{
+    if (nSporkID == SPORK_2_SWIFTTX) return SPORK_2_SWIFTTX_DEFAULT;
+    if (nSporkID == SPORK_3_SWIFTTX_BLOCK_FILTERING) return SPORK_3_SWIFTTX_BLOCK_FILTERING_DEFAULT;
+    if (nSporkID == SPORK_5_MAX_VALUE) return SPORK_5_MAX_VALUE_DEFAULT;
+    if (nSporkID == SPORK_8_SERVICENODE_PAYMENT_ENFORCEMENT) return SPORK_8_SERVICENODE_PAYMENT_ENFORCEMENT_DEFAULT;
+    if (nSporkID == SPORK_9_SERVICENODE_BUDGET_ENFORCEMENT) return SPORK_9_SERVICENODE_BUDGET_ENFORCEMENT_DEFAULT;
+    if (nSporkID == SPORK_11_RESET_BUDGET) return SPORK_11_RESET_BUDGET_DEFAULT;
+    if (nSporkID == SPORK_12_RECONSIDER_BLOCKS) return SPORK_12_RECONSIDER_BLOCKS_DEFAULT;
+    if (nSporkID == SPORK_13_ENABLE_SUPERBLOCKS) return SPORK_13_ENABLE_SUPERBLOCKS_DEFAULT;
+    if (nSporkID == SPORK_14_NEW_PROTOCOL_ENFORCEMENT) return SPORK_14_NEW_PROTOCOL_ENFORCEMENT_DEFAULT;
+    if (nSporkID == SPORK_17_EXPL_FIX) return SPORK_17_EXPL_FIX_DEFAULT;
+    if (nSporkID == SPORK_18_PROPOSAL_FEE) return SPORK_18_PROPOSAL_FEE_DEFAULT;
+    if (nSporkID == SPORK_18_PROPOSAL_FEE_AMOUNT) return SPORK_18_PROPOSAL_FEE_AMOUNT_DEFAULT;
+    if (nSporkID == SPORK_21_SNODE_PAYMENT) return SPORK_21_SNODE_PAYMENT_DEFAULT;
+    if (nSporkID == SPORK_22_OP_RETURN) return SPORK_22_OP_RETURN_DEFAULT;
+    if (nSporkID == SPORK_23_SNODE_SIGNATURES) return SPORK_23_SNODE_SIGNATURES_DEFAULT;
+
+    return -1;
+}
+
+static CSporkTable MakeDefaultSporkTable()
+{
+    CSporkTable table;
+    for (int nSporkID = SPORK_START; nSporkID <= SPORK_END; nSporkID++)
+        table.nValues[nSporkID - SPORK_START] = GetSporkDefault(nSporkID);
+    return table;
+}
+
+static const CSporkTable sporkTableDefault = MakeDefaultSporkTable();
+static std::atomic<const CSporkTable*> pSporkTable(&sporkTableDefault);
+// Replaced tables are kept, a reader may still be looking at one. Only the
+// spork key can make new ones, a handful over the life of a release.
+static std::vector<std::unique_ptr<CSporkTable> > vSporkTables;
+
+// Publish a table of mapSporksActive; requires cs_sporks
+static void PublishSporkTable()
+{
+    std::unique_ptr<CSporkTable> table(new CSporkTable(sporkTableDefault));
+    for (std::map<int, CSporkMessage>::const_iterator it = mapSporksActive.begin(); it != mapSporksActive.end(); ++it) {
+        if (it->first >= SPORK_START && it->first <= SPORK_END)
+            table->nValues[it->first - SPORK_START] = it->second.nValue;
+    }
+    pSporkTable.store(table.get(), std::memory_order_release);
+    vSporkTables.push_back(std::move(table));
+}
+
+static int64_t ReadSporkValue(int nSporkID)
+{
+    int64_t r = -1;
+    if (nSporkID >= SPORK_START && nSporkID <= SPORK_END)
+        r = pSporkTable.load(std::memory_order_acquire)->nValues[nSporkID - SPORK_START];
+
+    if (r == -1) LogPrintf("GetSpork::Unknown Spork %d\n", nSporkID);
+    return r;
+}
+
 
 void ProcessSpork(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
 {
@@ -37,12 +108,15 @@ void ProcessSpork(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
         if (chainActive.Tip() == NULL) return;
 
         uint256 hash = spork.GetHash();
-        if (mapSporksActive.count(spork.nSporkID)) {
-            if (mapSporksActive[spork.nSporkID].nTimeSigned >= spork.nTimeSigned) {
-                if (fDebug) LogPrintf("spork - seen %s block %d \n", hash.ToString(), chainActive.Tip()->nHeight);
-                return;
-            } else {
-                if (fDebug) LogPrintf("spork - got updated spork %s block %d \n", hash.ToString(), chainActive.Tip()->nHeight);
+        {
+            LOCK(cs_sporks);
+            if (mapSporksActive.count(spork.nSporkID)) {
+                if (mapSporksActive[spork.nSporkID].nTimeSigned >= spork.nTimeSigned) {
+                    if (fDebug) LogPrintf("spork - seen %s block %d \n", hash.ToString(), chainActive.Tip()->nHeight);
+                    return;
+                } else {
+                    if (fDebug) LogPrintf("spork - got updated spork %s block %d \n", hash.ToString(), chainActive.Tip()->nHeight);
+                }
             }
         }
 
@@ -54,14 +128,19 @@ void ProcessSpork(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
             return;
         }
 
-        mapSporks[hash] = spork;
-        mapSporksActive[spork.nSporkID] = spork;
+        {
+            LOCK(cs_sporks);
+            mapSporks[hash] = spork;
+            mapSporksActive[spork.nSporkID] = spork;
+            PublishSporkTable();
+        }
         sporkManager.Relay(spork);
 
         //does a task if needed
         ExecuteSpork(spork.nSporkID, spork.nValue);
     }
     if (strCommand == "getsporks") {
+        LOCK(cs_sporks);
         std::map<int, CSporkMessage>::iterator it = mapSporksActive.begin();
 
         while (it != mapSporksActive.end()) {
@@ -74,29 +153,7 @@ void ProcessSpork(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
 // grab the spork, otherwise say it's off
 bool IsSporkActive(int nSporkID)
 {
-    int64_t r = -1;
-
-    if (mapSporksActive.count(nSporkID)) {
-        r = mapSporksActive[nSporkID].nValue;
-    } else {
-        if (nSporkID == SPORK_2_SWIFTTX) r = SPORK_2_SWIFTTX_DEFAULT;
-        if (nSporkID == SPORK_3_SWIFTTX_BLOCK_FILTERING) r = SPORK_3_SWIFTTX_BLOCK_FILTERING_DEFAULT;
-        if (nSporkID == SPORK_5_MAX_VALUE) r = SPORK_5_MAX_VALUE_DEFAULT;
-        if (nSporkID == SPORK_8_SERVICENODE_PAYMENT_ENFORCEMENT) r = SPORK_8_SERVICENODE_PAYMENT_ENFORCEMENT_DEFAULT;
-        if (nSporkID == SPORK_9_SERVICENODE_BUDGET_ENFORCEMENT) r = SPORK_9_SERVICENODE_BUDGET_ENFORCEMENT_DEFAULT;
-        if (nSporkID == SPORK_11_RESET_BUDGET) r = SPORK_11_RESET_BUDGET_DEFAULT;
-        if (nSporkID == SPORK_12_RECONSIDER_BLOCKS) r = SPORK_12_RECONSIDER_BLOCKS_DEFAULT;
-        if (nSporkID == SPORK_13_ENABLE_SUPERBLOCKS) r = SPORK_13_ENABLE_SUPERBLOCKS_DEFAULT;
-        if (nSporkID == SPORK_14_NEW_PROTOCOL_ENFORCEMENT) r = SPORK_14_NEW_PROTOCOL_ENFORCEMENT_DEFAULT;
-        if (nSporkID == SPORK_17_EXPL_FIX) r = SPORK_17_EXPL_FIX_DEFAULT;
-        if (nSporkID == SPORK_18_PROPOSAL_FEE) r = SPORK_18_PROPOSAL_FEE_DEFAULT;
-        if (nSporkID == SPORK_18_PROPOSAL_FEE_AMOUNT) r = SPORK_18_PROPOSAL_FEE_AMOUNT_DEFAULT;
-        if (nSporkID == SPORK_21_SNODE_PAYMENT) r = SPORK_21_SNODE_PAYMENT_DEFAULT;
-        if (nSporkID == SPORK_22_OP_RETURN) r = SPORK_22_OP_RETURN_DEFAULT;
-        if (nSporkID == SPORK_23_SNODE_SIGNATURES) r = SPORK_23_SNODE_SIGNATURES_DEFAULT;
-
-        if (r == -1) LogPrintf("GetSpork::Unknown Spork %d\n", nSporkID);
-    }
+    int64_t r = ReadSporkValue(nSporkID);
     if (r == -1) r = 4070908800; //return 2099-1-1 by default
 
     return r < GetTime();
@@ -105,31 +162,7 @@ bool IsSporkActive(int nSporkID)
 // grab the value of the spork on the network, or the default
 int64_t GetSporkValue(int nSporkID)
 {
-    int64_t r = -1;
-
-    if (mapSporksActive.count(nSporkID)) {
-        r = mapSporksActive[nSporkID].nValue;
-    } else {
-        if (nSporkID == SPORK_2_SWIFTTX) r = SPORK_2_SWIFTTX_DEFAULT;
-        if (nSporkID == SPORK_3_SWIFTTX_BLOCK_FILTERING) r = SPORK_3_SWIFTTX_BLOCK_FILTERING_DEFAULT;
-        if (nSporkID == SPORK_5_MAX_VALUE) r = SPORK_5_MAX_VALUE_DEFAULT;
-        if (nSporkID == SPORK_8_SERVICENODE_PAYMENT_ENFORCEMENT) r = SPORK_8_SERVICENODE_PAYMENT_ENFORCEMENT_DEFAULT;
-        if (nSporkID == SPORK_9_SERVICENODE_BUDGET_ENFORCEMENT) r = SPORK_9_SERVICENODE_BUDGET_ENFORCEMENT_DEFAULT;
-        if (nSporkID == SPORK_11_RESET_BUDGET) r = SPORK_11_RESET_BUDGET_DEFAULT;
-        if (nSporkID == SPORK_12_RECONSIDER_BLOCKS) r = SPORK_12_RECONSIDER_BLOCKS_DEFAULT;
-        if (nSporkID == SPORK_13_ENABLE_SUPERBLOCKS) r = SPORK_13_ENABLE_SUPERBLOCKS_DEFAULT;
-        if (nSporkID == SPORK_14_NEW_PROTOCOL_ENFORCEMENT) r = SPORK_14_NEW_PROTOCOL_ENFORCEMENT_DEFAULT;
-        if (nSporkID == SPORK_17_EXPL_FIX) r = SPORK_17_EXPL_FIX_DEFAULT;
-        if (nSporkID == SPORK_18_PROPOSAL_FEE) r = SPORK_18_PROPOSAL_FEE_DEFAULT;
-        if (nSporkID == SPORK_18_PROPOSAL_FEE_AMOUNT) r = SPORK_18_PROPOSAL_FEE_AMOUNT_DEFAULT;
-        if (nSporkID == SPORK_21_SNODE_PAYMENT) r = SPORK_21_SNODE_PAYMENT_DEFAULT;
-        if (nSporkID == SPORK_22_OP_RETURN) r = SPORK_22_OP_RETURN_DEFAULT;
-        if (nSporkID == SPORK_23_SNODE_SIGNATURES) r = SPORK_23_SNODE_SIGNATURES_DEFAULT;
-
-        if (r == -1) LogPrintf("GetSpork::Unknown Spork %d\n", nSporkID);
-    }
-
-    return r;
+    return ReadSporkValue(nSporkID);
 }
 
 void ExecuteSpork(int nSporkID, int nValue)
@@ -227,8 +260,10 @@ bool CSporkManager::UpdateSpork(int nSporkID, int64_t nValue)
 
     if (Sign(msg)) {
         Relay(msg);
+        LOCK(cs_sporks);
         mapSporks[msg.GetHash()] = msg;
         mapSporksActive[nSporkID] = msg;
+        PublishSporkTable();
         return true;
     }
 
@@ -63,6 +63,7 @@ using namespace boost;
 class CSporkMessage;
 class CSporkManager;
 
+extern CCriticalSection cs_sporks; // guards mapSporks and mapSporksActive
 extern std::map<uint256, CSporkMessage> mapSporks;
 extern std::map<int, CSporkMessage> mapSporksActive;
 extern CSporkManager sporkManager;
@@ -0,0 +1,200 @@
+// Copyright (c) 2018 The Blocknet developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUPPORT_POOL_H
+#define BITCOIN_SUPPORT_POOL_H
+
+#include "memusage.h"
+
+#include <assert.h>
+#include <stddef.h>
+
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+/**
+ * Arena for large numbers of small allocations, such as the nodes of a
+ * node based hash map. Memory is carved out of big chunks and recycled
+ * through one free list per size class, so inserting an element costs no
+ * malloc and elements inserted together end up close to each other.
+ * Once the last allocation is returned all chunks are released again.
+ *
+ * Not thread safe; the owner of the container provides locking.
+ */
+class CPoolResource
+{
+public:
+    //! Largest allocation served from the pool; anything bigger goes to operator new
+    static const size_t MAX_ELEMENT_SIZE = 256;
+    //! Granularity (and alignment) of the size classes
+    static const size_t ELEMENT_ALIGN = sizeof(void*);
+    //! Size of the chunks requested from the system
+    static const size_t CHUNK_SIZE = 256 * 1024;
+
+private:
+    struct FreeNode {
+        FreeNode* next;
+    };
+
+    std::vector<FreeNode*> vFree;
+    std::vector<char*> vChunks;
+    char* pChunkPos;
+    char* pChunkEnd;
+    size_t nLive;
+
+    static size_t SizeClass(size_t nBytes)
+    {
+        return (nBytes + ELEMENT_ALIGN - 1) / ELEMENT_ALIGN;
+    }
+
+    void ReleaseChunks()
+    {
+        for (std::vector<char*>::iterator it = vChunks.begin(); it != vChunks.end(); ++it)
+            ::operator delete(*it);
+        vChunks.clear();
+        vFree.assign(vFree.size(), NULL);
+        pChunkPos = pChunkEnd = NULL;
+    }
+
+    // disable copy
+    CPoolResource(const CPoolResource&);
+    CPoolResource& operator=(const CPoolResource&);
+
+public:
+    CPoolResource() : vFree(SizeClass(MAX_ELEMENT_SIZE) + 1, NULL), pChunkPos(NULL), pChunkEnd(NULL), nLive(0) {}
+
+    ~CPoolResource()
+    {
+        ReleaseChunks();
+    }
+
+    /** Whether an object of this size and alignment can be served from the pool */
+    static bool Fits(size_t nBytes, size_t nAlign)
+    {
+        return nBytes <= MAX_ELEMENT_SIZE && nAlign <= ELEMENT_ALIGN;
+    }
+
+    void* Allocate(size_t nBytes)
+    {
+        assert(Fits(nBytes, 1));
+        size_t nClass = SizeClass(nBytes);
+        nLive++;
+        if (vFree[nClass]) {
+            FreeNode* node = vFree[nClass];
+            vFree[nClass] = node->next;
+            return node;
+        }
+        size_t nSize = nClass * ELEMENT_ALIGN;
+        if (pChunkPos == NULL || (size_t)(pChunkEnd - pChunkPos) < nSize) {
+            // Put whatever is left of the current chunk on the free lists before starting a new one.
+            while (pChunkPos != NULL && (size_t)(pChunkEnd - pChunkPos) >= ELEMENT_ALIGN) {
+                size_t nRest = std::min((size_t)(pChunkEnd - pChunkPos) / ELEMENT_ALIGN, SizeClass(MAX_ELEMENT_SIZE));
+                FreeNode* node = reinterpret_cast<FreeNode*>(pChunkPos);
+                node->next = vFree[nRest];
+                vFree[nRest] = node;
+                pChunkPos += nRest * ELEMENT_ALIGN;
+            }
+            char* pChunk = static_cast<char*>(::operator new(CHUNK_SIZE));
+            vChunks.push_back(pChunk);
+            pChunkPos = pChunk;
+            pChunkEnd = pChunk + CHUNK_SIZE;
+        }
+        void* p = pChunkPos;
+        pChunkPos += nSize;
+        return p;
+    }
+
+    void Deallocate(void* p, size_t nBytes)
+    {
+        assert(nLive > 0);
+        size_t nClass = SizeClass(nBytes);
+        FreeNode* node = static_cast<FreeNode*>(p);
+        node->next = vFree[nClass];
+        vFree[nClass] = node;
+        if (--nLive == 0)
+            ReleaseChunks();
+    }
+
+    //! Number of allocations currently handed out
+    size_t GetLiveCount() const { return nLive; }
+
+    //! Memory held by the pool, including free space inside its chunks
+    size_t DynamicMemoryUsage() const
+    {
+        return vChunks.size() * memusage::MallocUsage(CHUNK_SIZE) + memusage::DynamicUsage(vFree) + memusage::DynamicUsage(vChunks);
+    }
+};
+
+/**
+ * Allocator serving single objects from a CPoolResource. Array allocations
+ * (like the bucket array of a hash map) and default constructed allocators
+ * fall back to operator new.
+ */
+template <typename T>
+struct pool_allocator {
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+
+    template <typename U>
+    struct rebind {
+        typedef pool_allocator<U> other;
+    };
+
+    CPoolResource* resource;
+
+    pool_allocator() throw() : resource(NULL) {}
+    explicit pool_allocator(CPoolResource* resourceIn) throw() : resource(resourceIn) {}
+    pool_allocator(const pool_allocator& a) throw() : resource(a.resource) {}
+    template <typename U>
+    pool_allocator(const pool_allocator<U>& a) throw() : resource(a.resource)
+    {
+    }
+    ~pool_allocator() throw() {}
+
+    T* address(T& x) const { return &x; }
+    const T* address(const T& x) const { return &x; }
+    size_t max_size() const throw() { return size_t(-1) / sizeof(T); }
+
+    T* allocate(size_t n, const void* hint = 0)
+    {
+        if (resource && n == 1 && CPoolResource::Fits(sizeof(T), alignof(T)))
+            return static_cast<T*>(resource->Allocate(sizeof(T)));
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        if (resource && n == 1 && CPoolResource::Fits(sizeof(T), alignof(T)))
+            resource->Deallocate(p, sizeof(T));
+        else
+            ::operator delete(p);
+    }
+
+    template <typename U, typename... Args>
+    void construct(U* p, Args&&... args) { ::new ((void*)p) U(std::forward<Args>(args)...); }
+    template <typename U>
+    void destroy(U* p) { p->~U(); }
+};
+
+template <typename T, typename U>
+bool operator==(const pool_allocator<T>& a, const pool_allocator<U>& b)
+{
+    return a.resource == b.resource;
+}
+
+template <typename T, typename U>
+bool operator!=(const pool_allocator<T>& a, const pool_allocator<U>& b)
+{
+    return a.resource != b.resource;
+}
+
+#endif // BITCOIN_SUPPORT_POOL_H
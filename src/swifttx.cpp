@@ -25,6 +25,52 @@ std::map<COutPoint, uint256> mapLockedInputs;
 std::map<uint256, int64_t> mapUnknownVotes; //track votes with no tx for DOS
 int nCompleteTXLocks;
 
+// Sum of mapUnknownVotes, for GetAverageVoteTime
+static int64_t nUnknownVotesTotal = 0;
+// Locks by expiration time, so CleanTransactionLocksList only visits expired ones.
+// A lock whose expiration was moved up has an entry for each time; stale ones are skipped.
+static std::multimap<int64_t, uint256> mapLockExpiry;
+
+// Time-to-lock metrics
+static CCriticalSection cs_swiftTxStats;
+static size_t nStatsLocks = 0;
+static uint64_t nStatsCompleted = 0;
+static int64_t nStatsTotalLockMs = 0;
+static int64_t nStatsMaxLockMs = 0;
+
+static void SetUnknownVoteTime(const uint256& hash, int64_t nTime)
+{
+    std::map<uint256, int64_t>::iterator it = mapUnknownVotes.find(hash);
+    if (it == mapUnknownVotes.end()) {
+        mapUnknownVotes.insert(make_pair(hash, nTime));
+    } else {
+        nUnknownVotesTotal -= it->second;
+        it->second = nTime;
+    }
+    nUnknownVotesTotal += nTime;
+}
+
+static void SetLockExpiration(CTransactionLock& lock, int64_t nTime)
+{
+    lock.nExpiration = nTime;
+    mapLockExpiry.insert(make_pair(nTime, lock.txHash));
+}
+
+static std::map<uint256, CTransactionLock>::iterator NewLock(const uint256& txHash, int nBlockHeight)
+{
+    CTransactionLock newLock;
+    newLock.nBlockHeight = nBlockHeight;
+    newLock.nTimeout = GetTime() + (60 * 5);
+    newLock.nTimeCreated = GetTimeMillis();
+    newLock.txHash = txHash;
+    std::map<uint256, CTransactionLock>::iterator it = mapTxLocks.insert(make_pair(txHash, newLock)).first;
+    SetLockExpiration(it->second, GetTime() + (60 * 60)); //locks expire after 60 minutes (24 confirmations)
+
+    LOCK(cs_swiftTxStats);
+    nStatsLocks++;
+    return it;
+}
+
 //txlock - Locks transaction
 //
 //step 1.) Broadcast intention to lock transaction inputs, "txlreg", CTransaction
@@ -70,6 +116,7 @@ void ProcessMessageSwiftTX(CNode* pfrom, std::string& strCommand, CDataStream& v
         CValidationState state;
 
         bool fAccepted = false;
+        PreverifyTransaction(mempool, tx);
         {
             LOCK(cs_main);
             fAccepted = AcceptToMemoryPool(mempool, state, tx, true, &fMissingInputs);
@@ -142,7 +189,7 @@ void ProcessMessageSwiftTX(CNode* pfrom, std::string& strCommand, CDataStream& v
             */
             if (!mapTxLockReq.count(ctx.txHash) && !mapTxLockReqRejected.count(ctx.txHash)) {
                 if (!mapUnknownVotes.count(ctx.vinServicenode.prevout.hash)) {
-                    mapUnknownVotes[ctx.vinServicenode.prevout.hash] = GetTime() + (60 * 10);
+                    SetUnknownVoteTime(ctx.vinServicenode.prevout.hash, GetTime() + (60 * 10));
                 }
 
                 if (mapUnknownVotes[ctx.vinServicenode.prevout.hash] > GetTime() &&
@@ -152,7 +199,7 @@ void ProcessMessageSwiftTX(CNode* pfrom, std::string& strCommand, CDataStream& v
                         ctx.txHash.ToString().c_str());
                     return;
                 } else {
-                    mapUnknownVotes[ctx.vinServicenode.prevout.hash] = GetTime() + (60 * 10);
+                    SetUnknownVoteTime(ctx.vinServicenode.prevout.hash, GetTime() + (60 * 10));
                 }
             }
             RelayInv(inv);
@@ -231,12 +278,7 @@ int64_t CreateNewLock(CTransaction tx)
     if (!mapTxLocks.count(tx.GetHash())) {
         LogPrintf("CreateNewLock - New Transaction Lock %s !\n", tx.GetHash().ToString().c_str());
 
-        CTransactionLock newLock;
-        newLock.nBlockHeight = nBlockHeight;
-        newLock.nExpiration = GetTime() + (60 * 60); //locks expire after 60 minutes (24 confirmations)
-        newLock.nTimeout = GetTime() + (60 * 5);
-        newLock.txHash = tx.GetHash();
-        mapTxLocks.insert(make_pair(tx.GetHash(), newLock));
+        NewLock(tx.GetHash(), nBlockHeight);
     } else {
         mapTxLocks[tx.GetHash()].nBlockHeight = nBlockHeight;
         LogPrint("swifttx", "CreateNewLock - Transaction Lock Exists %s !\n", tx.GetHash().ToString().c_str());
@@ -315,22 +357,20 @@ bool ProcessConsensusVote(CNode* pnode, CConsensusVote& ctx)
         return false;
     }
 
-    if (!mapTxLocks.count(ctx.txHash)) {
+    std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(ctx.txHash);
+    if (i == mapTxLocks.end()) {
         LogPrintf("SwiftTX::ProcessConsensusVote - New Transaction Lock %s !\n", ctx.txHash.ToString().c_str());
 
-        CTransactionLock newLock;
-        newLock.nBlockHeight = 0;
-        newLock.nExpiration = GetTime() + (60 * 60);
-        newLock.nTimeout = GetTime() + (60 * 5);
-        newLock.txHash = ctx.txHash;
-        mapTxLocks.insert(make_pair(ctx.txHash, newLock));
+        i = NewLock(ctx.txHash, 0);
     } else
         LogPrint("swifttx", "SwiftTX::ProcessConsensusVote - Transaction Lock Exists %s !\n", ctx.txHash.ToString().c_str());
 
     //compile consessus vote
-    std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(ctx.txHash);
     if (i != mapTxLocks.end()) {
-        (*i).second.AddSignature(ctx);
+        if (!(*i).second.AddSignature(ctx)) {
+            LogPrint("swifttx", "SwiftTX::ProcessConsensusVote - Servicenode already voted %s !\n", ctx.GetHash().ToString().c_str());
+            return false;
+        }
 
 #ifdef ENABLE_WALLET
         if (pwalletMain) {
@@ -345,6 +385,17 @@ bool ProcessConsensusVote(CNode* pnode, CConsensusVote& ctx)
         if ((*i).second.CountSignatures() >= SWIFTTX_SIGNATURES_REQUIRED) {
             LogPrint("swifttx", "SwiftTX::ProcessConsensusVote - Transaction Lock Is Complete %s !\n", (*i).second.GetHash().ToString().c_str());
 
+            if ((*i).second.nTimeLocked == 0) {
+                (*i).second.nTimeLocked = GetTimeMillis();
+                int64_t nLockMs = (*i).second.nTimeLocked - (*i).second.nTimeCreated;
+                LogPrint("swifttx", "SwiftTX::ProcessConsensusVote - Transaction %s locked in %dms\n", ctx.txHash.ToString(), nLockMs);
+
+                LOCK(cs_swiftTxStats);
+                nStatsCompleted++;
+                nStatsTotalLockMs += nLockMs;
+                nStatsMaxLockMs = std::max(nStatsMaxLockMs, nLockMs);
+            }
+
             CTransaction& tx = mapTxLockReq[ctx.txHash];
             if (!CheckForConflictingLocks(tx)) {
 #ifdef ENABLE_WALLET
@@ -392,8 +443,8 @@ bool CheckForConflictingLocks(CTransaction& tx)
         if (mapLockedInputs.count(in.prevout)) {
             if (mapLockedInputs[in.prevout] != tx.GetHash()) {
                 LogPrintf("SwiftTX::CheckForConflictingLocks - found two complete conflicting locks - removing both. %s %s", tx.GetHash().ToString().c_str(), mapLockedInputs[in.prevout].ToString().c_str());
-                if (mapTxLocks.count(tx.GetHash())) mapTxLocks[tx.GetHash()].nExpiration = GetTime();
-                if (mapTxLocks.count(mapLockedInputs[in.prevout])) mapTxLocks[mapLockedInputs[in.prevout]].nExpiration = GetTime();
+                if (mapTxLocks.count(tx.GetHash())) SetLockExpiration(mapTxLocks[tx.GetHash()], GetTime());
+                if (mapTxLocks.count(mapLockedInputs[in.prevout])) SetLockExpiration(mapTxLocks[mapLockedInputs[in.prevout]], GetTime());
                 return true;
             }
         }
@@ -404,26 +455,32 @@ bool CheckForConflictingLocks(CTransaction& tx)
 
 int64_t GetAverageVoteTime()
 {
-    std::map<uint256, int64_t>::iterator it = mapUnknownVotes.begin();
-    int64_t total = 0;
-    int64_t count = 0;
-
-    while (it != mapUnknownVotes.end()) {
-        total += it->second;
-        count++;
-        it++;
-    }
+    if (mapUnknownVotes.empty()) return 0;
 
-    return total / count;
+    return nUnknownVotesTotal / (int64_t)mapUnknownVotes.size();
+}
+
+void GetSwiftTxStats(size_t& nLocks, uint64_t& nCompleted, int64_t& nAvgLockMs, int64_t& nMaxLockMs)
+{
+    LOCK(cs_swiftTxStats);
+    nLocks = nStatsLocks;
+    nCompleted = nStatsCompleted;
+    nAvgLockMs = nStatsCompleted ? nStatsTotalLockMs / (int64_t)nStatsCompleted : 0;
+    nMaxLockMs = nStatsMaxLockMs;
 }
 
 void CleanTransactionLocksList()
 {
     if (chainActive.Tip() == NULL) return;
 
-    std::map<uint256, CTransactionLock>::iterator it = mapTxLocks.begin();
+    while (!mapLockExpiry.empty() && GetTime() > mapLockExpiry.begin()->first) {
+        uint256 txHash = mapLockExpiry.begin()->second;
+        mapLockExpiry.erase(mapLockExpiry.begin());
+
+        std::map<uint256, CTransactionLock>::iterator it = mapTxLocks.find(txHash);
+        if (it == mapTxLocks.end())
+            continue;
 
-    while (it != mapTxLocks.end()) {
         if (GetTime() > it->second.nExpiration) { //keep them for an hour
             LogPrintf("Removing old transaction lock %s\n", it->second.txHash.ToString().c_str());
 
@@ -440,9 +497,10 @@ void CleanTransactionLocksList()
                     mapTxLockVote.erase(v.GetHash());
             }
 
-            mapTxLocks.erase(it++);
-        } else {
-            it++;
+            mapTxLocks.erase(it);
+
+            LOCK(cs_swiftTxStats);
+            nStatsLocks--;
         }
     }
 }
@@ -527,9 +585,14 @@ bool CTransactionLock::SignaturesValid()
     return true;
 }
 
-void CTransactionLock::AddSignature(CConsensusVote& cv)
+bool CTransactionLock::AddSignature(CConsensusVote& cv)
 {
+    if (!setVoters.insert(cv.vinServicenode.prevout).second)
+        return false;
+
     vecConsensusVotes.push_back(cv);
+    mapVotesByHeight[cv.nBlockHeight]++;
+    return true;
 }
 
 int CTransactionLock::CountSignatures()
@@ -541,11 +604,6 @@ int CTransactionLock::CountSignatures()
 
     if (nBlockHeight == 0) return -1;
 
-    int n = 0;
-    BOOST_FOREACH (CConsensusVote v, vecConsensusVotes) {
-        if (v.nBlockHeight == nBlockHeight) {
-            n++;
-        }
-    }
-    return n;
+    std::map<int, int>::const_iterator it = mapVotesByHeight.find(nBlockHeight);
+    return it == mapVotesByHeight.end() ? 0 : it->second;
 }
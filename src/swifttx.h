@@ -64,6 +64,9 @@ void CleanTransactionLocksList();
 
 int64_t GetAverageVoteTime();
 
+/** Locks tracked and how long complete ones took from first sight to SWIFTTX_SIGNATURES_REQUIRED votes */
+void GetSwiftTxStats(size_t& nLocks, uint64_t& nCompleted, int64_t& nAvgLockMs, int64_t& nMaxLockMs);
+
 class CConsensusVote
 {
 public:
@@ -91,16 +94,27 @@ public:
 
 class CTransactionLock
 {
+private:
+    //! Servicenodes that voted, one vote each
+    std::set<COutPoint> setVoters;
+    //! Number of votes for each block height
+    std::map<int, int> mapVotesByHeight;
+
 public:
     int nBlockHeight;
     uint256 txHash;
     std::vector<CConsensusVote> vecConsensusVotes;
     int nExpiration;
     int nTimeout;
+    int64_t nTimeCreated; // milliseconds
+    int64_t nTimeLocked;  // milliseconds, 0 until complete
+
+    CTransactionLock() : nBlockHeight(0), nExpiration(0), nTimeout(0), nTimeCreated(0), nTimeLocked(0) {}
 
     bool SignaturesValid();
     int CountSignatures();
-    void AddSignature(CConsensusVote& cv);
+    //! Returns false if the servicenode already voted
+    bool AddSignature(CConsensusVote& cv);
 
     uint256 GetHash()
     {
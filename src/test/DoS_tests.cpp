@@ -10,6 +10,7 @@
 
 #include "keystore.h"
 #include "main.h"
+#include "msgworkers.h"
 #include "net.h"
 #include "pow.h"
 #include "script/sign.h"
@@ -19,20 +20,24 @@
 #include <stdint.h>
 
 #include <boost/assign/list_of.hpp> // for 'map_list_of()'
+#include <boost/bind.hpp>
 #include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <boost/foreach.hpp>
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 
 // Tests this internal-to-main.cpp method:
 extern bool AddOrphanTx(const CTransaction& tx, NodeId peer);
 extern void EraseOrphansFor(NodeId peer);
-extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans);
+extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans, size_t nMaxOrphansSize);
 struct COrphanTx {
     CTransaction tx;
     NodeId fromPeer;
+    int64_t nTimeExpire;
+    unsigned int nSize;
 };
 extern std::map<uint256, COrphanTx> mapOrphanTransactions;
-extern std::map<uint256, std::set<uint256> > mapOrphanTransactionsByPrev;
+extern size_t nOrphanTransactionsSize;
 
 CService ip(uint32_t i)
 {
@@ -66,6 +71,44 @@ BOOST_AUTO_TEST_CASE(DoS_banning)
     BOOST_CHECK(CNode::IsBanned(addr2));
 }
 
+static void MisbehaveMessage(CNode* pnode, CNetMessage& msg)
+{
+    Misbehaving(pnode->GetId(), 100);
+}
+
+BOOST_AUTO_TEST_CASE(DoS_deferred_banning)
+{
+    CNode::ClearBanned();
+    CAddress addr1(ip(0xa0b0c001));
+    CNode dummyNode1(INVALID_SOCKET, addr1, "", true);
+    dummyNode1.nVersion = 1;
+
+    CMessageWorkers workers;
+    boost::thread thread(boost::bind(&CMessageWorkers::Thread, &workers, CMessageWorkers::ProcessFn(MisbehaveMessage), CMessageWorkers::PrepareFn()));
+    {
+        // A worker finding cs_main taken leaves the score for SendMessages
+        LOCK(cs_main);
+        std::deque<CNetMessage> vMsgs(1, CNetMessage(SER_NETWORK, PROTOCOL_VERSION));
+        {
+            LOCK(dummyNode1.cs_vRecvMsg);
+            workers.Submit(&dummyNode1, vMsgs);
+        }
+        bool fBusy = true;
+        for (int i = 0; i < 500 && fBusy; i++) {
+            MilliSleep(10);
+            LOCK(dummyNode1.cs_vRecvMsg);
+            fBusy = dummyNode1.fRecvMsgAsync;
+        }
+        BOOST_CHECK(!fBusy);
+    }
+    thread.interrupt();
+    thread.join();
+
+    BOOST_CHECK(!CNode::IsBanned(addr1));
+    SendMessages(&dummyNode1, false);
+    BOOST_CHECK(CNode::IsBanned(addr1));
+}
+
 BOOST_AUTO_TEST_CASE(DoS_banscore)
 {
     CNode::ClearBanned();
@@ -188,14 +231,82 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
     }
 
     // Test LimitOrphanTxSize() function:
-    LimitOrphanTxSize(40);
+    LimitOrphanTxSize(40, std::numeric_limits<size_t>::max());
     BOOST_CHECK(mapOrphanTransactions.size() <= 40);
-    LimitOrphanTxSize(10);
+    LimitOrphanTxSize(10, std::numeric_limits<size_t>::max());
     BOOST_CHECK(mapOrphanTransactions.size() <= 10);
-    LimitOrphanTxSize(0);
+    LimitOrphanTxSize(0, std::numeric_limits<size_t>::max());
     BOOST_CHECK(mapOrphanTransactions.empty());
-    BOOST_CHECK(mapOrphanTransactionsByPrev.empty());
+    BOOST_CHECK_EQUAL(nOrphanTransactionsSize, 0U);
 }
 #endif /* FIXME(unit test) */
 
+static CTransaction UnsignedOrphan()
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout.n = 0;
+    tx.vin[0].prevout.hash = GetRandHash();
+    tx.vin[0].scriptSig << OP_1;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 1 * CENT;
+    tx.vout[0].scriptPubKey << OP_TRUE;
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(DoS_mapOrphans_limits)
+{
+    LOCK(cs_main);
+    LimitOrphanTxSize(0, 0);
+
+    // 10 orphans from each of 3 peers
+    for (NodeId i = 0; i < 30; i++)
+        BOOST_CHECK(AddOrphanTx(UnsignedOrphan(), i % 3));
+    BOOST_CHECK_EQUAL(mapOrphanTransactions.size(), 30U);
+    size_t nSize = nOrphanTransactionsSize;
+    BOOST_CHECK_EQUAL(nSize, 30 * mapOrphanTransactions.begin()->second.nSize);
+
+    // Erasing a peer's orphans only touches that peer
+    EraseOrphansFor(1);
+    BOOST_CHECK_EQUAL(mapOrphanTransactions.size(), 20U);
+    BOOST_CHECK_EQUAL(nOrphanTransactionsSize, nSize * 2 / 3);
+    for (std::map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.begin(); it != mapOrphanTransactions.end(); ++it)
+        BOOST_CHECK(it->second.fromPeer != 1);
+
+    // The byte cap evicts without the count cap
+    LimitOrphanTxSize(100, nSize / 3);
+    BOOST_CHECK(nOrphanTransactionsSize <= nSize / 3);
+    BOOST_CHECK_EQUAL(mapOrphanTransactions.size(), 10U);
+
+    // Orphans expire
+    SetMockTime(GetTime() + ORPHAN_TX_EXPIRE_TIME + ORPHAN_TX_EXPIRE_INTERVAL + 1);
+    LimitOrphanTxSize(100, nSize);
+    BOOST_CHECK(mapOrphanTransactions.empty());
+    BOOST_CHECK_EQUAL(nOrphanTransactionsSize, 0U);
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_CASE(DoS_inventory_known)
+{
+    CAddress addr(ip(0xa0b0c001));
+    CNode dummyNode(INVALID_SOCKET, addr, "", true);
+    uint256 hash = GetRandHash();
+
+    // A known transaction doesn't hide its obfuscation or SwiftTX announcement
+    dummyNode.AddInventoryKnown(CInv(MSG_TX, hash));
+    dummyNode.PushInventory(CInv(MSG_TX, hash));
+    BOOST_CHECK(dummyNode.vInventoryToSend.empty());
+    dummyNode.PushInventory(CInv(MSG_DSTX, hash));
+    dummyNode.PushInventory(CInv(MSG_TXLOCK_REQUEST, hash));
+    BOOST_CHECK_EQUAL(dummyNode.vInventoryToSend.size(), 2U);
+
+    // ... and the other way round
+    uint256 hash2 = GetRandHash();
+    dummyNode.AddInventoryKnown(CInv(MSG_DSTX, hash2));
+    dummyNode.PushInventory(CInv(MSG_DSTX, hash2));
+    BOOST_CHECK_EQUAL(dummyNode.vInventoryToSend.size(), 2U);
+    dummyNode.PushInventory(CInv(MSG_TX, hash2));
+    BOOST_CHECK_EQUAL(dummyNode.vInventoryToSend.size(), 3U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -175,4 +175,66 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(missed_an_entry);
 }
 
+BOOST_AUTO_TEST_CASE(coins_cache_memusage_test)
+{
+    CCoinsViewTest base;
+    CCoinsViewCache cache(&base);
+    size_t nEmptyUsage = cache.DynamicMemoryUsage();
+
+    // Every entry carries a script, so usage must grow with the number of entries.
+    size_t nLastUsage = nEmptyUsage;
+    for (unsigned int i = 0; i < 1000; i++) {
+        CCoinsModifier entry = cache.ModifyCoins(GetRandHash());
+        entry->nVersion = 1;
+        entry->vout.resize(1);
+        entry->vout[0].nValue = i + 1;
+        entry->vout[0].scriptPubKey = CScript() << OP_TRUE;
+        if (i % 100 == 99) {
+            BOOST_CHECK(cache.DynamicMemoryUsage() > nLastUsage);
+            nLastUsage = cache.DynamicMemoryUsage();
+        }
+    }
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 1000U);
+
+    // Spending everything frees the outputs again, but not the entries.
+    size_t nFullUsage = cache.DynamicMemoryUsage();
+    {
+        CCoinsModifier entry = cache.ModifyCoins(GetRandHash());
+        entry->vout.resize(1);
+        entry->vout[0].scriptPubKey = CScript() << OP_TRUE;
+        entry->Clear();
+    }
+    BOOST_CHECK(cache.DynamicMemoryUsage() <= nFullUsage);
+
+    // After flushing, the pooled entries are released.
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+    BOOST_CHECK(cache.DynamicMemoryUsage() < nFullUsage);
+}
+
+BOOST_AUTO_TEST_CASE(pool_allocator_test)
+{
+    CPoolResource resource;
+    std::vector<int*> vAllocated;
+    pool_allocator<int> alloc(&resource);
+    for (int i = 0; i < 100000; i++) {
+        int* p = alloc.allocate(1);
+        *p = i;
+        vAllocated.push_back(p);
+    }
+    BOOST_CHECK_EQUAL(resource.GetLiveCount(), 100000U);
+    BOOST_CHECK(resource.DynamicMemoryUsage() > 0);
+    for (int i = 0; i < 100000; i++)
+        BOOST_CHECK_EQUAL(*vAllocated[i], i);
+    // Freed memory is reused before new chunks are taken.
+    size_t nUsage = resource.DynamicMemoryUsage();
+    alloc.deallocate(vAllocated.back(), 1);
+    vAllocated.back() = alloc.allocate(1);
+    BOOST_CHECK_EQUAL(resource.DynamicMemoryUsage(), nUsage);
+    BOOST_FOREACH (int* p, vAllocated)
+        alloc.deallocate(p, 1);
+    BOOST_CHECK_EQUAL(resource.GetLiveCount(), 0U);
+    BOOST_CHECK(resource.DynamicMemoryUsage() < nUsage);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -99,4 +99,112 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     removed.clear();
 }
 
+BOOST_AUTO_TEST_CASE(MempoolAncestorDescendantTest)
+{
+    // A chain tx1 <- tx2 <- tx3 of equally sized transactions
+    CMutableTransaction tx1;
+    tx1.vin.resize(1);
+    tx1.vin[0].scriptSig = CScript() << OP_11;
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+
+    CMutableTransaction tx2;
+    tx2.vin.resize(1);
+    tx2.vin[0].scriptSig = CScript() << OP_11;
+    tx2.vin[0].prevout = COutPoint(tx1.GetHash(), 0);
+    tx2.vout = tx1.vout;
+
+    CMutableTransaction tx3;
+    tx3.vin.resize(1);
+    tx3.vin[0].scriptSig = CScript() << OP_11;
+    tx3.vin[0].prevout = COutPoint(tx2.GetHash(), 0);
+    tx3.vout = tx1.vout;
+
+    CTxMemPool pool(CFeeRate(0));
+    pool.addUnchecked(tx1.GetHash(), CTxMemPoolEntry(tx1, 1000LL, 0, 0.0, 1));
+    pool.addUnchecked(tx2.GetHash(), CTxMemPoolEntry(tx2, 2000LL, 0, 0.0, 1));
+    pool.addUnchecked(tx3.GetHash(), CTxMemPoolEntry(tx3, 30000LL, 0, 0.0, 1));
+
+    CTxMemPool::txiter it1 = pool.mapTx.find(tx1.GetHash());
+    CTxMemPool::txiter it2 = pool.mapTx.find(tx2.GetHash());
+    CTxMemPool::txiter it3 = pool.mapTx.find(tx3.GetHash());
+    uint64_t nSize = it1->GetTxSize();
+    BOOST_CHECK_EQUAL(it2->GetTxSize(), nSize);
+    BOOST_CHECK_EQUAL(it3->GetTxSize(), nSize);
+
+    BOOST_CHECK_EQUAL(it1->GetCountWithDescendants(), 3);
+    BOOST_CHECK_EQUAL(it1->GetSizeWithDescendants(), 3 * nSize);
+    BOOST_CHECK_EQUAL(it1->GetModFeesWithDescendants(), 33000LL);
+    BOOST_CHECK_EQUAL(it3->GetCountWithAncestors(), 3);
+    BOOST_CHECK_EQUAL(it3->GetSizeWithAncestors(), 3 * nSize);
+    BOOST_CHECK_EQUAL(it3->GetModFeesWithAncestors(), 33000LL);
+
+    // The child pays for its parents: its package is the best one to mine...
+    BOOST_CHECK(pool.mapTx.get<ancestor_score>().begin()->GetTx().GetHash() == tx3.GetHash());
+    // ... and the parent is worth the least to keep
+    BOOST_CHECK(pool.mapTx.get<descendant_score>().begin()->GetTx().GetHash() == tx1.GetHash());
+
+    // Removing the tip of the chain updates its ancestors
+    std::list<CTransaction> removed;
+    pool.remove(tx3, removed, true);
+    BOOST_CHECK_EQUAL(removed.size(), 1);
+    BOOST_CHECK_EQUAL(it1->GetCountWithDescendants(), 2);
+    BOOST_CHECK_EQUAL(it1->GetModFeesWithDescendants(), 3000LL);
+
+    // Fee deltas count towards the packages on both sides
+    pool.PrioritiseTransaction(tx2.GetHash(), tx2.GetHash().ToString(), 0.0, 5000LL);
+    BOOST_CHECK_EQUAL(it2->GetModifiedFee(), 7000LL);
+    BOOST_CHECK_EQUAL(it1->GetModFeesWithDescendants(), 8000LL);
+    BOOST_CHECK_EQUAL(it2->GetModFeesWithAncestors(), 8000LL);
+
+    // Confirming the parent leaves the child on its own
+    removed.clear();
+    pool.remove(tx1, removed, false);
+    BOOST_CHECK_EQUAL(removed.size(), 1);
+    BOOST_CHECK_EQUAL(pool.size(), 1);
+    BOOST_CHECK_EQUAL(it2->GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(it2->GetSizeWithAncestors(), nSize);
+    BOOST_CHECK_EQUAL(it2->GetModFeesWithAncestors(), 7000LL);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
+{
+    CMutableTransaction tx1;
+    tx1.vin.resize(1);
+    tx1.vin[0].scriptSig = CScript() << OP_11;
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+
+    CMutableTransaction tx2;
+    tx2.vin.resize(1);
+    tx2.vin[0].scriptSig = CScript() << OP_12;
+    tx2.vout = tx1.vout;
+
+    CTxMemPool pool(CFeeRate(1000));
+    pool.addUnchecked(tx1.GetHash(), CTxMemPoolEntry(tx1, 10000LL, 1, 0.0, 1));
+    pool.addUnchecked(tx2.GetHash(), CTxMemPoolEntry(tx2, 5000LL, 2, 0.0, 1));
+    size_t nUsage = pool.DynamicMemoryUsage();
+    BOOST_CHECK_EQUAL(pool.GetMinFee(nUsage).GetFeePerK(), 0);
+
+    pool.TrimToSize(nUsage);
+    BOOST_CHECK(pool.exists(tx1.GetHash()));
+    BOOST_CHECK(pool.exists(tx2.GetHash()));
+
+    // The lower feerate transaction goes first, and the minimum fee goes up
+    pool.TrimToSize(nUsage - 1);
+    BOOST_CHECK(pool.exists(tx1.GetHash()));
+    BOOST_CHECK(!pool.exists(tx2.GetHash()));
+    BOOST_CHECK(pool.DynamicMemoryUsage() < nUsage);
+    CFeeRate feeRemoved(5000LL, ::GetSerializeSize(tx2, SER_NETWORK, PROTOCOL_VERSION));
+    BOOST_CHECK_EQUAL(pool.GetMinFee(nUsage).GetFeePerK(), feeRemoved.GetFeePerK() + 1000);
+
+    // Old transactions expire
+    pool.addUnchecked(tx2.GetHash(), CTxMemPoolEntry(tx2, 5000LL, 2, 0.0, 1));
+    BOOST_CHECK_EQUAL(pool.Expire(2), 1);
+    BOOST_CHECK(!pool.exists(tx1.GetHash()));
+    BOOST_CHECK(pool.exists(tx2.GetHash()));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
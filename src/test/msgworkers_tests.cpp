@@ -0,0 +1,143 @@
+// Copyright (c) 2018 The Blocknet developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "msgworkers.h"
+#include "utiltime.h"
+#include "version.h"
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+namespace
+{
+struct Recorder {
+    boost::mutex mutex;
+    std::vector<std::pair<CNode*, int> > vProcessed;
+    int nPrepared;
+
+    Recorder() : nPrepared(0) {}
+
+    void Process(CNode* pnode, CNetMessage& msg)
+    {
+        int n;
+        msg.vRecv >> n;
+        boost::unique_lock<boost::mutex> lock(mutex);
+        vProcessed.push_back(std::make_pair(pnode, n));
+    }
+
+    void Prepare(CNode* pnode, const std::deque<CNetMessage>& vMsgs)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nPrepared += vMsgs.size();
+    }
+};
+
+CNetMessage MakeMessage(const char* pszCommand, int n)
+{
+    CNetMessage msg(SER_NETWORK, PROTOCOL_VERSION);
+    msg.vRecv << n;
+    msg.hdr = CMessageHeader(pszCommand, msg.vRecv.size());
+    msg.in_data = true;
+    msg.nDataPos = msg.vRecv.size();
+    return msg;
+}
+
+void Submit(CMessageWorkers& workers, CNode& node, int nBegin, int nEnd, bool fPrepareOnly = false)
+{
+    std::deque<CNetMessage> vMsgs;
+    for (int i = nBegin; i < nEnd; i++)
+        vMsgs.push_back(MakeMessage("mnb", i));
+    LOCK(node.cs_vRecvMsg);
+    workers.Submit(&node, vMsgs, fPrepareOnly);
+}
+
+bool WaitIdle(CNode& node)
+{
+    for (int i = 0; i < 500; i++) {
+        {
+            LOCK(node.cs_vRecvMsg);
+            if (!node.fRecvMsgAsync)
+                return true;
+        }
+        MilliSleep(10);
+    }
+    return false;
+}
+}
+
+BOOST_AUTO_TEST_SUITE(msgworkers_tests)
+
+BOOST_AUTO_TEST_CASE(msgworkers_order)
+{
+    CMessageWorkers workers;
+    Recorder recorder;
+    boost::thread_group threads;
+    for (int i = 0; i < 2; i++)
+        threads.create_thread(boost::bind(&CMessageWorkers::Thread, &workers,
+            CMessageWorkers::ProcessFn(boost::bind(&Recorder::Process, &recorder, _1, _2)),
+            CMessageWorkers::PrepareFn(boost::bind(&Recorder::Prepare, &recorder, _1, _2))));
+    while (!workers.IsActive())
+        MilliSleep(1);
+
+    CNode node1(INVALID_SOCKET, CAddress(), "", true);
+    CNode node2(INVALID_SOCKET, CAddress(), "", true);
+
+    // Like the message handler, submit the next run of a peer once the previous one is done
+    for (int i = 0; i < 10; i++) {
+        Submit(workers, node1, i * 20, (i + 1) * 20);
+        Submit(workers, node2, i * 20, (i + 1) * 20);
+        BOOST_CHECK(WaitIdle(node1));
+        BOOST_CHECK(WaitIdle(node2));
+    }
+
+    threads.interrupt_all();
+    threads.join_all();
+
+    std::vector<int> vNode1, vNode2;
+    for (size_t i = 0; i < recorder.vProcessed.size(); i++)
+        (recorder.vProcessed[i].first == &node1 ? vNode1 : vNode2).push_back(recorder.vProcessed[i].second);
+    BOOST_CHECK_EQUAL(vNode1.size(), 200U);
+    BOOST_CHECK_EQUAL(vNode2.size(), 200U);
+    for (int i = 0; i < (int)vNode1.size(); i++)
+        BOOST_CHECK_EQUAL(vNode1[i], i);
+    for (int i = 0; i < (int)vNode2.size(); i++)
+        BOOST_CHECK_EQUAL(vNode2[i], i);
+    BOOST_CHECK_EQUAL(recorder.nPrepared, 400);
+}
+
+BOOST_AUTO_TEST_CASE(msgworkers_prepare_only)
+{
+    CMessageWorkers workers;
+    Recorder recorder;
+    boost::thread thread(boost::bind(&CMessageWorkers::Thread, &workers,
+        CMessageWorkers::ProcessFn(boost::bind(&Recorder::Process, &recorder, _1, _2)),
+        CMessageWorkers::PrepareFn(boost::bind(&Recorder::Prepare, &recorder, _1, _2))));
+
+    CNode node(INVALID_SOCKET, CAddress(), "", true);
+    {
+        // A message that arrived after the prepared run
+        LOCK(node.cs_vRecvMsg);
+        node.vRecvMsg.push_back(MakeMessage("mnb", 3));
+    }
+    Submit(workers, node, 0, 3, true);
+    BOOST_CHECK(WaitIdle(node));
+
+    thread.interrupt();
+    thread.join();
+
+    // The run is back in front of the queue, in order, and was not processed
+    BOOST_CHECK(recorder.vProcessed.empty());
+    BOOST_CHECK_EQUAL(recorder.nPrepared, 3);
+    LOCK(node.cs_vRecvMsg);
+    BOOST_CHECK_EQUAL(node.vRecvMsg.size(), 4U);
+    for (int i = 0; i < (int)node.vRecvMsg.size(); i++) {
+        int n;
+        node.vRecvMsg[i].vRecv >> n;
+        BOOST_CHECK_EQUAL(n, i);
+        BOOST_CHECK_EQUAL(node.vRecvMsg[i].fPrepared, i < 3);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
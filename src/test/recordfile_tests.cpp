@@ -0,0 +1,102 @@
+// Copyright (c) 2018 The Blocknet developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "recordfile.h"
+#include "util.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(recordfile_tests)
+
+BOOST_AUTO_TEST_CASE(recordfile_roundtrip)
+{
+    std::map<int, std::string> mapObjs;
+    for (int i = 0; i < 10; i++)
+        mapObjs[i] = strprintf("object %d", i);
+
+    CRecordFile::RecordMap mapRecords;
+    CRecordFile::AddMap(mapRecords, 'o', mapObjs);
+    BOOST_CHECK_EQUAL(mapRecords.size(), 10U);
+
+    CRecordFile file("recordfile_test.dat", "RecordFileTest");
+    BOOST_CHECK(file.Write(mapRecords));
+    boost::uintmax_t nSize = boost::filesystem::file_size(GetDataDir() / "recordfile_test.dat");
+
+    // Unchanged records are not written again
+    BOOST_CHECK(file.Write(mapRecords));
+    BOOST_CHECK_EQUAL(boost::filesystem::file_size(GetDataDir() / "recordfile_test.dat"), nSize);
+
+    // Changes and erasures are appended
+    mapObjs[3] = "changed";
+    mapObjs.erase(7);
+    mapRecords.clear();
+    CRecordFile::AddMap(mapRecords, 'o', mapObjs);
+    BOOST_CHECK(file.Write(mapRecords));
+    BOOST_CHECK(boost::filesystem::file_size(GetDataDir() / "recordfile_test.dat") > nSize);
+
+    CRecordFile file2("recordfile_test.dat", "RecordFileTest");
+    CRecordFile::RecordMap mapRead;
+    BOOST_CHECK(file2.Read(mapRead) == CRecordFile::Ok);
+    BOOST_CHECK(mapRead == mapRecords);
+
+    std::map<int, std::string> mapObjsRead;
+    for (CRecordFile::RecordMap::const_iterator it = mapRead.begin(); it != mapRead.end(); ++it) {
+        CDataStream ss(it->second, SER_DISK, CLIENT_VERSION);
+        char chType;
+        ss >> chType;
+        BOOST_CHECK_EQUAL(chType, 'o');
+        CRecordFile::ReadMapEntry(ss, mapObjsRead);
+    }
+    BOOST_CHECK(mapObjsRead == mapObjs);
+
+    // Someone else's file is neither read nor overwritten
+    CRecordFile file3("recordfile_test.dat", "OtherMagic");
+    BOOST_CHECK(file3.Read(mapRead) == CRecordFile::IncorrectMagicMessage);
+    BOOST_CHECK(!file3.Write(mapRecords));
+}
+
+BOOST_AUTO_TEST_CASE(recordfile_corruption)
+{
+    std::map<int, std::string> mapObjs;
+    for (int i = 0; i < 10; i++)
+        mapObjs[i] = strprintf("object %d", i);
+    CRecordFile::RecordMap mapRecords;
+    CRecordFile::AddMap(mapRecords, 'o', mapObjs);
+
+    boost::filesystem::path path = GetDataDir() / "recordfile_corrupt.dat";
+    CRecordFile file("recordfile_corrupt.dat", "RecordFileTest");
+    BOOST_CHECK(file.Write(mapRecords));
+
+    // Flip a byte of the last record's data and cut off part of its checksum
+    std::string strFile;
+    {
+        boost::filesystem::ifstream stream(path, std::ios::binary);
+        strFile.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+    }
+    strFile[strFile.size() - 6] ^= 0x01;
+    {
+        boost::filesystem::ofstream stream(path, std::ios::binary | std::ios::trunc);
+        stream.write(strFile.data(), strFile.size());
+    }
+
+    CRecordFile::RecordMap mapRead;
+    BOOST_CHECK(file.Read(mapRead) == CRecordFile::Ok);
+    BOOST_CHECK_EQUAL(mapRead.size(), 9U);
+
+    {
+        boost::filesystem::ofstream stream(path, std::ios::binary | std::ios::trunc);
+        stream.write(strFile.data(), strFile.size() - 2);
+    }
+    BOOST_CHECK(file.Read(mapRead) == CRecordFile::Ok);
+    BOOST_CHECK_EQUAL(mapRead.size(), 9U);
+
+    // The damage is gone after the next write
+    BOOST_CHECK(file.Write(mapRecords));
+    BOOST_CHECK(file.Read(mapRead) == CRecordFile::Ok);
+    BOOST_CHECK(mapRead == mapRecords);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,119 @@
+// Copyright (c) 2018 The Blocknet developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "clientversion.h"
+#include "key.h"
+#include "obfuscation.h"
+#include "random.h"
+#include "servicenode-budget.h"
+#include "servicenodeman.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(servicenode_budget_tests)
+
+BOOST_AUTO_TEST_CASE(proposal_tallies)
+{
+    CBudgetProposal proposal;
+    std::string strError;
+
+    std::vector<CTxIn> vVoters;
+    for (int i = 0; i < 6; i++)
+        vVoters.push_back(CTxIn(GetRandHash(), 0));
+
+    for (int i = 0; i < 6; i++) {
+        CBudgetVote vote(vVoters[i], proposal.GetHash(), i < 3 ? VOTE_YES : (i < 5 ? VOTE_NO : VOTE_ABSTAIN));
+        BOOST_CHECK(proposal.AddOrUpdateVote(vote, strError));
+    }
+    BOOST_CHECK_EQUAL(proposal.GetYeas(), 3);
+    BOOST_CHECK_EQUAL(proposal.GetNays(), 2);
+    BOOST_CHECK_EQUAL(proposal.GetAbstains(), 1);
+    BOOST_CHECK_EQUAL(proposal.Votes(), 1);
+
+    // A changed vote moves between the tallies
+    CBudgetVote vote(vVoters[3], proposal.GetHash(), VOTE_YES);
+    vote.nTime += BUDGET_VOTE_UPDATE_MIN;
+    BOOST_CHECK(proposal.AddOrUpdateVote(vote, strError));
+    BOOST_CHECK_EQUAL(proposal.GetYeas(), 4);
+    BOOST_CHECK_EQUAL(proposal.GetNays(), 1);
+
+    // Rejected votes don't count
+    vote.nVote = VOTE_NO;
+    BOOST_CHECK(!proposal.AddOrUpdateVote(vote, strError));
+    BOOST_CHECK_EQUAL(proposal.GetYeas(), 4);
+
+    // Copies and deserialized proposals carry the tallies
+    CBudgetProposal copy(proposal);
+    BOOST_CHECK_EQUAL(copy.GetYeas(), 4);
+    BOOST_CHECK_EQUAL(copy.GetNays(), 1);
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << proposal;
+    CBudgetProposal proposal2;
+    ss >> proposal2;
+    BOOST_CHECK_EQUAL(proposal2.GetYeas(), 4);
+    BOOST_CHECK_EQUAL(proposal2.GetNays(), 1);
+    BOOST_CHECK_EQUAL(proposal2.GetAbstains(), 1);
+    BOOST_CHECK_EQUAL(proposal2.GetRatio(), proposal.GetRatio());
+}
+
+static CNetMessage VoteMessage(const CBudgetVote& vote)
+{
+    CNetMessage msg(SER_NETWORK, PROTOCOL_VERSION);
+    msg.vRecv << vote;
+    msg.hdr = CMessageHeader("mvote", msg.vRecv.size());
+    msg.in_data = true;
+    msg.nDataPos = msg.vRecv.size();
+    return msg;
+}
+
+BOOST_AUTO_TEST_CASE(preverify_votes)
+{
+    uint256 nProposalHash = GetRandHash();
+    std::deque<CNetMessage> vMsgs;
+    std::vector<CBudgetVote> vVotes;
+    std::vector<CPubKey> vPubKeys;
+    for (int i = 0; i < 8; i++) {
+        CKey key;
+        key.MakeNewKey(true);
+        CServicenode mn;
+        mn.vin = CTxIn(GetRandHash(), 0);
+        mn.pubKeyServicenode = key.GetPubKey();
+        BOOST_CHECK(mnodeman.Add(mn));
+
+        // Signed without CBudgetVote::Sign, which would verify and cache the signature
+        CBudgetVote vote(mn.vin, nProposalHash, VOTE_YES);
+        std::string strError;
+        BOOST_CHECK(obfuScationSigner.SignMessage(vote.GetSignatureMessage(), strError, vote.vchSig, key));
+        vMsgs.push_back(VoteMessage(vote));
+        vVotes.push_back(vote);
+        vPubKeys.push_back(mn.pubKeyServicenode);
+    }
+
+    // Votes of unknown servicenodes and garbage are left to the message handler
+    CBudgetVote voteUnknown(CTxIn(GetRandHash(), 0), nProposalHash, VOTE_NO);
+    vMsgs.push_back(VoteMessage(voteUnknown));
+    CNetMessage msgGarbage(SER_NETWORK, PROTOCOL_VERSION);
+    msgGarbage.hdr = CMessageHeader("mvote", 0);
+    vMsgs.push_back(msgGarbage);
+
+    size_t nEntries, nEntriesAfter;
+    uint64_t nHits, nHitsAfter, nMisses;
+    obfuScationSigner.GetCacheStats(nEntries, nHits, nMisses);
+    budget.PreverifyVotes(vMsgs);
+    obfuScationSigner.GetCacheStats(nEntriesAfter, nHits, nMisses);
+    BOOST_CHECK_EQUAL(nEntriesAfter, nEntries + vVotes.size());
+
+    // The votes are now verified from the cache
+    for (size_t i = 0; i < vVotes.size(); i++) {
+        std::string strError;
+        BOOST_CHECK(obfuScationSigner.VerifyMessage(vPubKeys[i], vVotes[i].vchSig, vVotes[i].GetSignatureMessage(), strError));
+    }
+    obfuScationSigner.GetCacheStats(nEntriesAfter, nHitsAfter, nMisses);
+    BOOST_CHECK_EQUAL(nHitsAfter, nHits + vVotes.size());
+
+    mnodeman.Clear();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,102 @@
+// Copyright (c) 2018 The Blocknet developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "clientversion.h"
+#include "random.h"
+#include "servicenode-payments.h"
+#include "servicenode.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(servicenode_payments_tests)
+
+BOOST_AUTO_TEST_CASE(block_payees_best)
+{
+    CScript a = CScript() << OP_1;
+    CScript b = CScript() << OP_2;
+    CScript c = CScript() << OP_3;
+    CScript payee;
+
+    CServicenodeBlockPayees blockPayees(100);
+    BOOST_CHECK(!blockPayees.GetPayee(payee));
+
+    BOOST_CHECK_EQUAL(blockPayees.AddPayee(a, 1), 1);
+    BOOST_CHECK_EQUAL(blockPayees.AddPayee(b, 1), 1);
+    BOOST_CHECK_EQUAL(blockPayees.AddPayee(b, 1), 2);
+    BOOST_CHECK(blockPayees.GetPayee(payee) && payee == b);
+
+    // On a tie the payee voted for first wins
+    BOOST_CHECK_EQUAL(blockPayees.AddPayee(a, 1), 2);
+    BOOST_CHECK(blockPayees.GetPayee(payee) && payee == a);
+    blockPayees.AddPayee(c, 3);
+    BOOST_CHECK(blockPayees.GetPayee(payee) && payee == c);
+
+    // The best payee is restored on deserialization
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << blockPayees;
+    CServicenodeBlockPayees blockPayees2;
+    ss >> blockPayees2;
+    BOOST_CHECK(blockPayees2.GetPayee(payee) && payee == c);
+    BOOST_CHECK(blockPayees2.HasPayeeWithVotes(a, 2));
+}
+
+static void AddWinner(CServicenodePayments& payments, int nBlockHeight, const CScript& payee, int nVotes)
+{
+    mapCacheBlockHashes[nBlockHeight - 100] = GetRandHash();
+    for (int i = 0; i < nVotes; i++) {
+        CServicenodePaymentWinner winner(CTxIn(GetRandHash(), 0));
+        winner.nBlockHeight = nBlockHeight;
+        winner.AddPayee(payee);
+        BOOST_CHECK(payments.AddWinningServicenode(winner));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(payee_heights)
+{
+    CScript a = CScript() << OP_1;
+    CScript b = CScript() << OP_2;
+    CScript c = CScript() << OP_3;
+
+    // The test chain is only the genesis block, old payments have negative heights
+    CServicenodePayments payments;
+    AddWinner(payments, -3000, a, MNPAYMENTS_PAID_VOTES);
+    AddWinner(payments, -2500, a, MNPAYMENTS_PAID_VOTES - 1);
+    AddWinner(payments, -2500, b, MNPAYMENTS_PAID_VOTES);
+    AddWinner(payments, -20, a, MNPAYMENTS_PAID_VOTES + 1);
+    AddWinner(payments, 5, c, MNPAYMENTS_PAID_VOTES);
+
+    // A block counts as paid once the payee has MNPAYMENTS_PAID_VOTES votes for it
+    BOOST_CHECK_EQUAL(payments.GetLastPaidHeight(a, 0), -20);
+    BOOST_CHECK_EQUAL(payments.GetLastPaidHeight(a, -21), -3000);
+    BOOST_CHECK_EQUAL(payments.GetLastPaidHeight(a, -3001), 0);
+    BOOST_CHECK_EQUAL(payments.GetLastPaidHeight(b, 0), -2500);
+    BOOST_CHECK_EQUAL(payments.GetLastPaidHeight(c, 0), 0);
+    BOOST_CHECK_EQUAL(payments.GetLastPaidHeight(c, 10), 5);
+
+    std::set<CScript> setPayees;
+    payments.GetScheduledPayees(-1, setPayees);
+    BOOST_CHECK(setPayees.size() == 1 && setPayees.count(c));
+    payments.GetScheduledPayees(5, setPayees);
+    BOOST_CHECK(setPayees.empty());
+
+    // The index is rebuilt on deserialization
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << payments;
+    CServicenodePayments payments2;
+    ss >> payments2;
+    BOOST_CHECK_EQUAL(payments2.GetLastPaidHeight(a, -21), -3000);
+    BOOST_CHECK_EQUAL(payments2.GetLastPaidHeight(b, 0), -2500);
+
+    // Blocks dropped from the payment list are dropped from the index
+    payments.CleanPaymentList();
+    BOOST_CHECK_EQUAL(payments.mapServicenodeBlocks.size(), 2U);
+    BOOST_CHECK_EQUAL(payments.GetLastPaidHeight(a, 0), -20);
+    BOOST_CHECK_EQUAL(payments.GetLastPaidHeight(a, -21), 0);
+    BOOST_CHECK_EQUAL(payments.GetLastPaidHeight(b, 0), 0);
+    BOOST_CHECK_EQUAL(payments.GetLastPaidHeight(c, 10), 5);
+
+    mapCacheBlockHashes.clear();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,122 @@
+// Copyright (c) 2018 The Blocknet developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "random.h"
+#include "servicenodeman.h"
+#include "version.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(servicenodeman_tests)
+
+static CServicenode RandomServicenode(unsigned int i)
+{
+    CServicenode mn;
+    mn.vin = CTxIn(GetRandHash(), i % 4);
+
+    std::vector<unsigned char> vch(33);
+    GetRandBytes(&vch[0], vch.size());
+    vch[0] = 0x02;
+    mn.pubKeyServicenode = CPubKey(vch);
+    GetRandBytes(&vch[1], vch.size() - 1);
+    mn.pubKeyCollateralAddress = CPubKey(vch);
+
+    mn.addr = CService(strprintf("10.%d.%d.%d", (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff), 41412);
+    return mn;
+}
+
+BOOST_AUTO_TEST_CASE(servicenodeman_find)
+{
+    CServicenodeMan man;
+    std::vector<CServicenode> vNodes;
+    for (unsigned int i = 0; i < 100; i++) {
+        vNodes.push_back(RandomServicenode(i));
+        BOOST_CHECK(man.Add(vNodes.back()));
+    }
+    BOOST_CHECK(!man.Add(vNodes[10]));
+    BOOST_CHECK_EQUAL(man.size(), 100);
+
+    BOOST_FOREACH (const CServicenode& mn, vNodes) {
+        BOOST_CHECK(man.Find(mn.vin) && man.Find(mn.vin)->vin == mn.vin);
+        BOOST_CHECK(man.Find(mn.pubKeyServicenode) && man.Find(mn.pubKeyServicenode)->vin == mn.vin);
+        BOOST_CHECK(man.Find(GetScriptForDestination(mn.pubKeyCollateralAddress.GetID()))->vin == mn.vin);
+        BOOST_CHECK(man.Find(mn.addr.ToString())->vin == mn.vin);
+    }
+
+    // Positions shift after a removal
+    man.Remove(vNodes[0].vin);
+    BOOST_CHECK(man.Find(vNodes[0].vin) == NULL);
+    BOOST_CHECK(man.Find(vNodes[0].pubKeyServicenode) == NULL);
+    BOOST_CHECK(man.Find(vNodes[0].addr.ToString()) == NULL);
+    for (unsigned int i = 1; i < vNodes.size(); i++) {
+        BOOST_CHECK(man.Find(vNodes[i].vin)->vin == vNodes[i].vin);
+        BOOST_CHECK(man.Find(vNodes[i].addr.ToString())->vin == vNodes[i].vin);
+    }
+
+    // Keys changed by a newer broadcast
+    CServicenode* pmn = man.Find(vNodes[1].vin);
+    CServicenodeBroadcast mnb(RandomServicenode(1000));
+    mnb.vin = vNodes[1].vin;
+    mnb.sigTime = pmn->sigTime + 1;
+    BOOST_CHECK(man.UpdateFromNewBroadcast(*pmn, mnb));
+    BOOST_CHECK(man.Find(vNodes[1].pubKeyServicenode) == NULL);
+    BOOST_CHECK(man.Find(vNodes[1].addr.ToString()) == NULL);
+    BOOST_CHECK(man.Find(mnb.pubKeyServicenode)->vin == mnb.vin);
+    BOOST_CHECK(man.Find(mnb.addr.ToString())->vin == mnb.vin);
+
+    man.Clear();
+    BOOST_CHECK(man.Find(vNodes[2].vin) == NULL);
+}
+
+BOOST_AUTO_TEST_CASE(servicenodeman_dseg_digests)
+{
+    // dseg skips local network addresses
+    CServicenodeMan man, manTheirs;
+    std::vector<CServicenode> vNodes;
+    for (unsigned int i = 0; i < 100; i++) {
+        vNodes.push_back(RandomServicenode(i));
+        vNodes.back().addr = CService(strprintf("11.0.%d.%d", i >> 8, i & 0xff), 41412);
+        BOOST_CHECK(man.Add(vNodes.back()));
+    }
+
+    // The peer's list only differs in the broadcast of one entry
+    for (unsigned int i = 0; i < vNodes.size(); i++) {
+        CServicenode mn(vNodes[i]);
+        if (i == 42)
+            mn.sigTime++;
+        BOOST_CHECK(manTheirs.Add(mn));
+    }
+    std::vector<uint64_t> vOurs = man.GetListDigests(), vTheirs = manTheirs.GetListDigests();
+    BOOST_CHECK_EQUAL(vOurs.size(), (size_t)SERVICENODES_DSEG_BUCKETS);
+    std::set<unsigned int> setDiffering;
+    for (unsigned int i = 0; i < vOurs.size(); i++) {
+        if (vOurs[i] != vTheirs[i])
+            setDiffering.insert(i);
+    }
+    BOOST_CHECK(!setDiffering.empty() && setDiffering.size() <= 2);
+
+    // Only the entries of the differing buckets are sent, including the changed one
+    CNode node(INVALID_SOCKET, CAddress(), "", true);
+    std::string strCommand = "dseg";
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << CTxIn() << vTheirs;
+    man.ProcessMessage(&node, strCommand, ss);
+    uint256 hashChanged = CServicenodeBroadcast(vNodes[42]).GetHash();
+    bool fChangedSent = false;
+    BOOST_CHECK(!node.vInventoryToSend.empty() && node.vInventoryToSend.size() < vNodes.size());
+    BOOST_FOREACH (const CInv& inv, node.vInventoryToSend) {
+        BOOST_CHECK(setDiffering.count(inv.hash.Get64(0) % SERVICENODES_DSEG_BUCKETS));
+        fChangedSent |= inv.hash == hashChanged;
+    }
+    BOOST_CHECK(fChangedSent);
+
+    // A dseg without digests gets the full list
+    CNode node2(INVALID_SOCKET, CAddress(), "", true);
+    CDataStream ss2(SER_NETWORK, PROTOCOL_VERSION);
+    ss2 << CTxIn();
+    man.ProcessMessage(&node2, strCommand, ss2);
+    BOOST_CHECK_EQUAL(node2.vInventoryToSend.size(), vNodes.size());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
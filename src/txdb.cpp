@@ -28,18 +28,28 @@ void static BatchWriteHashBestChain(CLevelDBBatch& batch, const uint256& hash)
     batch.Write('B', hash);
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe)
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, CLevelDBOptions::FromArgs("chainstate")),
+                                                                         nReads(0),
+                                                                         nReadMicros(0)
 {
 }
 
 bool CCoinsViewDB::GetCoins(const uint256& txid, CCoins& coins) const
 {
-    return db.Read(make_pair('c', txid), coins);
+    int64_t nStart = GetTimeMicros();
+    bool fFound = db.Read(make_pair('c', txid), coins);
+    nReadMicros += GetTimeMicros() - nStart;
+    nReads++;
+    return fFound;
 }
 
 bool CCoinsViewDB::HaveCoins(const uint256& txid) const
 {
-    return db.Exists(make_pair('c', txid));
+    int64_t nStart = GetTimeMicros();
+    bool fFound = db.Exists(make_pair('c', txid));
+    nReadMicros += GetTimeMicros() - nStart;
+    nReads++;
+    return fFound;
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const
@@ -51,27 +61,176 @@ uint256 CCoinsViewDB::GetBestBlock() const
 }
 
 bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+{
+    bool fOk = WriteCoins(mapCoins, hashBlock);
+    mapCoins.clear();
+    return fOk;
+}
+
+bool CCoinsViewDB::WriteCoins(const CCoinsMap& mapCoins, const uint256& hashBlock)
 {
     CLevelDBBatch batch;
     size_t count = 0;
     size_t changed = 0;
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
             BatchWriteCoins(batch, it->first, it->second.coins);
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
     }
     if (hashBlock != uint256())
         BatchWriteHashBestChain(batch, hashBlock);
 
+    // Lookups missing the coins cache end up here; how fast they are depends on the -chainstate* options
+    uint64_t nReadsDone = nReads.exchange(0);
+    int64_t nMicros = nReadMicros.exchange(0);
+    LogPrint("bench", "- Coin database lookups since the last write: %u, %.2fms (%.4fms/lookup)\n", (unsigned int)nReadsDone, nMicros * 0.001, nReadsDone ? nMicros * 0.001 / nReadsDone : 0);
+
     LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
     return db.WriteBatch(batch);
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe)
+CCoinsViewBackgroundFlush::CCoinsViewBackgroundFlush(CCoinsViewDB* dbIn, bool fBackgroundIn) : CCoinsViewBacked(dbIn),
+                                                                                             db(dbIn),
+                                                                                             fBackground(fBackgroundIn),
+                                                                                             fWriting(false),
+                                                                                             fFailed(false),
+                                                                                             fQuit(false)
+{
+    if (fBackground)
+        thread = boost::thread(&CCoinsViewBackgroundFlush::ThreadWrite, this);
+}
+
+CCoinsViewBackgroundFlush::~CCoinsViewBackgroundFlush()
+{
+    if (thread.joinable()) {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (fWriting && !fFailed)
+                cond.wait(lock);
+            fQuit = true;
+        }
+        cond.notify_all();
+        thread.join();
+    }
+}
+
+bool CCoinsViewBackgroundFlush::GetCoins(const uint256& txid, CCoins& coins) const
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        CCoinsMap::const_iterator it = mapSnapshot.find(txid);
+        if (it != mapSnapshot.end()) {
+            coins = it->second.coins;
+            return true;
+        }
+    }
+    return base->GetCoins(txid, coins);
+}
+
+bool CCoinsViewBackgroundFlush::HaveCoins(const uint256& txid) const
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        CCoinsMap::const_iterator it = mapSnapshot.find(txid);
+        if (it != mapSnapshot.end())
+            return !it->second.coins.IsPruned();
+    }
+    return base->HaveCoins(txid);
+}
+
+uint256 CCoinsViewBackgroundFlush::GetBestBlock() const
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (fWriting && hashSnapshot != uint256())
+            return hashSnapshot;
+    }
+    return base->GetBestBlock();
+}
+
+bool CCoinsViewBackgroundFlush::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+{
+    if (!Sync())
+        return false;
+    if (!fBackground)
+        return base->BatchWrite(mapCoins, hashBlock);
+
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        assert(mapSnapshot.empty());
+        for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
+            if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+                CCoinsCacheEntry& entry = mapSnapshot[it->first];
+                entry.coins.swap(it->second.coins);
+                entry.flags = it->second.flags;
+            }
+        }
+        hashSnapshot = hashBlock;
+        fWriting = true;
+    }
+    mapCoins.clear();
+    cond.notify_all();
+    return true;
+}
+
+bool CCoinsViewBackgroundFlush::GetStats(CCoinsStats& stats) const
+{
+    if (!Sync())
+        return false;
+    return base->GetStats(stats);
+}
+
+bool CCoinsViewBackgroundFlush::Sync() const
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (fWriting && !fFailed)
+        cond.wait(lock);
+    return !fFailed;
+}
+
+void CCoinsViewBackgroundFlush::ThreadWrite()
+{
+    RenameThread("blocknetdx-coinflush");
+    while (true) {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (!fWriting && !fQuit)
+                cond.wait(lock);
+            if (fQuit)
+                return;
+        }
+
+        // The snapshot is not modified while fWriting is set, so it can be
+        // read here without holding the lock.
+        int64_t nStart = GetTimeMillis();
+        bool fOk = false;
+        try {
+            fOk = db->WriteCoins(mapSnapshot, hashSnapshot);
+        } catch (const std::exception& e) {
+            LogPrintf("%s : %s\n", __func__, e.what());
+        }
+
+        CCoinsMap mapWritten;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (fOk) {
+                mapSnapshot.swap(mapWritten);
+                fWriting = false;
+            } else {
+                // Keep serving the snapshot; the next flush or Sync() reports the failure.
+                LogPrintf("%s : failed to write %u transactions to the coin database\n", __func__, (unsigned int)mapSnapshot.size());
+                fFailed = true;
+            }
+        }
+        cond.notify_all();
+        if (fOk)
+            LogPrint("coindb", "Background flush of %u transactions took %dms\n", (unsigned int)mapWritten.size(), GetTimeMillis() - nStart);
+    }
+}
+
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe, CLevelDBOptions::FromArgs("blockindex"))
 {
 }
 
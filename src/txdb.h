@@ -10,11 +10,16 @@
 #include "coins.h"
 #include "chain.h"
 
+#include <atomic>
 #include <map>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
 class CBlockFileInfo;
 class CDiskTxPos;
 
@@ -24,6 +29,8 @@ static const int64_t nDefaultDbCache = 100;
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 4096 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
+//! -backgroundflush default
+static const bool DEFAULT_BACKGROUND_FLUSH = false;
 
 /** CCoinsView backed by the LevelDB coin database (chainstate/) */
 class CCoinsViewDB : public CCoinsView
@@ -31,6 +38,10 @@ class CCoinsViewDB : public CCoinsView
 protected:
     CLevelDBWrapper db;
 
+    //! Lookups that reached the database and the time they took, logged (-debug=bench) and reset by every write
+    mutable std::atomic<uint64_t> nReads;
+    mutable std::atomic<int64_t> nReadMicros;
+
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
@@ -39,6 +50,60 @@ public:
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
     bool GetStats(CCoinsStats& stats) const;
+
+    //! Write the dirty entries of mapCoins and the best block in one atomic batch, leaving mapCoins untouched
+    bool WriteCoins(const CCoinsMap& mapCoins, const uint256& hashBlock);
+};
+
+/**
+ * Layer between the coins cache and CCoinsViewDB that can commit a flush on a
+ * background thread. In background mode, BatchWrite() only moves the dirty
+ * entries into a snapshot and returns; the snapshot keeps answering reads
+ * until a writer thread has committed it, so validation can continue against
+ * the (now empty) cache above while LevelDB works. The coins and the best
+ * block hash go into a single LevelDB batch, so the database always holds a
+ * complete flush. At most one write is in flight at any time.
+ */
+class CCoinsViewBackgroundFlush : public CCoinsViewBacked
+{
+private:
+    CCoinsViewDB* db;
+    bool fBackground;
+
+    //! Protects the snapshot and the flags below
+    mutable boost::mutex mutex;
+    //! Signalled when a write is queued, completes or the writer should stop
+    mutable boost::condition_variable cond;
+
+    //! Entries being written, and the best block they correspond to
+    CCoinsMap mapSnapshot;
+    uint256 hashSnapshot;
+    //! Whether a snapshot is queued or being written
+    bool fWriting;
+    //! Whether the last background write failed; sticky until shutdown
+    bool fFailed;
+    bool fQuit;
+
+    boost::thread thread;
+
+    void ThreadWrite();
+
+    // disable copy
+    CCoinsViewBackgroundFlush(const CCoinsViewBackgroundFlush&);
+    CCoinsViewBackgroundFlush& operator=(const CCoinsViewBackgroundFlush&);
+
+public:
+    CCoinsViewBackgroundFlush(CCoinsViewDB* dbIn, bool fBackgroundIn);
+    ~CCoinsViewBackgroundFlush();
+
+    bool GetCoins(const uint256& txid, CCoins& coins) const;
+    bool HaveCoins(const uint256& txid) const;
+    uint256 GetBestBlock() const;
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
+    bool GetStats(CCoinsStats& stats) const;
+
+    //! Wait for the write in flight (if any) to be committed; returns false if it failed
+    bool Sync() const;
 };
 
 /** Access to the block database (blocks/index/) */
@@ -544,13 +544,11 @@ void App::onMessageReceived(const std::vector<unsigned char> & id,
                             const std::vector<unsigned char> & message,
                             CValidationState & /*state*/)
 {
-    if (isKnownMessage(message))
+    if (!addToKnown(message))
     {
         return;
     }
 
-    addToKnown(message);
-
     if (!Session::checkXBridgePacketVersion(message))
     {
         // TODO state.DoS()
@@ -633,13 +631,11 @@ void App::onMessageReceived(const std::vector<unsigned char> & id,
 void App::onBroadcastReceived(const std::vector<unsigned char> & message,
                               CValidationState & state)
 {
-    if (isKnownMessage(message))
+    if (!addToKnown(message))
     {
         return;
     }
 
-    addToKnown(message);
-
     if (!Session::checkXBridgePacketVersion(message))
     {
         // TODO state.DoS()
@@ -1088,24 +1084,24 @@ bool App::isKnownMessage(const uint256 & hash)
 
 //*****************************************************************************
 //*****************************************************************************
-void App::addToKnown(const std::vector<unsigned char> & message)
+bool App::addToKnown(const std::vector<unsigned char> & message)
 {
     // add to known
     LOCK(m_p->m_messagesLock);
     // clear memory if it's larger than mempool threshold
     clearMempool();
-    m_p->m_processedMessages.insert(Hash(message.begin(), message.end()));
+    return m_p->m_processedMessages.insert(Hash(message.begin(), message.end())).second;
 }
 
 //*****************************************************************************
 //*****************************************************************************
-void App::addToKnown(const uint256 & hash)
+bool App::addToKnown(const uint256 & hash)
 {
     // add to known
     LOCK(m_p->m_messagesLock);
     // clear memory if it's larger than mempool threshold
     clearMempool();
-    m_p->m_processedMessages.insert(hash);
+    return m_p->m_processedMessages.insert(hash).second;
 }
 
 //******************************************************************************
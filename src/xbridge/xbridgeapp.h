@@ -387,9 +387,10 @@ public:
     /**
      * @brief addToKnown - add message to queue of processed messages
      * @param message
+     * @return true, if message was not known before
      */
-    void addToKnown(const std::vector<unsigned char> & message);
-    void addToKnown(const uint256 & hash);
+    bool addToKnown(const std::vector<unsigned char> & message);
+    bool addToKnown(const uint256 & hash);
 
     //
     /**